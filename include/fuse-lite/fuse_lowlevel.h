@@ -1091,6 +1091,14 @@ void *fuse_req_userdata(fuse_req_t req);
  */
 const struct fuse_ctx *fuse_req_ctx(fuse_req_t req);
 
+/**
+ * Get the unique identifier of the request
+ *
+ * @param req request handle
+ * @return the identifier assigned by the kernel
+ */
+uint64_t fuse_req_unique(fuse_req_t req);
+
 /**
  * Callback function for an interrupt
  *
@@ -200,6 +200,16 @@ struct _ntfs_attr {
 	s8 unused_runs; /* pre-reserved entries available */
 };
 
+/*
+ *	A file which got clusters reserved beyond its end by this mount,
+ *	only these reservations are freed when the file is closed.
+ */
+
+struct RESERVATION {
+	struct RESERVATION *next;
+	u64 inum;		/* inode number of the file */
+} ;
+
 /**
  * enum ntfs_attr_state_bits - bits for the state field in the ntfs_attr
  * structure
@@ -212,6 +222,7 @@ typedef enum {
 	NA_DataAppending,	/* 1: Attribute is being appended to */
 	NA_ComprClosing,	/* 1: Compressed attribute is being closed */
 	NA_RunlistDirty,	/* 1: Runlist has been updated */
+	NA_Preallocating,	/* 1: Space may be reserved beyond the end */
 } ntfs_attr_state_bits;
 
 #define  test_nattr_flag(na, flag)	 test_bit(NA_##flag, (na)->state)
@@ -246,6 +257,10 @@ typedef enum {
 #define NAttrSetComprClosing(na)	set_nattr_flag(na, ComprClosing)
 #define NAttrClearComprClosing(na)	clear_nattr_flag(na, ComprClosing)
 
+#define NAttrPreallocating(na)		test_nattr_flag(na, Preallocating)
+#define NAttrSetPreallocating(na)	set_nattr_flag(na, Preallocating)
+#define NAttrClearPreallocating(na)	clear_nattr_flag(na, Preallocating)
+
 #define GenNAttrIno(func_name, flag)			\
 extern int NAttr##func_name(ntfs_attr *na);		\
 extern void NAttrSet##func_name(ntfs_attr *na);		\
@@ -352,6 +367,8 @@ extern int ntfs_attr_update_mapping_pairs(ntfs_attr *na, VCN from_vcn);
 
 extern int ntfs_attr_truncate(ntfs_attr *na, const s64 newsize);
 extern int ntfs_attr_truncate_solid(ntfs_attr *na, const s64 newsize);
+extern int ntfs_attr_trim(ntfs_attr *na);
+extern void ntfs_attr_release_reservations(ntfs_volume *vol);
 
 /**
  * get_attribute_value_length - return the length of the value of an attribute
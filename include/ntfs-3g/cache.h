@@ -60,6 +60,16 @@ struct CACHED_LOOKUP {
 	u64 inum;
 } ;
 
+struct CACHED_LISTING {
+	struct CACHED_LISTING *next;
+	struct CACHED_LISTING *previous;
+	const char *listing;
+	size_t size;
+		/* above fields must match "struct CACHED_GENERIC" */
+	u64 inum;
+	int count;
+} ;
+
 enum {
 	CACHE_FREE = 1,
 	CACHE_NOHASH = 2
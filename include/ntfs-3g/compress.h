@@ -26,6 +26,17 @@
 #include "types.h"
 #include "attrib.h"
 
+/*
+ *	Levels of effort for compressing, selecting how many earlier
+ *	positions are examined for finding the longest match.
+ */
+
+enum {
+	COMPRESSION_LEVEL_FAST = 1,	/* single probe, greedy parsing */
+	COMPRESSION_LEVEL_NORMAL = 2,	/* a few probes, lazy parsing */
+	COMPRESSION_LEVEL_BEST = 3,	/* many probes, lazy parsing */
+} ;
+
 extern s64 ntfs_compressed_attr_pread(ntfs_attr *na, s64 pos, s64 count,
 		void *b);
 
@@ -118,6 +118,8 @@ typedef int (*ntfs_filldir_t)(void *dirent, const ntfschar *name,
 
 extern int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
 		void *dirent, ntfs_filldir_t filldir);
+extern int ntfs_readdir_after(ntfs_inode *dir_ni, const ntfschar *name,
+		int name_len, void *dirent, ntfs_filldir_t filldir);
 
 ntfs_inode *ntfs_dir_parent_inode(ntfs_inode *ni);
 u32 ntfs_interix_types(ntfs_inode *ni);
@@ -128,6 +130,7 @@ int ntfs_set_ntfs_dos_name(ntfs_inode *ni, ntfs_inode *dir_ni,
 			const char *value, size_t size,	int flags);
 int ntfs_remove_ntfs_dos_name(ntfs_inode *ni, ntfs_inode *dir_ni);
 int ntfs_dir_link_cnt(ntfs_inode *ni);
+void ntfs_dir_forget_listing(ntfs_inode *dir_ni);
 
 #if CACHE_INODE_SIZE
 
@@ -138,5 +141,13 @@ extern int ntfs_dir_lookup_hash(const struct CACHED_GENERIC *cached);
 
 #endif
 
+#if CACHE_LISTING_SIZE
+
+struct CACHED_GENERIC;
+
+extern int ntfs_dir_listing_hash(const struct CACHED_GENERIC *cached);
+
+#endif
+
 #endif /* defined _NTFS_DIR_H */
 
@@ -66,6 +66,31 @@
 typedef int (*COLLATE)(ntfs_volume *vol, const void *data1, int len1,
 					 const void *data2, int len2);
 
+/*
+ *	An index block of a directory modified but not written yet,
+ *	the block (without its fixups) follows the structure.
+ */
+
+struct DEFERRED_INDEX_BLOCK {
+	struct DEFERRED_INDEX_BLOCK *next;
+	s64 pos;		/* position in the index allocation */
+	u32 size;
+} ;
+
+/*
+ *	The deferred index blocks of a directory, they are kept along
+ *	with the volume so that all the copies of the directory inode
+ *	see them.
+ */
+
+struct DEFERRED_INDEX {
+	struct DEFERRED_INDEX *next;
+	struct DEFERRED_INDEX_BLOCK *blocks;	/* ordered by position */
+	u64 inum;		/* inode number of the directory */
+	int count;		/* count of blocks */
+	s64 stamp;		/* when the first block was deferred */
+} ;
+
 /**
  * struct ntfs_index_context -
  * @ni:			inode containing the @entry described by this context
@@ -150,6 +175,14 @@ extern int ntfs_index_add_filename(ntfs_inode *ni, FILE_NAME_ATTR *fn,
 extern int ntfs_index_remove(ntfs_inode *dir_ni, ntfs_inode *ni,
 		const void *key, const int keylen);
 
+extern s64 ntfs_index_block_pread(ntfs_attr *ia_na, s64 pos, u32 size,
+		INDEX_BLOCK *dst);
+extern int ntfs_index_flush_deferred(ntfs_inode *ni);
+extern void ntfs_index_drop_deferred(ntfs_inode *ni);
+extern int ntfs_index_sync_deferred(ntfs_volume *vol, BOOL all);
+extern BOOL ntfs_index_has_deferred(ntfs_volume *vol);
+extern int ntfs_index_release_deferred(ntfs_volume *vol);
+
 extern INDEX_ROOT *ntfs_index_root_get(ntfs_inode *ni, ATTR_RECORD *attr);
 
 extern VCN ntfs_ie_get_vcn(INDEX_ENTRY *ie);
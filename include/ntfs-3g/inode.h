@@ -52,6 +52,7 @@ typedef enum {
 	NI_v3_Extensions,	/* 1: JPA v3.x extensions present. */
 	NI_TimesSet,		/* 1: Use times which were set */
 	NI_KnownSize,		/* 1: Set if sizes are meaningful */
+	NI_KnownWslDev,		/* 1: Set if wsl_rdev is meaningful */
 } ntfs_inode_state_bits;
 
 #define  test_nino_flag(ni, flag)	   test_bit(NI_##flag, (ni)->state)
@@ -164,6 +165,10 @@ struct _ntfs_inode {
 	le32 security_id;
 	le64 quota_charged;
 	le64 usn;
+				/* cached data, freed with the inode */
+	REPARSE_POINT *reparse;	/* copy of the reparse data, if read */
+	u32 reparse_size;	/* size of the reparse data */
+	dev_t wsl_rdev;		/* WSL device, if NI_KnownWslDev is set */
 };
 
 typedef enum {
@@ -27,6 +27,7 @@
 #include "types.h"
 #include "runlist.h"
 #include "volume.h"
+#include "cache.h"
 
 /**
  * enum NTFS_CLUSTER_ALLOCATION_ZONES -
@@ -47,5 +48,28 @@ extern int ntfs_cluster_free_basic(ntfs_volume *vol, s64 lcn, s64 count);
 extern int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn,
 		s64 count);
 
+/*
+ *	Entry in the placement cache : where the next small file
+ *	of a directory should have its data allocated
+ */
+
+struct CACHED_PLACEMENT {
+	struct CACHED_PLACEMENT *next;
+	struct CACHED_PLACEMENT *previous;
+	void *variable;
+	size_t varsize;
+		/* above fields must match "struct CACHED_GENERIC" */
+	u64 dir;
+	LCN next_lcn;
+} ;
+
+extern u64 ntfs_placement_group(ntfs_attr *na, s64 size);
+extern LCN ntfs_placement_hint(ntfs_volume *vol, u64 group);
+extern void ntfs_placement_update(ntfs_volume *vol, u64 group,
+		const runlist *rl);
+extern LCN ntfs_placement_continue(ntfs_attr *na, LCN lcn,
+		s64 allocated, s64 size);
+extern int ntfs_placement_hash(const struct CACHED_GENERIC *cached);
+
 #endif /* defined _NTFS_LCNALLOC_H */
 
@@ -22,11 +22,21 @@
 #ifndef _NTFS_PARAM_H
 #define _NTFS_PARAM_H
 
-#define CACHE_INODE_SIZE 32	/* inode cache, zero or >= 3 and not too big */
+#define CACHE_INODE_SIZE 256	/* inode cache, zero or >= 3 and not too big */
 #define CACHE_NIDATA_SIZE 64	/* idata cache, zero or >= 3 and not too big */
 #define CACHE_LOOKUP_SIZE 64	/* lookup cache, zero or >= 3 and not too big */
+#define CACHE_NEGATIVE_SIZE 64	/* missing names cache, zero or >= 3 and not too big */
 #define CACHE_SECURID_SIZE 16    /* securid cache, zero or >= 3 and not too big */
 #define CACHE_LEGACY_SIZE 8    /* legacy cache size, zero or >= 3 and not too big */
+#define CACHE_GROUPS_SIZE 32	/* groups cache, zero or >= 3 and not too big */
+#define CACHE_GROUPS_TTL 2	/* seconds a cached group list remains valid */
+#define CACHE_INHERITED_SIZE 64	/* inherited ids cache, zero or >= 3 and not too big */
+#define CACHE_SYMLINK_SIZE 32	/* symlink targets cache, zero or >= 3 and not too big */
+#define CACHE_SYMLINK_DIRS 8	/* max directories a cached symlink target depends on */
+#define CACHE_PLACEMENT_SIZE 32	/* directory placement cache, zero or >= 3 and not too big */
+#define CACHE_LISTING_SIZE 16	/* directory listings cache, zero or >= 3 and not too big */
+#define CACHE_LISTING_MAX 524288 /* max index allocation of a cached listing */
+#define SECURE_INDEX_MAX 100000 /* max descriptors of $Secure in memory */
 
 #define FORCE_FORMAT_v1x 0	/* Insert security data as in NTFS v1.x */
 #define OWNERFROMACL 1		/* Get the owner from ACL (not Windows owner) */
@@ -62,6 +72,9 @@ enum {
  */
 
 #define DEFAULT_DMTIME 60 /* default 1mn for delay_mtime */
+#define DEFAULT_DELAY_ALLOC 1024 /* default KiB appended per file for delay_alloc */
+#define DELAY_ALLOC_FILES 16 /* files which may have delayed data together */
+#define TRACE_RECORDS 65536 /* records kept in the trace ring buffer */
 
 /*
  *		Use of big write buffers
@@ -83,6 +96,47 @@ enum {
 	/* only update the final extent of a runlist when appending data */
 #define PARTIAL_RUNLIST_UPDATING 1
 
+/*
+ *		Parameters for speculative preallocation
+ *
+ *	When the option prealloc is set, a file appended to beyond
+ *	PREALLOC_MIN bytes gets a reservation of clusters beyond its end
+ *	as big as its current size, up to PREALLOC_MAX bytes and to
+ *	1/PREALLOC_FREE_SHARE of the free space.
+ */
+
+#define PREALLOC_MIN 65536
+#define PREALLOC_MAX 67108864
+#define PREALLOC_FREE_SHARE 16
+
+/*
+ *		Parameters for placement of small files
+ *
+ *	The data of files up to PLACEMENT_SMALL_FILE bytes is placed
+ *	next to the data of their siblings, bigger allocations are made
+ *	from the general allocator position.
+ */
+
+#define PLACEMENT_SMALL_FILE 262144
+
+/*
+ *		Parameters for deferred writing of directory index blocks
+ *
+ *	When the volume is mounted with option defer_index and directory
+ *	inodes are kept in cache after being closed (CACHE_NIDATA_SIZE not
+ *	zero), the index blocks updated in place are kept in memory and written when the directory is dropped from
+ *	the cache, on fsync, or when the first one was modified more than
+ *	DEFERRED_INDEX_DELAY seconds ago (checked on close, and by the
+ *	drivers after each request and while idle). New or split blocks,
+ *	and blocks from which an entry is removed, are always written
+ *	immediately. At most DEFERRED_INDEX_BLOCKS
+ *	blocks are kept per directory. Zero blocks means writing
+ *	immediately.
+ */
+
+#define DEFERRED_INDEX_BLOCKS 16
+#define DEFERRED_INDEX_DELAY 5
+
 /*
  *		Parameters for upper-case table
  */
@@ -114,16 +168,18 @@ enum {
  *	performances, but bad on security with internal fuse or external
  *	fuse older than 2.8
  *
- *	On Linux, cacheing is discouraged for the high level interface
- *	in order to get proper support of hard links. As a consequence,
- *	having access control in the file system leads to fewer requests
- *	to the file system and fewer context switches.
+ *	On Linux, cacheing on the high level interface relies on the
+ *	internal fuse identifying the hard links to a file by their inode
+ *	number, which is not possible when the named streams are accessed
+ *	as "file:stream", so cacheing is not used with an external fuse
+ *	or with streams_interface=windows.
  *
  *	Irrespective of the selected mode, cacheing is always used
  *	in read-only mounts
  *
  *	Possible values for high level :
- *		1 : no cache, kernel control (recommended)
+ *		1 : no cache, kernel control
+ *		3 : use kernel/fuse cache, kernel control (recommended)
  *		4 : no cache, file system control
  *		6 : kernel/fuse cache, file system control (OpenIndiana only)
  *		7 : no cache, kernel control for ACLs
@@ -152,11 +208,10 @@ enum {
 #else /* defined(__sun) && defined(__SVR4) */
 /*
  *	Cacheing by kernel is buggy on Linux when access control is done
- *	by the file system, and also when using hard-linked files on
- *	the fuse high level interface.
+ *	by the file system.
  *	Also ACL checks by recent kernels do not prove satisfactory.
  */
-#define HPERMSCONFIG 1
+#define HPERMSCONFIG 3
 #define LPERMSCONFIG 3
 #endif /* defined(__sun) && defined(__SVR4) */
 
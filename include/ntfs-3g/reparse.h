@@ -24,6 +24,18 @@
 #ifndef REPARSE_H
 #define REPARSE_H
 
+struct CACHED_SYMLINK {
+	struct CACHED_SYMLINK *next;
+	struct CACHED_SYMLINK *previous;
+	char *target;	/* mount point, then target */
+	size_t targetsize;
+		/* above fields must match "struct CACHED_GENERIC" */
+	u64 inum;
+	u32 datahash;	/* hash of the reparse data */
+	int dircount;	/* count of directories, -1 if too many */
+	u64 dirs[CACHE_SYMLINK_DIRS]; /* directories used for resolving */
+} ;
+
 char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point);
 
 BOOL ntfs_possible_symlink(ntfs_inode *ni);
@@ -48,4 +60,13 @@ int ntfs_remove_ntfs_reparse_data(ntfs_inode *ni);
 
 int ntfs_delete_reparse_index(ntfs_inode *ni);
 
+#if CACHE_SYMLINK_SIZE
+
+struct CACHED_GENERIC;
+
+extern int ntfs_symlink_hash(const struct CACHED_GENERIC *cached);
+extern void ntfs_forget_symlinks(ntfs_inode *dir_ni);
+
+#endif
+
 #endif /* REPARSE_H */
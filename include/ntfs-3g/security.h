@@ -39,12 +39,15 @@
  *          item in the mapping list
  */
 
+struct MAPPING_INDEX;
+
 struct MAPPING {
 	struct MAPPING *next;
 	int xid;		/* linux id : uid or gid */
 	SID *sid;		/* Windows id : usid or gsid */
 	int grcnt;		/* group count (for users only) */
 	gid_t *groups;		/* groups which the user is member of */
+	struct MAPPING_INDEX *index; /* hashed ids, only on first item */
 };
 
 /*
@@ -95,6 +98,47 @@ struct CACHED_SECURID {
 	le32 securid;
 } ;
 
+/*
+ *	Entry in the inherited ids cache
+ *
+ *	A security id always designates the same descriptor, so the
+ *	id inherited from a parent directory only depends on the
+ *	parent security id and on the creator.
+ */
+
+struct CACHED_INHERITED {
+	struct CACHED_INHERITED *next;
+	struct CACHED_INHERITED *previous;
+	void *variable;
+	size_t varsize;
+		/* above fields must match "struct CACHED_GENERIC" */
+	le32 parentid;
+	uid_t uid;
+	gid_t gid;
+	BOOL fordir;
+	le32 securid;
+} ;
+
+/*
+ *	Entry in the groups cache
+ *
+ *	Records the supplementary groups of a requesting thread, as
+ *	read from /proc, so that they are not parsed again for each
+ *	permission check.
+ */
+
+struct CACHED_GROUPS {
+	struct CACHED_GROUPS *next;
+	struct CACHED_GROUPS *previous;
+	gid_t *groups;
+	size_t groupsize;
+		/* above fields must match "struct CACHED_GENERIC" */
+	pid_t tid;
+	uid_t uid;
+	gid_t gid;
+	time_t stamp;
+} ;
+
 /*
  *	Header of the security cache
  *	(has no cache structure by itself)
@@ -258,6 +302,22 @@ int ntfs_close_secure(ntfs_volume *vol);
 
 void ntfs_destroy_security_context(struct SECURITY_CONTEXT *scx);
 
+#if CACHE_GROUPS_SIZE
+
+struct CACHED_GENERIC;
+
+extern int ntfs_groups_hash(const struct CACHED_GENERIC *cached);
+
+#endif
+
+#if CACHE_INHERITED_SIZE
+
+struct CACHED_GENERIC;
+
+extern int ntfs_inherited_hash(const struct CACHED_GENERIC *cached);
+
+#endif
+
 #if POSIXACLS
 
 int ntfs_set_inherited_posix(struct SECURITY_CONTEXT *scx,
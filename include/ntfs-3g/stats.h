@@ -0,0 +1,76 @@
+/*
+ * stats.h : counters and latency histograms of operations
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _NTFS_STATS_H_
+#define _NTFS_STATS_H_
+
+#include "types.h"
+
+/*
+ *	Latencies are recorded in microseconds, bucket n counting
+ *	the operations which lasted less than 2^n microseconds,
+ *	and the last bucket counting all the longer ones.
+ */
+
+#define NTFS_STATS_BUCKETS 24
+
+/*
+ *	Room for the growth of the formatted counters between a call
+ *	getting the size of the text and the call formatting it.
+ */
+
+#define NTFS_STATS_MARGIN 1024
+
+struct NTFS_STATS {
+	const char *name;
+	unsigned long count;
+	unsigned long errors;
+	u64 bytes;
+	u64 total_us;
+	unsigned long hist[NTFS_STATS_BUCKETS];
+} ;
+
+struct NTFS_STATS_TABLE {
+	struct NTFS_STATS_TABLE *next;
+	struct NTFS_STATS *items;
+	int count;
+} ;
+
+	/* operations recorded by the library */
+enum {
+	STATS_INODE_OPEN,
+	STATS_ATTR_PREAD,
+	STATS_ATTR_PWRITE,
+	STATS_CLUSTER_ALLOC,
+	STATS_INDEX_LOOKUP,
+	STATS_DEVICE_READ,
+	STATS_DEVICE_WRITE,
+	STATS_COMPRESS_UNIT,
+	STATS_COMPRESS_SKIP,
+	STATS_COUNT
+} ;
+
+extern struct NTFS_STATS ntfs_stats[STATS_COUNT];
+
+s64 ntfs_stats_begin(void);
+void ntfs_stats_end(struct NTFS_STATS *st, s64 begin, s64 bytes);
+void ntfs_stats_register(struct NTFS_STATS_TABLE *table);
+int ntfs_stats_format(char *buf, int size);
+
+#endif /* _NTFS_STATS_H_ */
@@ -0,0 +1,77 @@
+/*
+ * trace.h : binary tracing of requests and device accesses
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _NTFS_TRACE_H_
+#define _NTFS_TRACE_H_
+
+#include "types.h"
+
+/*
+ *	A dump file is made of a header, followed by the names of
+ *	the events (NTFS_TRACE_NAME_LTH bytes each, empty for unused
+ *	events), then followed by the records from the oldest to
+ *	the most recent one. All fields are in the byte order of
+ *	the computer which made the dump, the magic number being
+ *	used to check it.
+ */
+
+#define NTFS_TRACE_MAGIC 0x4352544e	/* "NTRC" on a little-endian cpu */
+#define NTFS_TRACE_VERSION 2
+#define NTFS_TRACE_NAME_LTH 24
+#define NTFS_TRACE_EVENTS 64
+
+struct NTFS_TRACE_HEADER {
+	u32 magic;
+	u32 version;
+	u32 record_size;
+	u32 events;	/* count of event names */
+	u32 count;	/* count of records */
+	u32 lost;	/* count of records overwritten */
+} ;
+
+struct NTFS_TRACE_RECORD {
+	u64 stamp;	/* start of event, microseconds */
+	u64 inode;
+	s64 offset;
+	s64 result;	/* bytes transferred, or negative error */
+	u32 duration;	/* microseconds */
+	u32 size;	/* requested size */
+	u32 request;	/* identifier of fuse request */
+	u16 event;
+	u16 filler;
+} ;
+
+	/* events recorded by the library */
+enum {
+	TRACE_ATTR_PREAD,
+	TRACE_ATTR_PWRITE,
+	TRACE_DEVICE_READ,
+	TRACE_DEVICE_WRITE,
+	TRACE_FUSE = 16		/* first event defined by the driver */
+} ;
+
+int ntfs_trace_start(unsigned int records);
+void ntfs_trace_stop(void);
+void ntfs_trace_name(int event, const char *name);
+void ntfs_trace_request(u32 request);
+void ntfs_trace_record(int event, u64 inode, s64 offset, u32 size,
+			s64 result, s64 begin);
+int ntfs_trace_dump(const char *path);
+
+#endif /* _NTFS_TRACE_H_ */
@@ -117,6 +117,8 @@ typedef enum {
 	NV_HideDotFiles,	/* 1: Set hidden flag on dot files */
 	NV_Compression,		/* 1: allow compression */
 	NV_NoFixupWarn,		/* 1: Do not log fixup errors */
+	NV_Preallocate,		/* 1: reserve space beyond appended data */
+	NV_DeferIndex,		/* 1: defer writing directory index blocks */
 } ntfs_volume_state_bits;
 
 #define  test_nvol_flag(nv, flag)	 test_bit(NV_##flag, (nv)->state)
@@ -155,6 +157,14 @@ typedef enum {
 #define NVolSetNoFixupWarn(nv)		  set_nvol_flag(nv, NoFixupWarn)
 #define NVolClearNoFixupWarn(nv)	clear_nvol_flag(nv, NoFixupWarn)
 
+#define NVolPreallocate(nv)		 test_nvol_flag(nv, Preallocate)
+#define NVolSetPreallocate(nv)		  set_nvol_flag(nv, Preallocate)
+#define NVolClearPreallocate(nv)	clear_nvol_flag(nv, Preallocate)
+
+#define NVolDeferIndex(nv)		 test_nvol_flag(nv, DeferIndex)
+#define NVolSetDeferIndex(nv)		  set_nvol_flag(nv, DeferIndex)
+#define NVolClearDeferIndex(nv)		clear_nvol_flag(nv, DeferIndex)
+
 /*
  * NTFS version 1.1 and 1.2 are used by Windows NT4.
  * NTFS version 2.x is used by Windows 2000 Beta
@@ -235,6 +245,7 @@ struct _ntfs_volume {
 	ntfs_index_context *secure_xsdh; /* index for using $Secure:$SDH */
 	int secure_reentry;  /* check for non-rentries */
 	unsigned int secure_flags;  /* flags, see security.h for values */
+	struct SECURE_INDEX *secure_index; /* $Secure descriptors in memory */
 
 	int mftmirr_size;	/* Size of the FILE_MFTMirr in mft records. */
 	LCN mftmirr_lcn;	/* Logical cluster number of the data attribute
@@ -262,6 +273,8 @@ struct _ntfs_volume {
 	s64 free_mft_records; 	/* Same for free mft records (see above) */
 	BOOL efs_raw;		/* volume is mounted for raw access to
 				   efs-encrypted files */
+	int compression_level;	/* effort for compressing, see compress.h,
+				   zero for the default level */
 	ntfs_volume_special_files special_files; /* Implementation of special files */
 	const char *abs_mnt_point; /* Mount point */
 #ifdef XATTR_MAPPINGS
@@ -276,12 +289,37 @@ struct _ntfs_volume {
 #if CACHE_LOOKUP_SIZE
 	struct CACHE_HEADER *lookup_cache;
 #endif
+#if CACHE_LOOKUP_SIZE && CACHE_NEGATIVE_SIZE
+	struct CACHE_HEADER *negative_cache;
+#endif
 #if CACHE_SECURID_SIZE
 	struct CACHE_HEADER *securid_cache;
 #endif
 #if CACHE_LEGACY_SIZE
 	struct CACHE_HEADER *legacy_cache;
 #endif
+#if CACHE_GROUPS_SIZE
+	struct CACHE_HEADER *groups_cache;
+#endif
+#if CACHE_INHERITED_SIZE
+	struct CACHE_HEADER *inherited_cache;
+#endif
+#if CACHE_SYMLINK_SIZE
+	struct CACHE_HEADER *symlink_cache;
+	struct CACHED_SYMLINK *symlink_record; /* symlink being resolved */
+#endif
+#if CACHE_PLACEMENT_SIZE
+	struct CACHE_HEADER *placement_cache;
+#endif
+#if CACHE_LISTING_SIZE
+	struct CACHE_HEADER *listing_cache;
+	u32 listing_generation;	/* changed when a cached listing is dropped or recycled */
+#endif
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	struct DEFERRED_INDEX *deferred_index; /* unwritten index blocks */
+	s64 deferred_index_stamp; /* oldest deferred index block, or zero */
+#endif
+	struct RESERVATION *reservations; /* files with clusters reserved */
 };
 
 extern const char *ntfs_home;
@@ -59,6 +59,7 @@ enum SYSTEMXATTRS {
 	XATTR_NTFS_CRTIME,
 	XATTR_NTFS_CRTIME_BE,
 	XATTR_NTFS_EA,
+	XATTR_NTFS_STATS,
 	XATTR_POSIX_ACC, 
 	XATTR_POSIX_DEF
 } ;
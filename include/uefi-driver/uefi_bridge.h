@@ -54,6 +54,8 @@ VOID NtfsCloseFile(EFI_NTFS_FILE* File);
 EFI_STATUS NtfsReadDirectory(EFI_NTFS_FILE* File, NTFS_DIRHOOK Hook,
 	VOID* HookData);
 EFI_STATUS NtfsReadFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len);
+EFI_STATUS NtfsReadFileEx(EFI_NTFS_FILE* File, EFI_FILE_IO_TOKEN* Token);
+VOID NtfsCancelReads(EFI_FS* FileSystem);
 EFI_STATUS NtfsWriteFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len);
 EFI_STATUS NtfsGetFileInfo(EFI_NTFS_FILE* File, EFI_FILE_INFO* Info,
 	CONST UINT64 MRef, BOOLEAN IsDir);
@@ -71,6 +71,9 @@
 #define COMMIT_INFO                 unknown
 #endif
 
+/* Number of buckets for the open file lookup tables (must be a power of 2) */
+#define LOOKUP_HASH_SIZE            64
+
 /* A file instance */
 typedef struct _EFI_NTFS_FILE {
 	/*
@@ -94,11 +97,14 @@ typedef struct _EFI_NTFS_FILE {
 	BOOLEAN                          IsRoot;
 	INT64                            DirPos;
 	INT64                            Offset;
+	INT64                            ReadEnd;
+	struct _NTFS_READ               *ReadAhead;
 	CHAR16                          *Path;
 	CHAR16                          *BaseName;
 	INTN                             RefCount;
 	struct _EFI_FS                  *FileSystem;
 	VOID                            *NtfsInode;
+	VOID                            *NtfsData;
 } EFI_NTFS_FILE;
 
 /* A file system instance */
@@ -118,14 +124,17 @@ typedef struct _EFI_FS {
 	INT64                            Offset;
 	INTN                             MountCount;
 	INTN                             TotalRefCount;
+	INTN                             PendingReads;
 	LIST_ENTRY                       LookupListHead;
+	LIST_ENTRY                       LookupPathHash[LOOKUP_HASH_SIZE];
+	LIST_ENTRY                       LookupInumHash[LOOKUP_HASH_SIZE];
 } EFI_FS;
 
 /* The top of our file system instances list */
 extern LIST_ENTRY FsListHead;
 
 extern EFI_STATUS FSInstall(EFI_FS* This, EFI_HANDLE ControllerHandle);
-extern VOID FSUninstall(EFI_FS* This, EFI_HANDLE ControllerHandle);
+extern EFI_STATUS FSUninstall(EFI_FS* This, EFI_HANDLE ControllerHandle);
 extern EFI_STATUS EFIAPI FileOpenVolume(EFI_SIMPLE_FILE_SYSTEM_PROTOCOL* This,
 	EFI_FILE_HANDLE* Root);
 
@@ -54,6 +54,7 @@ struct fuse_config {
     int debug;
     int hard_remove;
     int use_ino;
+    int link_ino;
     int readdir_ino;
     int set_mode;
     int set_uid;
@@ -84,12 +85,27 @@ struct fusemod_so {
 };
 #endif /* __SOLARIS__ */
 
+/*
+ * Hash table with incremental resizing : when growing, the buckets
+ * below "split" have already been spread over the doubled table, and
+ * the other ones have not been yet. Each insertion or removal moves
+ * one bucket, so that no request has to rehash the whole table.
+ */
+struct node_table {
+    struct node **array;
+    size_t use;
+    size_t size;
+    size_t split;
+    unsigned long lookups;
+    unsigned long probes;
+};
+
+#define NODE_TABLE_MIN_SIZE 8192
+
 struct fuse {
     struct fuse_session *se;
-    struct node **name_table;
-    size_t name_table_size;
-    struct node **id_table;
-    size_t id_table_size;
+    struct node_table name_table;
+    struct node_table id_table;
     fuse_ino_t ctr;
     unsigned int generation;
     unsigned int hidectr;
@@ -109,6 +125,12 @@ struct lock {
     struct lock *next;
 };
 
+/*
+ * With link_ino, the nodeid of a node is the inode number when possible,
+ * and the other hard links to the same inode get an alias node, which
+ * is only hashed by name and shares the nodeid of its master node, so
+ * that the kernel sees a single inode whatever the path used.
+ */
 struct node {
     struct node *name_next;
     struct node *id_next;
@@ -117,6 +139,9 @@ struct node {
     int refctr;
     struct node *parent;
     char *name;
+    fuse_ino_t ino;
+    struct node *master;
+    struct node *alias;
     uint64_t nlookup;
     int open_count;
     int is_hidden;
@@ -253,14 +278,90 @@ static void fuse_put_module(struct fuse_module *m)
 }
 #endif /* __SOLARIS__ */
 
+static int node_table_init(struct node_table *t)
+{
+    t->size = NODE_TABLE_MIN_SIZE;
+    t->array = (struct node **) calloc(1, sizeof(struct node *) * t->size);
+    if (t->array == NULL) {
+        fprintf(stderr, "fuse: memory allocation failed\n");
+        return -1;
+    }
+    t->use = 0;
+    t->split = 0;
+    t->lookups = 0;
+    t->probes = 0;
+    return 0;
+}
+
+static int node_table_resize(struct node_table *t)
+{
+    size_t newsize = t->size * 2;
+    void *newarray;
+
+    newarray = realloc(t->array, sizeof(struct node *) * newsize);
+    if (newarray == NULL)
+        return -1;
+
+    t->array = (struct node **) newarray;
+    memset(t->array + t->size, 0, t->size * sizeof(struct node *));
+    t->size = newsize;
+    t->split = 0;
+    return 0;
+}
+
+static void node_table_reduce(struct node_table *t)
+{
+    size_t newsize = t->size / 2;
+    void *newarray;
+
+    if (newsize < NODE_TABLE_MIN_SIZE)
+        return;
+
+    newarray = realloc(t->array, sizeof(struct node *) * newsize);
+    if (newarray != NULL)
+        t->array = (struct node **) newarray;
+
+    t->size = newsize;
+    t->split = t->size / 2;
+}
+
+/* Select the bucket in the half or full table depending on split */
+static size_t node_table_bucket(const struct node_table *t, size_t hash)
+{
+    size_t newhash = hash % t->size;
+    size_t oldhash = newhash % (t->size / 2);
+
+    if (oldhash >= t->split)
+        return oldhash;
+    else
+        return newhash;
+}
+
+static size_t id_hash(struct fuse *f, fuse_ino_t ino)
+{
+    return node_table_bucket(&f->id_table, (uint32_t) ino * 2654435761U);
+}
+
+static void node_table_stats(const char *name, const struct node_table *t)
+{
+    fprintf(stderr, "%s table: %llu nodes, %llu buckets, "
+            "%lu lookups, %.2f probes per lookup\n", name,
+            (unsigned long long) t->use, (unsigned long long) t->size,
+            t->lookups,
+            t->lookups ? (double) t->probes / t->lookups : 0.0);
+}
+
 static struct node *get_node_nocheck(struct fuse *f, fuse_ino_t nodeid)
 {
-    size_t hash = nodeid % f->id_table_size;
+    size_t hash = id_hash(f, nodeid);
     struct node *node;
 
-    for (node = f->id_table[hash]; node != NULL; node = node->id_next)
+    f->id_table.lookups++;
+    for (node = f->id_table.array[hash]; node != NULL; node = node->id_next) {
+        f->id_table.probes++;
         if (node->nodeid == nodeid)
             return node;
+    }
 
     return NULL;
 }
@@ -282,35 +383,151 @@ static void free_node(struct node *node)
     free(node);
 }
 
+static void remerge_id(struct fuse *f)
+{
+    struct node_table *t = &f->id_table;
+    int iter;
+
+    if (t->split == 0)
+        node_table_reduce(t);
+
+    for (iter = 8; t->split > 0 && iter; iter--) {
+        struct node **upper;
+
+        t->split--;
+        upper = &t->array[t->split + t->size / 2];
+        if (*upper) {
+            struct node **nodep;
+
+            for (nodep = &t->array[t->split]; *nodep;
+                 nodep = &(*nodep)->id_next);
+
+            *nodep = *upper;
+            *upper = NULL;
+            break;
+        }
+    }
+}
+
 static void unhash_id(struct fuse *f, struct node *node)
 {
-    size_t hash = node->nodeid % f->id_table_size;
-    struct node **nodep = &f->id_table[hash];
+    struct node **nodep = &f->id_table.array[id_hash(f, node->nodeid)];
 
     for (; *nodep != NULL; nodep = &(*nodep)->id_next)
         if (*nodep == node) {
             *nodep = node->id_next;
+            f->id_table.use--;
+
+            if (f->id_table.use < f->id_table.size / 4)
+                remerge_id(f);
             return;
         }
 }
 
+static void rehash_id(struct fuse *f)
+{
+    struct node_table *t = &f->id_table;
+    struct node **nodep;
+    struct node **next;
+    size_t hash;
+
+    if (t->split == t->size / 2)
+        return;
+
+    hash = t->split;
+    t->split++;
+    for (nodep = &t->array[hash]; *nodep != NULL; nodep = next) {
+        struct node *node = *nodep;
+        size_t newhash = id_hash(f, node->nodeid);
+
+        if (newhash != hash) {
+            next = nodep;
+            *nodep = node->id_next;
+            node->id_next = t->array[newhash];
+            t->array[newhash] = node;
+        } else {
+            next = &node->id_next;
+        }
+    }
+    if (t->split == t->size / 2)
+        node_table_resize(t);
+}
+
 static void hash_id(struct fuse *f, struct node *node)
 {
-    size_t hash = node->nodeid % f->id_table_size;
-    node->id_next = f->id_table[hash];
-    f->id_table[hash] = node;
+    size_t hash = id_hash(f, node->nodeid);
+    node->id_next = f->id_table.array[hash];
+    f->id_table.array[hash] = node;
+    f->id_table.use++;
+
+    if (f->id_table.use >= f->id_table.size / 2)
+        rehash_id(f);
 }
 
-static unsigned int name_hash(struct fuse *f, fuse_ino_t parent,
-                              const char *name)
+static size_t name_hash(struct fuse *f, fuse_ino_t parent,
+                        const char *name)
 {
-    unsigned int hash = *name;
+    uint64_t hash = (uint32_t) parent * 2654435761U;
 
-    if (hash)
-        for (name += 1; *name != '\0'; name++)
-            hash = (hash << 5) - hash + *name;
+    for (; *name != '\0'; name++)
+        hash = hash * 31 + (unsigned char) *name;
+
+    return node_table_bucket(&f->name_table, hash);
+}
+
+static void remerge_name(struct fuse *f)
+{
+    struct node_table *t = &f->name_table;
+    int iter;
 
-    return (hash + parent) % f->name_table_size;
+    if (t->split == 0)
+        node_table_reduce(t);
+
+    for (iter = 8; t->split > 0 && iter; iter--) {
+        struct node **upper;
+
+        t->split--;
+        upper = &t->array[t->split + t->size / 2];
+        if (*upper) {
+            struct node **nodep;
+
+            for (nodep = &t->array[t->split]; *nodep;
+                 nodep = &(*nodep)->name_next);
+
+            *nodep = *upper;
+            *upper = NULL;
+            break;
+        }
+    }
+}
+
+static void rehash_name(struct fuse *f)
+{
+    struct node_table *t = &f->name_table;
+    struct node **nodep;
+    struct node **next;
+    size_t hash;
+
+    if (t->split == t->size / 2)
+        return;
+
+    hash = t->split;
+    t->split++;
+    for (nodep = &t->array[hash]; *nodep != NULL; nodep = next) {
+        struct node *node = *nodep;
+        size_t newhash = name_hash(f, node->parent->nodeid, node->name);
+
+        if (newhash != hash) {
+            next = nodep;
+            *nodep = node->name_next;
+            node->name_next = t->array[newhash];
+            t->array[newhash] = node;
+        } else {
+            next = &node->name_next;
+        }
+    }
+    if (t->split == t->size / 2)
+        node_table_resize(t);
 }
 
 static void unref_node(struct fuse *f, struct node *node);
@@ -319,7 +536,7 @@ static void unhash_name(struct fuse *f, struct node *node)
 {
     if (node->name) {
         size_t hash = name_hash(f, node->parent->nodeid, node->name);
-        struct node **nodep = &f->name_table[hash];
+        struct node **nodep = &f->name_table.array[hash];
 
         for (; *nodep != NULL; nodep = &(*nodep)->name_next)
             if (*nodep == node) {
@@ -329,6 +546,10 @@ static void unhash_name(struct fuse *f, struct node *node)
                 free(node->name);
                 node->name = NULL;
                 node->parent = NULL;
+                f->name_table.use--;
+
+                if (f->name_table.use < f->name_table.size / 4)
+                    remerge_name(f);
                 return;
             }
         fprintf(stderr, "fuse internal error: unable to unhash node: %llu\n",
@@ -348,8 +569,12 @@ static int hash_name(struct fuse *f, struct node *node, fuse_ino_t parentid,
 
     parent->refctr ++;
     node->parent = parent;
-    node->name_next = f->name_table[hash];
-    f->name_table[hash] = node;
+    node->name_next = f->name_table.array[hash];
+    f->name_table.array[hash] = node;
+    f->name_table.use++;
+
+    if (f->name_table.use >= f->name_table.size / 2)
+        rehash_name(f);
     return 0;
 }
 
@@ -388,36 +613,78 @@ static struct node *lookup_node(struct fuse *f, fuse_ino_t parent,
     size_t hash = name_hash(f, parent, name);
     struct node *node;
 
-    for (node = f->name_table[hash]; node != NULL; node = node->name_next)
+    f->name_table.lookups++;
+    for (node = f->name_table.array[hash]; node != NULL;
+         node = node->name_next) {
+        f->name_table.probes++;
         if (node->parent->nodeid == parent && strcmp(node->name, name) == 0)
             return node;
+    }
 
     return NULL;
 }
 
+/* Check whether an inode number can be used as a nodeid */
+static int ino_is_nodeid(struct fuse *f, const struct stat *stbuf)
+{
+    return f->conf.use_ino && f->conf.link_ino && stbuf->st_ino != 0 &&
+           stbuf->st_ino != FUSE_ROOT_ID && stbuf->st_ino != FUSE_UNKNOWN_INO &&
+           (fuse_ino_t) stbuf->st_ino == stbuf->st_ino;
+}
+
 static struct node *find_node(struct fuse *f, fuse_ino_t parent,
-                              const char *name)
+                              const char *name, const struct stat *stbuf)
 {
     struct node *node;
+    struct node *master;
+    fuse_ino_t ino;
 
     pthread_mutex_lock(&f->lock);
     node = lookup_node(f, parent, name);
+    if (node != NULL && node->master != NULL)
+        node = node->master;
     if (node == NULL) {
+        ino = 0;
+        master = NULL;
+        if (ino_is_nodeid(f, stbuf)) {
+            master = get_node_nocheck(f, stbuf->st_ino);
+            if (master == NULL)
+                ino = stbuf->st_ino;
+            else if (master->ino != stbuf->st_ino || !master->name ||
+                     S_ISDIR(stbuf->st_mode))
+                master = NULL;
+        }
         node = (struct node *) calloc(1, sizeof(struct node));
         if (node == NULL)
             goto out_err;
 
         node->refctr = 1;
-        node->nodeid = next_id(f);
         node->open_count = 0;
         node->is_hidden = 0;
-        node->generation = f->generation;
-        if (hash_name(f, node, parent, name) == -1) {
-            free(node);
-            node = NULL;
-            goto out_err;
+        if (master != NULL) {
+            /* another hard link to a known inode */
+            node->nodeid = master->nodeid;
+            node->generation = master->generation;
+            node->master = master;
+            if (hash_name(f, node, parent, name) == -1) {
+                free(node);
+                node = NULL;
+                goto out_err;
+            }
+            node->alias = master->alias;
+            master->alias = node;
+            node = master;
+        } else {
+            node->nodeid = ino ? ino : next_id(f);
+            node->ino = ino;
+            node->generation = f->generation;
+            if (hash_name(f, node, parent, name) == -1) {
+                free(node);
+                node = NULL;
+                goto out_err;
+            }
+            hash_id(f, node);
         }
-        hash_id(f, node);
     }
     node->nlookup ++;
  out_err:
@@ -425,6 +692,33 @@ static struct node *find_node(struct fuse *f, fuse_ino_t parent,
     return node;
 }
 
+static void drop_alias(struct fuse *f, struct node *node)
+{
+    struct node **aliasp;
+
+    for (aliasp = &node->master->alias; *aliasp != node;
+         aliasp = &(*aliasp)->alias);
+    *aliasp = node->alias;
+    unhash_name(f, node);
+    free_node(node);
+}
+
+/* Remove a name, another hard link then becomes the name of the inode */
+static void unlink_name(struct fuse *f, struct node *node)
+{
+    struct node *alias;
+
+    if (node->master != NULL)
+        drop_alias(f, node);
+    else {
+        unhash_name(f, node);
+        alias = node->alias;
+        if (alias != NULL &&
+            hash_name(f, node, alias->parent->nodeid, alias->name) != -1)
+            drop_alias(f, alias);
+    }
+}
+
 #ifndef __SOLARIS__
 static char *add_name(char **buf, unsigned *bufsize, char *s, const char *name)
 #else /* __SOLARIS__ */
@@ -570,6 +864,8 @@ static void forget_node(struct fuse *f, fuse_ino_t nodeid, uint64_t nlookup)
     assert(node->nlookup >= nlookup);
     node->nlookup -= nlookup;
     if (!node->nlookup) {
+        while (node->alias != NULL)
+            drop_alias(f, node->alias);
         unhash_name(f, node);
         unref_node(f, node);
     }
@@ -583,7 +879,7 @@ static void remove_node(struct fuse *f, fuse_ino_t dir, const char *name)
     pthread_mutex_lock(&f->lock);
     node = lookup_node(f, dir, name);
     if (node != NULL)
-        unhash_name(f, node);
+        unlink_name(f, node);
     pthread_mutex_unlock(&f->lock);
 }
 
@@ -606,7 +902,11 @@ static int rename_node(struct fuse *f, fuse_ino_t olddir, const char *oldname,
             err = -EBUSY;
             goto out;
         }
-        unhash_name(f, newnode);
+        unlink_name(f, newnode);
+        /* the old name may have moved to another node of the inode */
+        node = lookup_node(f, olddir, oldname);
+        if (node == NULL)
+            goto out;
     }
 
     unhash_name(f, node);
@@ -1060,7 +1360,8 @@ static int is_open(struct fuse *f, fuse_ino_t dir, const char *name)
     int isopen = 0;
     pthread_mutex_lock(&f->lock);
     node = lookup_node(f, dir, name);
-    if (node && node->open_count > 0)
+    /* no need to hide a name if the inode has other ones */
+    if (node && !node->master && !node->alias && node->open_count > 0)
         isopen = 1;
     pthread_mutex_unlock(&f->lock);
     return isopen;
@@ -1174,7 +1475,7 @@ static int lookup_path(struct fuse *f, fuse_ino_t nodeid,
     if (res == 0) {
         struct node *node;
 
-        node = find_node(f, nodeid, name);
+        node = find_node(f, nodeid, name, &e->attr);
         if (node == NULL)
             res = -ENOMEM;
         else {
@@ -2872,6 +3173,7 @@ static const struct fuse_opt fuse_lib_opts[] = {
     FUSE_LIB_OPT("-d",                    debug, 1),
     FUSE_LIB_OPT("hard_remove",           hard_remove, 1),
     FUSE_LIB_OPT("use_ino",               use_ino, 1),
+    FUSE_LIB_OPT("link_ino",              link_ino, 1),
     FUSE_LIB_OPT("readdir_ino",           readdir_ino, 1),
     FUSE_LIB_OPT("direct_io",             direct_io, 1),
     FUSE_LIB_OPT("kernel_cache",          kernel_cache, 1),
@@ -2903,6 +3205,7 @@ static void fuse_lib_help(void)
     fprintf(stderr,
 "    -o hard_remove         immediate removal (don't hide files)\n"
 "    -o use_ino             let filesystem set inode numbers\n"
+"    -o link_ino            identify hard links by inode numbers (with use_ino)\n"
 "    -o readdir_ino         try to fill in d_ino in readdir\n"
 "    -o direct_io           use direct I/O\n"
 "    -o kernel_cache        cache files in kernel\n"
@@ -3127,24 +3430,14 @@ struct fuse *fuse_new(struct fuse_chan *ch, struct fuse_args *args,
 
     fuse_session_add_chan(f->se, ch);
 
-    f->ctr = 0;
+    /* keep the allocated nodeids away from the inode numbers */
+    f->ctr = f->conf.link_ino ? 0x7fffffff : 0;
     f->generation = 0;
-    /* FIXME: Dynamic hash table */
-    f->name_table_size = 14057;
-    f->name_table = (struct node **)
-        calloc(1, sizeof(struct node *) * f->name_table_size);
-    if (f->name_table == NULL) {
-        fprintf(stderr, "fuse: memory allocation failed\n");
+    if (node_table_init(&f->name_table) == -1)
         goto out_free_session;
-    }
 
-    f->id_table_size = 14057;
-    f->id_table = (struct node **)
-        calloc(1, sizeof(struct node *) * f->id_table_size);
-    if (f->id_table == NULL) {
-        fprintf(stderr, "fuse: memory allocation failed\n");
+    if (node_table_init(&f->id_table) == -1)
         goto out_free_name_table;
-    }
 
     fuse_mutex_init(&f->lock);
     pthread_rwlock_init(&f->tree_lock, NULL);
@@ -3179,9 +3472,9 @@ struct fuse *fuse_new(struct fuse_chan *ch, struct fuse_args *args,
  out_free_root:
     free(root);
  out_free_id_table:
-    free(f->id_table);
+    free(f->id_table.array);
  out_free_name_table:
-    free(f->name_table);
+    free(f->name_table.array);
  out_free_session:
     fuse_session_destroy(f->se);
  out_free_fs:
@@ -3213,10 +3506,11 @@ void fuse_destroy(struct fuse *f)
         memset(c, 0, sizeof(*c));
         c->ctx.fuse = f;
 
-        for (i = 0; i < f->id_table_size; i++) {
+        for (i = 0; i < f->id_table.size; i++) {
             struct node *node;
 
-            for (node = f->id_table[i]; node != NULL; node = node->id_next) {
+            for (node = f->id_table.array[i]; node != NULL;
+                 node = node->id_next) {
                 if (node->is_hidden) {
                     char *path = get_path(f, node->nodeid);
                     if (path) {
@@ -3227,17 +3521,27 @@ void fuse_destroy(struct fuse *f)
             }
         }
     }
-    for (i = 0; i < f->id_table_size; i++) {
+    if (f->conf.debug) {
+        node_table_stats("name", &f->name_table);
+        node_table_stats("id", &f->id_table);
+    }
+    for (i = 0; i < f->id_table.size; i++) {
         struct node *node;
         struct node *next;
 
-        for (node = f->id_table[i]; node != NULL; node = next) {
+        for (node = f->id_table.array[i]; node != NULL; node = next) {
             next = node->id_next;
+            while (node->alias != NULL) {
+                struct node *alias = node->alias;
+
+                node->alias = alias->alias;
+                free_node(alias);
+            }
             free_node(node);
         }
     }
-    free(f->id_table);
-    free(f->name_table);
+    free(f->id_table.array);
+    free(f->name_table.array);
     pthread_mutex_destroy(&f->lock);
     pthread_rwlock_destroy(&f->tree_lock);
     fuse_session_destroy(f->se);
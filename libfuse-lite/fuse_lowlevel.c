@@ -1209,6 +1209,11 @@ const struct fuse_ctx *fuse_req_ctx(fuse_req_t req)
     return &req->ctx;
 }
 
+uint64_t fuse_req_unique(fuse_req_t req)
+{
+    return req->unique;
+}
+
 void fuse_req_interrupt_func(fuse_req_t req, fuse_interrupt_func_t func,
                              void *data)
 {
@@ -409,6 +409,116 @@ static u32 findimplicit(const SID *xsid, const SID *pattern, int parity)
 	return (xid);
 }
 
+/*
+ *		Hashed index of a mapping list
+ *
+ *	Big mappings (such as those generated for a directory service)
+ *	are indexed at load time by Linux id and by SID, so that
+ *	translating an ownership does not need walking the whole list.
+ *	The index is attached to the first item of the list, and uses
+ *	open addressing with linear probing.
+ *
+ *	Only the items located before the implicit mapping pattern are
+ *	indexed, and when an id or SID is defined several times, only
+ *	the first definition is recorded, so that the result is the
+ *	same as with a sequential search.
+ */
+
+struct MAPPING_INDEX {
+	unsigned int mask;		/* number of slots minus one */
+	const struct MAPPING *pattern;	/* implicit mapping pattern */
+	const struct MAPPING **byxid;
+	const struct MAPPING **bysid;
+} ;
+
+static unsigned int xidhash(int xid)
+{
+	return ((u32)xid*0x9e3779b1);
+}
+
+static unsigned int sidhash(const SID *sid)
+{
+	unsigned int h;
+	int i;
+
+	h = sid->sub_authority_count;
+	for (i=0; i<sid->sub_authority_count; i++)
+		h = h*31 + le32_to_cpu(sid->sub_authority[i]);
+	return (h*0x9e3779b1);
+}
+
+static const struct MAPPING *find_xid_index(const struct MAPPING_INDEX *index,
+			int xid)
+{
+	const struct MAPPING *p;
+	unsigned int h;
+
+	h = xidhash(xid) & index->mask;
+	while ((p = index->byxid[h]) && (p->xid != xid))
+		h = (h + 1) & index->mask;
+	return (p ? p : index->pattern);
+}
+
+static const struct MAPPING *find_sid_index(const struct MAPPING_INDEX *index,
+			const SID *sid)
+{
+	const struct MAPPING *p;
+	unsigned int h;
+
+	h = sidhash(sid) & index->mask;
+	while ((p = index->bysid[h]) && !ntfs_same_sid(sid, p->sid))
+		h = (h + 1) & index->mask;
+	return (p ? p : index->pattern);
+}
+
+/*
+ *		Build the hashed index of a mapping list
+ *
+ *	Returns NULL if there is no memory, the mapping is then
+ *	searched sequentially.
+ */
+
+static struct MAPPING_INDEX *build_mapping_index(const struct MAPPING *first)
+{
+	struct MAPPING_INDEX *index;
+	const struct MAPPING *p;
+	unsigned int slots;
+	unsigned int h;
+	int count;
+
+	count = 0;
+	for (p=first; p && p->xid; p=p->next)
+		count++;
+		/* at least twice as many slots as items */
+	slots = 16;
+	while (slots < 2*(unsigned int)count)
+		slots <<= 1;
+	index = (struct MAPPING_INDEX*)ntfs_malloc(sizeof(struct MAPPING_INDEX)
+			+ 2*slots*sizeof(const struct MAPPING*));
+	if (index) {
+		index->mask = slots - 1;
+		index->byxid = (const struct MAPPING**)&index[1];
+		index->bysid = &index->byxid[slots];
+		memset(index->byxid, 0, 2*slots*sizeof(const struct MAPPING*));
+		for (p=first; p && p->xid; p=p->next) {
+			h = xidhash(p->xid) & index->mask;
+			while (index->byxid[h]
+			    && (index->byxid[h]->xid != p->xid))
+				h = (h + 1) & index->mask;
+			if (!index->byxid[h])
+				index->byxid[h] = p;
+			h = sidhash(p->sid) & index->mask;
+			while (index->bysid[h]
+			    && !ntfs_same_sid(index->bysid[h]->sid, p->sid))
+				h = (h + 1) & index->mask;
+			if (!index->bysid[h])
+				index->bysid[h] = p;
+		}
+		index->pattern = p;
+	}
+	return (index);
+}
+
 /*
  *		Find usid mapped to a Linux user
  *	Returns NULL if not found
@@ -426,9 +536,13 @@ const SID *ntfs_find_usid(const struct MAPPING* usermapping,
 	if (!uid)
 		sid = adminsid;
 	else {
-		p = usermapping;
-		while (p && p->xid && ((uid_t)p->xid != uid))
-			p = p->next;
+		if (usermapping && usermapping->index)
+			p = find_xid_index(usermapping->index, uid);
+		else {
+			p = usermapping;
+			while (p && p->xid && ((uid_t)p->xid != uid))
+				p = p->next;
+		}
 		if (p && !p->xid) {
 			/*
 			 * default pattern has been reached :
@@ -470,9 +584,13 @@ const SID *ntfs_find_gsid(const struct MAPPING* groupmapping,
 	if (!gid)
 		sid = adminsid;
 	else {
-		p = groupmapping;
-		while (p && p->xid && ((gid_t)p->xid != gid))
-			p = p->next;
+		if (groupmapping && groupmapping->index)
+			p = find_xid_index(groupmapping->index, gid);
+		else {
+			p = groupmapping;
+			while (p && p->xid && ((gid_t)p->xid != gid))
+				p = p->next;
+		}
 		if (p && !p->xid) {
 			/*
 			 * default pattern has been reached :
@@ -507,9 +625,13 @@ uid_t ntfs_find_user(const struct MAPPING* usermapping, const SID *usid)
 	uid_t uid;
 	const struct MAPPING *p;
 
-	p = usermapping;
-	while (p && p->xid && !ntfs_same_sid(usid, p->sid))
-		p = p->next;
+	if (usermapping && usermapping->index)
+		p = find_sid_index(usermapping->index, usid);
+	else {
+		p = usermapping;
+		while (p && p->xid && !ntfs_same_sid(usid, p->sid))
+			p = p->next;
+	}
 	if (p && !p->xid)
 		/*
 		 * No explicit mapping found, try implicit mapping
@@ -530,9 +652,13 @@ gid_t ntfs_find_group(const struct MAPPING* groupmapping, const SID * gsid)
 	gid_t gid;
 	const struct MAPPING *p;
 
-	p = groupmapping;
-	while (p && p->xid && !ntfs_same_sid(gsid, p->sid))
-		p = p->next;
+	if (groupmapping && groupmapping->index)
+		p = find_sid_index(groupmapping->index, gsid);
+	else {
+		p = groupmapping;
+		while (p && p->xid && !ntfs_same_sid(gsid, p->sid))
+			p = p->next;
+	}
 	if (p && !p->xid)
 		/*
 		 * No explicit mapping found, try implicit mapping
@@ -4324,6 +4450,11 @@ void ntfs_free_mapping(struct MAPPING *mapping[])
 	struct MAPPING *user;
 	struct MAPPING *group;
 
+		/* free the indexes */
+	if (mapping[MAPUSERS])
+		free(mapping[MAPUSERS]->index);
+	if (mapping[MAPGROUPS])
+		free(mapping[MAPGROUPS]->index);
 		/* free user mappings */
 	while (mapping[MAPUSERS]) {
 		user = mapping[MAPUSERS];
@@ -4418,6 +4549,7 @@ struct MAPPING *ntfs_do_user_mapping(struct MAPLIST *firstitem)
 					mapping->sid = sid;
 					mapping->xid = uid;
 					mapping->grcnt = 0;
+					mapping->index = (struct MAPPING_INDEX*)NULL;
 					mapping->next = (struct MAPPING*)NULL;
 					if (lastmapping)
 						lastmapping->next = mapping;
@@ -4429,6 +4561,8 @@ struct MAPPING *ntfs_do_user_mapping(struct MAPLIST *firstitem)
 			}
 		}
 	}
+	if (firstmapping)
+		firstmapping->index = build_mapping_index(firstmapping);
 	return (firstmapping);
 }
 
@@ -4510,7 +4644,7 @@ struct MAPPING *ntfs_do_group_mapping(struct MAPLIST *firstitem)
 						} else
 							mapping->grcnt = 0;
 
-
+						mapping->index = (struct MAPPING_INDEX*)NULL;
 						mapping->next = (struct MAPPING*)NULL;
 						if (lastmapping)
 							lastmapping->next = mapping;
@@ -4522,5 +4656,7 @@ struct MAPPING *ntfs_do_group_mapping(struct MAPLIST *firstitem)
 			}
 		}
 	}
+	if (firstmapping)
+		firstmapping->index = build_mapping_index(firstmapping);
 	return (firstmapping);
 }
@@ -63,6 +63,8 @@
 #include "bitmap.h"
 #include "logging.h"
 #include "misc.h"
+#include "stats.h"
+#include "trace.h"
 #include "efs.h"
 
 ntfschar AT_UNNAMED[] = { const_cpu_to_le16('\0') };
@@ -1165,6 +1167,7 @@ rl_err_out:
 s64 ntfs_attr_pread(ntfs_attr *na, const s64 pos, s64 count, void *b)
 {
 	s64 ret;
+	s64 stamp;
 	
 	if (!na || !na->ni || !na->ni->vol || !b || pos < 0 || count < 0) {
 		errno = EINVAL;
@@ -1178,7 +1181,11 @@ s64 ntfs_attr_pread(ntfs_attr *na, const s64 pos, s64 count, void *b)
 		       "%lld\n", (unsigned long long)na->ni->mft_no,
 		       le32_to_cpu(na->type), (long long)pos, (long long)count);
 
+	stamp = ntfs_stats_begin();
 	ret = ntfs_attr_pread_i(na, pos, count, b);
+	ntfs_stats_end(&ntfs_stats[STATS_ATTR_PREAD], stamp, ret);
+	ntfs_trace_record(TRACE_ATTR_PREAD, na->ni->mft_no, pos, count,
+			ret, stamp);
 	
 	ntfs_log_leave("\n");
 	return ret;
@@ -1255,6 +1262,7 @@ static int ntfs_attr_fill_hole(ntfs_attr *na, s64 count, s64 *ofs,
 	runlist *rlc;
 	LCN lcn_seek_from = -1;
 	VCN cur_vcn, from_vcn;
+	u64 group;
 
 	to_write = min(count, ((*rl)->length << vol->cluster_size_bits) - *ofs);
 	
@@ -1324,6 +1332,18 @@ static int ntfs_attr_fill_hole(ntfs_attr *na, s64 count, s64 *ofs,
 		}
 	}
 	
+	/*
+	 * The data of a small file is placed next to its siblings,
+	 * and a file which gets big is moved apart from them.
+	 */
+	group = ntfs_placement_group(na, na->data_size);
+	if (lcn_seek_from == -1)
+		lcn_seek_from = ntfs_placement_hint(vol, group);
+	else
+		lcn_seek_from = ntfs_placement_continue(na, lcn_seek_from,
+				from_vcn << vol->cluster_size_bits,
+				na->data_size);
+	
 	need = ((*ofs + to_write - 1) >> vol->cluster_size_bits)
 			 + 1 + (*rl)->vcn - from_vcn;
 	if ((na->data_flags & ATTR_COMPRESSION_MASK)
@@ -1358,6 +1378,7 @@ static int ntfs_attr_fill_hole(ntfs_attr *na, s64 count, s64 *ofs,
 				 lcn_seek_from, DATA_ZONE);
 	if (!rlc)
 		goto err_out;
+	ntfs_placement_update(vol, group, rlc);
 	if (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_SPARSE))
 		na->compressed_size += need << vol->cluster_size_bits;
 	
@@ -1849,6 +1870,15 @@ static s64 ntfs_attr_pwrite_i(ntfs_attr *na, const s64 pos, s64 count,
 	if ((na->type == AT_DATA) && (pos >= old_data_size)
 	    && NAttrNonResident(na))
 		NAttrSetDataAppending(na);
+	/* a big unnamed stream extended from its end may get a reservation */
+	if ((na->type == AT_DATA) && !na->name_len
+	    && (pos == old_data_size)
+	    && NAttrNonResident(na)
+	    && NVolPreallocate(vol)
+	    && (old_data_size >= PREALLOC_MIN)
+	    && !(na->data_flags & (ATTR_COMPRESSION_MASK
+				| ATTR_IS_ENCRYPTED | ATTR_IS_SPARSE)))
+		NAttrSetPreallocating(na);
 	if (pos + count > na->data_size) {
 #if PARTIAL_RUNLIST_UPDATING
 		/*
@@ -2262,6 +2292,7 @@ done:
 		NAttrClearDataAppending(na);
 	}
 out:	
+	NAttrClearPreallocating(na);
 	return total;
 rl_err_out:
 	eo = errno;
@@ -2332,6 +2363,7 @@ s64 ntfs_attr_pwrite(ntfs_attr *na, const s64 pos, s64 count, const void *b)
 {
 	s64 total;
 	s64 written;
+	s64 stamp;
 
 	ntfs_log_enter("Entering for inode %lld, attr 0x%x, pos 0x%llx, count "
 		       "0x%llx.\n", (long long)na->ni->mft_no, le32_to_cpu(na->type),
@@ -2349,12 +2381,17 @@ s64 ntfs_attr_pwrite(ntfs_attr *na, const s64 pos, s64 count, const void *b)
 		 * Compressed attributes may be written partially, so
 		 * we may have to iterate.
 		 */
+	stamp = ntfs_stats_begin();
 	do {
 		written = ntfs_attr_pwrite_i(na, pos + total,
 				count - total, (const u8*)b + total);
 		if (written > 0)
 			total += written;
 	} while ((written > 0) && (total < count));
+	ntfs_stats_end(&ntfs_stats[STATS_ATTR_PWRITE], stamp,
+			(total > 0 ? total : written));
+	ntfs_trace_record(TRACE_ATTR_PWRITE, na->ni->mft_no, pos, count,
+			(total > 0 ? total : written), stamp);
 out :
 	ntfs_log_leave("\n");
 	return (total > 0 ? total : written);
@@ -4791,6 +4828,7 @@ int ntfs_attr_make_non_resident(ntfs_attr *na,
 	ntfs_volume *vol = na->ni->vol;
 	ATTR_REC *a = ctx->attr;
 	runlist *rl;
+	u64 group;
 	int mp_size, mp_ofs, name_ofs, arec_size, err;
 
 	ntfs_log_trace("Entering for inode 0x%llx, attr 0x%x.\n", (unsigned long
@@ -4820,10 +4858,13 @@ int ntfs_attr_make_non_resident(ntfs_attr *na,
 					   + vol->cluster_size_bits)) - 1)) + 1;
 			}
 		/* Start by allocating clusters to hold the attribute value. */
+		group = ntfs_placement_group(na, new_allocated_size);
 		rl = ntfs_cluster_alloc(vol, 0, new_allocated_size >>
-				vol->cluster_size_bits, -1, DATA_ZONE);
+				vol->cluster_size_bits,
+				ntfs_placement_hint(vol, group), DATA_ZONE);
 		if (!rl)
 			return -1;
+		ntfs_placement_update(vol, group, rl);
 	} else
 		rl = NULL;
 	/*
@@ -6164,6 +6205,72 @@ put_err_out:
 	return -1;
 }
 
+/*
+ *		Record that clusters are reserved beyond the end of a file
+ *
+ *	Returns TRUE if the file is recorded (possibly already)
+ *		FALSE if there was not enough memory
+ */
+
+static BOOL ntfs_reservation_record(ntfs_volume *vol, u64 inum)
+{
+	struct RESERVATION *rsv;
+
+	rsv = vol->reservations;
+	while (rsv && (rsv->inum != inum))
+		rsv = rsv->next;
+	if (!rsv) {
+		rsv = (struct RESERVATION*)ntfs_malloc(
+				sizeof(struct RESERVATION));
+		if (rsv) {
+			rsv->inum = inum;
+			rsv->next = vol->reservations;
+			vol->reservations = rsv;
+		}
+	}
+	return (rsv != (struct RESERVATION*)NULL);
+}
+
+/*
+ *		Forget the reservation recorded for a file
+ *
+ *	Returns TRUE if clusters were reserved by this mount
+ */
+
+static BOOL ntfs_reservation_forget(ntfs_volume *vol, u64 inum)
+{
+	struct RESERVATION **prsv;
+	struct RESERVATION *rsv;
+
+	prsv = &vol->reservations;
+	while (*prsv && ((*prsv)->inum != inum))
+		prsv = &(*prsv)->next;
+	rsv = *prsv;
+	if (rsv) {
+		*prsv = rsv->next;
+		free(rsv);
+	}
+	return (rsv != (struct RESERVATION*)NULL);
+}
+
+/*
+ *		Free the records of reservations when unmounting
+ *
+ *	The files are closed by then, so the records are normally
+ *	left over from files which could not be trimmed.
+ */
+
+void ntfs_attr_release_reservations(ntfs_volume *vol)
+{
+	struct RESERVATION *rsv;
+
+	while (vol->reservations) {
+		rsv = vol->reservations;
+		vol->reservations = rsv->next;
+		free(rsv);
+	}
+}
+
 /**
  * ntfs_non_resident_attr_expand - expand a non-resident, open ntfs attribute
  * @na:		non-resident ntfs attribute to expand
@@ -6187,6 +6294,8 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 	ntfs_attr_search_ctx *ctx;
 	runlist *rl, *rln;
 	s64 org_alloc_size;
+	s64 reserved;
+	u64 group;
 	int err;
 
 	ntfs_log_trace("Inode %lld, attr 0x%x, new size %lld old size %lld\n",
@@ -6213,6 +6322,25 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 	/* The first cluster outside the new allocation. */
 	first_free_vcn = (newsize + vol->cluster_size - 1) >>
 			vol->cluster_size_bits;
+	/*
+	 * When a stream is being appended to and its reservation is
+	 * exhausted, reserve as many clusters as it already uses
+	 * beyond the new end, so that the next appends find them
+	 * allocated contiguously. The reservation is not initialized,
+	 * it is freed by ntfs_attr_trim() or when truncating.
+	 */
+	reserved = 0;
+	if (NAttrPreallocating(na)
+	    && ((na->allocated_size >> vol->cluster_size_bits)
+						< first_free_vcn)) {
+		reserved = min(na->data_size, PREALLOC_MAX)
+					>> vol->cluster_size_bits;
+		if (reserved > vol->free_clusters/PREALLOC_FREE_SHARE)
+			reserved = vol->free_clusters/PREALLOC_FREE_SHARE;
+			/* record the reservation, so that it can be freed */
+		if (reserved && !ntfs_reservation_record(vol, na->ni->mft_no))
+			reserved = 0;
+	}
 	/*
 	 * Compare the new allocation with the old one and only allocate
 	 * clusters if there is a change.
@@ -6244,7 +6372,7 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 		 * sparse runs instead of real allocation of clusters.
 		 */
 		if ((na->type == AT_DATA) && (vol->major_ver >= 3)
-					 && (holes != HOLES_NO)) {
+					 && (holes != HOLES_NO) && !reserved) {
 			rl = ntfs_malloc(0x1000);
 			if (!rl)
 				return -1;
@@ -6282,12 +6410,34 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 				if (rl->lcn >= 0)
 					lcn_seek_from = rl->lcn + rl->length;
 			}
+			/* a small file is placed next to its siblings */
+			group = ntfs_placement_group(na, newsize);
+			if (lcn_seek_from == -1)
+				lcn_seek_from = ntfs_placement_hint(vol,
+								group);
+			else
+				lcn_seek_from = ntfs_placement_continue(na,
+						lcn_seek_from,
+						na->allocated_size, newsize);
 
 			rl = ntfs_cluster_alloc(vol, na->allocated_size >>
-					vol->cluster_size_bits, first_free_vcn -
-					(na->allocated_size >>
+					vol->cluster_size_bits, first_free_vcn
+					+ reserved - (na->allocated_size >>
 					vol->cluster_size_bits), lcn_seek_from,
 					DATA_ZONE);
+			/* not enough space, give up the reservation */
+			if (!rl && reserved && (errno == ENOSPC)) {
+				reserved = 0;
+				ntfs_reservation_forget(vol, na->ni->mft_no);
+				rl = ntfs_cluster_alloc(vol,
+					na->allocated_size
+						>> vol->cluster_size_bits,
+					first_free_vcn - (na->allocated_size
+						>> vol->cluster_size_bits),
+					lcn_seek_from, DATA_ZONE);
+			}
+			if (rl)
+				ntfs_placement_update(vol, group, rl);
 			if (!rl) {
 				ntfs_log_perror("Cluster allocation failed "
 						"(%lld)",
@@ -6313,7 +6463,8 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 		NAttrSetRunlistDirty(na);
 
 		/* Prepare to mapping pairs update. */
-		na->allocated_size = first_free_vcn << vol->cluster_size_bits;
+		na->allocated_size = (first_free_vcn + reserved)
+						<< vol->cluster_size_bits;
 #if PARTIAL_RUNLIST_UPDATING
 		/*
 		 * Write mapping pairs for new runlist, unless this is
@@ -6546,6 +6697,40 @@ int ntfs_attr_truncate_solid(ntfs_attr *na, const s64 newsize)
 	return (ntfs_attr_truncate_i(na, newsize, HOLES_NO));
 }
 
+/*
+ *		Free the clusters reserved beyond the end of an attribute
+ *
+ *	This is meant to be called when closing a file which may have
+ *	been appended to with preallocation, nothing is done when
+ *	there is no reservation made by this mount, so that the space
+ *	allocated in advance by another system is kept.
+ *
+ *	Returns 0 if successful,
+ *		-1 if it failed (as explained in errno)
+ */
+
+int ntfs_attr_trim(ntfs_attr *na)
+{
+	ntfs_volume *vol;
+	int res;
+
+	res = 0;
+	vol = na->ni->vol;
+	if (ntfs_reservation_forget(vol, na->ni->mft_no)
+	    && NAttrNonResident(na)
+	    && na->data_size
+	    && !(na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED))
+	    && (na->allocated_size > ((na->data_size + vol->cluster_size - 1)
+					& -(s64)vol->cluster_size))) {
+		ntfs_log_trace("Inode %lld trimmed from %lld to %lld\n",
+				(long long)na->ni->mft_no,
+				(long long)na->allocated_size,
+				(long long)na->data_size);
+		res = ntfs_non_resident_attr_shrink(na, na->data_size);
+	}
+	return (res);
+}
+
 /*
  *		Stuff a hole in a compressed file
  *
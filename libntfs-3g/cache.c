@@ -32,7 +32,9 @@
 
 #include "types.h"
 #include "security.h"
+#include "reparse.h"
 #include "cache.h"
+#include "lcnalloc.h"
 #include "misc.h"
 #include "logging.h"
 
@@ -577,6 +579,13 @@ void ntfs_create_lru_caches(ntfs_volume *vol)
 		(cache_free)NULL, ntfs_dir_lookup_hash,
 		sizeof(struct CACHED_LOOKUP),
 		CACHE_LOOKUP_SIZE, 2*CACHE_LOOKUP_SIZE);
+#endif
+#if CACHE_LOOKUP_SIZE && CACHE_NEGATIVE_SIZE
+		 /* missing names cache */
+	vol->negative_cache = ntfs_create_cache("negative",
+		(cache_free)NULL, ntfs_dir_lookup_hash,
+		sizeof(struct CACHED_LOOKUP),
+		CACHE_NEGATIVE_SIZE, 2*CACHE_LOOKUP_SIZE);
 #endif
 	vol->securid_cache = ntfs_create_cache("securid",(cache_free)NULL,
 		(cache_hash)NULL,sizeof(struct CACHED_SECURID), CACHE_SECURID_SIZE, 0);
@@ -584,6 +593,40 @@ void ntfs_create_lru_caches(ntfs_volume *vol)
 	vol->legacy_cache = ntfs_create_cache("legacy",(cache_free)NULL,
 		(cache_hash)NULL, sizeof(struct CACHED_PERMISSIONS_LEGACY), CACHE_LEGACY_SIZE, 0);
 #endif
+#if CACHE_GROUPS_SIZE
+		 /* groups cache */
+	vol->groups_cache = ntfs_create_cache("groups",(cache_free)NULL,
+		ntfs_groups_hash, sizeof(struct CACHED_GROUPS),
+		CACHE_GROUPS_SIZE, 2*CACHE_GROUPS_SIZE);
+#endif
+#if CACHE_INHERITED_SIZE
+		 /* inherited ids cache */
+	vol->inherited_cache = ntfs_create_cache("inherited",
+		(cache_free)NULL, ntfs_inherited_hash,
+		sizeof(struct CACHED_INHERITED),
+		CACHE_INHERITED_SIZE, 2*CACHE_INHERITED_SIZE);
+#endif
+#if CACHE_SYMLINK_SIZE
+		 /* symlink targets cache */
+	vol->symlink_cache = ntfs_create_cache("symlink",
+		(cache_free)NULL, ntfs_symlink_hash,
+		sizeof(struct CACHED_SYMLINK),
+		CACHE_SYMLINK_SIZE, 2*CACHE_SYMLINK_SIZE);
+#endif
+#if CACHE_PLACEMENT_SIZE
+		 /* placement of small files cache */
+	vol->placement_cache = ntfs_create_cache("placement",
+		(cache_free)NULL, ntfs_placement_hash,
+		sizeof(struct CACHED_PLACEMENT),
+		CACHE_PLACEMENT_SIZE, 2*CACHE_PLACEMENT_SIZE);
+#endif
+#if CACHE_LISTING_SIZE
+		 /* directory listings cache */
+	vol->listing_cache = ntfs_create_cache("listing",
+		(cache_free)NULL, ntfs_dir_listing_hash,
+		sizeof(struct CACHED_LISTING),
+		CACHE_LISTING_SIZE, 2*CACHE_LISTING_SIZE);
+#endif
 }
 
 /*
@@ -600,9 +643,27 @@ void ntfs_free_lru_caches(ntfs_volume *vol)
 #endif
 #if CACHE_LOOKUP_SIZE
 	ntfs_free_cache(vol->lookup_cache);
+#endif
+#if CACHE_LOOKUP_SIZE && CACHE_NEGATIVE_SIZE
+	ntfs_free_cache(vol->negative_cache);
 #endif
 	ntfs_free_cache(vol->securid_cache);
 #if CACHE_LEGACY_SIZE
 	ntfs_free_cache(vol->legacy_cache);
 #endif
+#if CACHE_GROUPS_SIZE
+	ntfs_free_cache(vol->groups_cache);
+#endif
+#if CACHE_INHERITED_SIZE
+	ntfs_free_cache(vol->inherited_cache);
+#endif
+#if CACHE_SYMLINK_SIZE
+	ntfs_free_cache(vol->symlink_cache);
+#endif
+#if CACHE_PLACEMENT_SIZE
+	ntfs_free_cache(vol->placement_cache);
+#endif
+#if CACHE_LISTING_SIZE
+	ntfs_free_cache(vol->listing_cache);
+#endif
 }
@@ -51,6 +51,7 @@
 #include "lcnalloc.h"
 #include "logging.h"
 #include "misc.h"
+#include "stats.h"
 
 #undef le16_to_cpup 
 /* the standard le16_to_cpup() crashes for unaligned data on some processors */ 
@@ -72,13 +73,37 @@ typedef enum {
 } ntfs_compression_constants;
 
 /* Match length at or above which ntfs_best_match() will stop searching for
- * longer matches.  */
+ * longer matches, for the normal compression level.  */
 #define NICE_MATCH_LEN 18
 
 /* Maximum number of potential matches that ntfs_best_match() will consider at
- * each position.  */
+ * each position, for the normal compression level.  */
 #define MAX_SEARCH_DEPTH 24
 
+/* Same limits for the best compression level.  */
+#define BEST_NICE_MATCH_LEN 258
+#define BEST_SEARCH_DEPTH 256
+
+/* Match finding parameters, indexed by compression level.  The fast level
+ * only considers the most recent position with the same hash, and does not
+ * check whether a longer match begins at the next position.  */
+static const struct {
+	int nice_len;
+	int max_depth;
+	BOOL lazy;
+} compression_levels[] = {
+	{ NICE_MATCH_LEN, MAX_SEARCH_DEPTH, TRUE },	/* default */
+	{ NICE_MATCH_LEN, 1, FALSE },			/* fast */
+	{ NICE_MATCH_LEN, MAX_SEARCH_DEPTH, TRUE },	/* normal */
+	{ BEST_NICE_MATCH_LEN, BEST_SEARCH_DEPTH, TRUE },	/* best */
+} ;
+
+/* Deviation from a uniform distribution of byte values below which a
+ * compression unit is suspected to be incompressible.  The value computed
+ * by ntfs_incompressible() is about 255 for random data, and much higher
+ * for text or code.  */
+#define INCOMPRESSIBLE_DEVIATION 512
+
 /* log base 2 of the number of entries in the hash table for match-finding.  */
 #define HASH_SHIFT 14
 
@@ -91,6 +116,9 @@ struct COMPRESS_CONTEXT {
 	int size;
 	int rel;
 	int mxsz;
+	int nice_len;
+	int max_depth;
+	BOOL lazy;
 	s16 head[1 << HASH_SHIFT];
 	s16 prev[NTFS_SB_SIZE];
 } ;
@@ -138,13 +166,15 @@ static inline unsigned int ntfs_hash(const u8 *p)
  *	Note: for the following reasons, this function is not guaranteed to find
  *	*the* longest match up to pctx->mxsz:
  *
- *	(1) If this function finds a match of NICE_MATCH_LEN bytes or greater,
+ *	(1) If this function finds a match of pctx->nice_len bytes or greater,
  *	    it ends early because a match this long is good enough and it's not
  *	    worth spending more time searching.
  *
- *	(2) If this function considers MAX_SEARCH_DEPTH matches with a single
+ *	(2) If this function considers pctx->max_depth matches with a single
  *	    position, it ends early and returns the longest match found so far.
  *	    This saves a lot of time on degenerate inputs.
+ *
+ *	Both limits depend on the compression level.
  */
 static void ntfs_best_match(struct COMPRESS_CONTEXT *pctx, const int i,
 			    int best_len)
@@ -153,8 +183,8 @@ static void ntfs_best_match(struct COMPRESS_CONTEXT *pctx, const int i,
 	const u8 * const strptr = &inbuf[i]; /* String we're matching against */
 	s16 * const prev = pctx->prev;
 	const int max_len = min(pctx->bufsize - i, pctx->mxsz);
-	const int nice_len = min(NICE_MATCH_LEN, max_len);
-	int depth_remaining = MAX_SEARCH_DEPTH;
+	const int nice_len = min(pctx->nice_len, max_len);
+	int depth_remaining = pctx->max_depth;
 	const u8 *best_matchptr = strptr;
 	unsigned int hash;
 	s16 cur_match;
@@ -274,7 +304,7 @@ static void ntfs_skip_position(struct COMPRESS_CONTEXT *pctx, const int i)
  */
 
 static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
-				char *outbuf)
+				char *outbuf, int level)
 {
 	struct COMPRESS_CONTEXT *pctx;
 	int i; /* current position */
@@ -303,6 +333,11 @@ static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
 
 	pctx->inbuf = (const unsigned char*)inbuf;
 	pctx->bufsize = bufsize;
+	if ((level < 0) || (level > COMPRESSION_LEVEL_BEST))
+		level = 0;
+	pctx->nice_len = compression_levels[level].nice_len;
+	pctx->max_depth = compression_levels[level].max_depth;
+	pctx->lazy = compression_levels[level].lazy;
 	xout = 2;
 	i = 0;
 	bp = 4;
@@ -318,7 +353,8 @@ static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
 		/* This implementation uses "lazy" parsing: it always chooses
 		 * the longest match, unless the match at the next position is
 		 * longer.  This is the same strategy used by the high
-		 * compression modes of zlib.  */
+		 * compression modes of zlib.  At the fast level, the match
+		 * at the current position is always chosen.  */
 
 		if (!have_match) {
 			/* Find the longest match at the current position.  But
@@ -341,7 +377,7 @@ static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
 			bp_cur = bp;
 			offs = pctx->rel;
 
-			if (pctx->size >= NICE_MATCH_LEN) {
+			if ((pctx->size >= pctx->nice_len) || !pctx->lazy) {
 
 				/* Choose long matches immediately.  */
 
@@ -1055,6 +1091,63 @@ static s32 write_clusters(ntfs_volume *vol, const runlist_element *rl,
 }
 
 
+/*
+ *		Check whether a compression unit is not worth compressing
+ *
+ *	Already compressed data (images, archives, video) cannot be
+ *	compressed further, but this is only detected after all the
+ *	sub-blocks have been compressed, so nearly all the compression
+ *	time is wasted on such data.
+ *
+ *	The distribution of byte values over the unit is checked first,
+ *	and when it is nearly uniform, the first sub-block is compressed
+ *	with the fast level. The unit is considered as incompressible
+ *	when this does not save its share of the cluster which is needed.
+ *	Units with a non uniform distribution are never skipped, so the
+ *	decision can only be wrong for units which compress poorly.
+ *
+ *	Returns TRUE if the unit should be stored uncompressed
+ */
+
+static BOOL ntfs_incompressible(ntfs_attr *na, const char *inbuf, u32 insz)
+{
+	u32 counts[256];
+	const unsigned char *p;
+	char *probe;
+	u64 sumsq;
+	u32 deviation;
+	u32 clsz;
+	unsigned int sz;
+	BOOL skip;
+	u32 i;
+
+	skip = FALSE;
+		/* short units are cheap to compress */
+	if (insz >= 2*NTFS_SB_SIZE) {
+		memset(counts, 0, sizeof(counts));
+		p = (const unsigned char*)inbuf;
+		for (i=0; i<insz; i++)
+			counts[p[i]]++;
+		sumsq = 0;
+		for (i=0; i<256; i++)
+			sumsq += (u64)counts[i]*counts[i];
+		deviation = (u32)((256*sumsq)/insz - insz);
+		if (deviation < INCOMPRESSIBLE_DEVIATION) {
+			probe = (char*)ntfs_malloc(NTFS_SB_SIZE + 4);
+			if (probe) {
+				clsz = 1 << na->ni->vol->cluster_size_bits;
+				sz = ntfs_compress_block(inbuf, NTFS_SB_SIZE,
+					probe, COMPRESSION_LEVEL_FAST);
+				skip = !sz || ((sz + 2)*(u64)na->compression_block_size
+					> (u64)NTFS_SB_SIZE
+					    *(na->compression_block_size - clsz));
+				free(probe);
+			}
+		}
+	}
+	return (skip);
+}
+
 /*
  *		Compress and write a set of blocks
  *
@@ -1079,6 +1172,7 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 	unsigned int bsz;
 	BOOL fail;
 	BOOL allzeroes;
+	s64 stamp;
 		/* a single compressed zero */
 	static char onezero[] = { 0x01, 0xb0, 0x00, 0x00 } ;
 		/* a couple of compressed zeroes */
@@ -1088,11 +1182,16 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 
 	vol = na->ni->vol;
 	written = -1; /* default return */
+	stamp = ntfs_stats_begin();
 	clsz = 1 << vol->cluster_size_bits;
+	if (ntfs_incompressible(na, inbuf, insz)) {
+		ntfs_stats_end(&ntfs_stats[STATS_COMPRESS_SKIP], stamp, insz);
+		outbuf = (char*)NULL;
+	} else
 		/* may need 2 extra bytes per block and 2 more bytes */
-	outbuf = (char*)ntfs_malloc(na->compression_block_size
-			+ 2*(na->compression_block_size/NTFS_SB_SIZE)
-			+ 2);
+		outbuf = (char*)ntfs_malloc(na->compression_block_size
+				+ 2*(na->compression_block_size/NTFS_SB_SIZE)
+				+ 2);
 	if (outbuf) {
 		fail = FALSE;
 		compsz = 0;
@@ -1103,7 +1202,8 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 			else
 				bsz = insz - p;
 			pbuf = &outbuf[compsz];
-			sz = ntfs_compress_block(&inbuf[p],bsz,pbuf);
+			sz = ntfs_compress_block(&inbuf[p],bsz,pbuf,
+					vol->compression_level);
 			/* fail if all the clusters (or more) are needed */
 			if (!sz || ((compsz + sz + clsz + 2)
 					 > na->compression_block_size))
@@ -1153,6 +1253,8 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 			if (!fail)
 				written = 0;
 		free(outbuf);
+		ntfs_stats_end(&ntfs_stats[STATS_COMPRESS_UNIT], stamp,
+				(written >= 0 ? (s64)insz : -1));
 	}
 	return (written);
 }
@@ -78,6 +78,8 @@
 #include "device.h"
 #include "logging.h"
 #include "misc.h"
+#include "stats.h"
+#include "trace.h"
 
 #ifndef UEFI_DRIVER
 
@@ -209,6 +211,7 @@ int ntfs_device_sync(struct ntfs_device *dev)
 s64 ntfs_pread(struct ntfs_device *dev, const s64 pos, s64 count, void *b)
 {
 	s64 br, total;
+	s64 stamp;
 	struct ntfs_device_operations *dops;
 
 	ntfs_log_trace("pos %lld, count %lld\n",(long long)pos,(long long)count);
@@ -223,7 +226,11 @@ s64 ntfs_pread(struct ntfs_device *dev, const s64 pos, s64 count, void *b)
 	dops = dev->d_ops;
 
 	for (total = 0; count; count -= br, total += br) {
+		stamp = ntfs_stats_begin();
 		br = dops->pread(dev, (char*)b + total, count, pos + total);
+		ntfs_stats_end(&ntfs_stats[STATS_DEVICE_READ], stamp, br);
+		ntfs_trace_record(TRACE_DEVICE_READ, 0, pos + total, count,
+				(br < 0 ? -errno : br), stamp);
 		/* If everything ok, continue. */
 		if (br > 0)
 			continue;
@@ -260,6 +267,7 @@ s64 ntfs_pwrite(struct ntfs_device *dev, const s64 pos, s64 count,
 		const void *b)
 {
 	s64 written, total, ret = -1;
+	s64 stamp;
 	struct ntfs_device_operations *dops;
 
 	ntfs_log_trace("pos %lld, count %lld\n",(long long)pos,(long long)count);
@@ -279,8 +287,13 @@ s64 ntfs_pwrite(struct ntfs_device *dev, const s64 pos, s64 count,
 
 	NDevSetDirty(dev);
 	for (total = 0; count; count -= written, total += written) {
+		stamp = ntfs_stats_begin();
 		written = dops->pwrite(dev, (const char*)b + total, count,
 				       pos + total);
+		ntfs_stats_end(&ntfs_stats[STATS_DEVICE_WRITE], stamp,
+				written);
+		ntfs_trace_record(TRACE_DEVICE_WRITE, 0, pos + total, count,
+				(written < 0 ? -errno : written), stamp);
 		/* If everything ok, continue. */
 		if (written > 0)
 			continue;
@@ -95,13 +95,16 @@ ntfschar NTFS_INDEX_R[3] = { const_cpu_to_le16('$'), const_cpu_to_le16('R'),
 /*
  *		Pathname hashing
  *
- *	Based on first char and second char (which may be '\0')
+ *	Based on all the chars of the last name and the length
+ *	of the full path, so that the same name in different
+ *	directories gets different hashes.
  */
 
 int ntfs_dir_inode_hash(const struct CACHED_GENERIC *cached)
 {
 	const char *path;
 	const unsigned char *name;
+	unsigned int val;
 
 	path = (const char*)cached->variable;
 	if (!path) {
@@ -111,8 +114,10 @@ int ntfs_dir_inode_hash(const struct CACHED_GENERIC *cached)
 	name = (const unsigned char*)strrchr(path,'/');
 	if (!name)
 		name = (const unsigned char*)path;
-	return (((name[0] << 1) + name[1] + strlen((const char*)name))
-				% (2*CACHE_INODE_SIZE));
+	val = cached->varsize;
+	while (*name)
+		val = (val << 5) - val + *name++;
+	return (val % (2*CACHE_INODE_SIZE));
 }
 
 /*
@@ -219,7 +224,117 @@ int ntfs_dir_lookup_hash(const struct CACHED_GENERIC *cached)
 	return (val % (2*CACHE_LOOKUP_SIZE));
 }
 
+#if CACHE_NEGATIVE_SIZE
+
+/*
+ *		Directory comparing for invalidating the missing names cache
+ *
+ *	All entries with designated parent are invalidated
+ *
+ *	Only use associated with a CACHE_NOHASH flag
+ */
+
+static int negative_cache_inv_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	const struct CACHED_LOOKUP *c = (const struct CACHED_LOOKUP*) cached;
+	const struct CACHED_LOOKUP *w = (const struct CACHED_LOOKUP*) wanted;
+	return (!c->name
+		    || (c->parent != w->parent));
+}
+
+#endif /* CACHE_NEGATIVE_SIZE */
+
+#endif /* CACHE_LOOKUP_SIZE */
+
+/*
+ *		Forget the names known to be missing from a directory
+ *	when a name is added to it
+ *
+ *	The cache is keyed on the UTF-8 name, which is not known here,
+ *	so all the missing names of the directory are forgotten.
+ */
+
+static void ntfs_dir_forget_missing(ntfs_inode *dir_ni)
+{
+#if CACHE_LOOKUP_SIZE && CACHE_NEGATIVE_SIZE
+	struct CACHED_LOOKUP item;
+
+	if (dir_ni->vol->negative_cache) {
+		item.name = (const char*)NULL;
+		item.namesize = 0;
+		item.parent = dir_ni->mft_no;
+		item.inum = (u64)-1;
+		ntfs_invalidate_cache(dir_ni->vol->negative_cache,
+				GENERIC(&item), negative_cache_inv_compare,
+				CACHE_NOHASH);
+	}
+#endif
+}
+
+#if CACHE_LISTING_SIZE
+
+/*
+ *		Entry of a cached directory listing
+ *
+ *	A listing is made of the entries as they were submitted to the
+ *	filldir callback, in ascending positions, followed by the indexes
+ *	of the entries in collation order, then by their names.
+ */
+
+struct LISTED_ENTRY {
+	s64 pos;
+	MFT_REF mref;
+	u32 name_offset;	/* from the beginning of the listing */
+	u32 dt_type;
+	u16 name_len;
+	u8 name_type;
+} ;
+
+static int listing_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	return (((const struct CACHED_LISTING*)cached)->inum
+			!= ((const struct CACHED_LISTING*)wanted)->inum);
+}
+
+/*
+ *		Listing hashing, based on the directory inode number
+ */
+
+int ntfs_dir_listing_hash(const struct CACHED_GENERIC *cached)
+{
+	const struct CACHED_LISTING *entry;
+
+	entry = (const struct CACHED_LISTING*)cached;
+	return (entry->inum % (2*CACHE_LISTING_SIZE));
+}
+
+#endif /* CACHE_LISTING_SIZE */
+
+/*
+ *		Forget the cached listing of a directory
+ *
+ *	This has to be done whenever the index of the directory is
+ *	modified, as the positions of entries may have changed, and
+ *	when the directory is renamed, as ".." may have changed.
+ *	A listing being replayed is protected by the generation number.
+ */
+
+void ntfs_dir_forget_listing(ntfs_inode *dir_ni __attribute__((unused)))
+{
+#if CACHE_LISTING_SIZE
+	struct CACHED_LISTING item;
+
+	if (dir_ni->vol->listing_cache) {
+		item.inum = dir_ni->mft_no;
+		if (ntfs_invalidate_cache(dir_ni->vol->listing_cache,
+				GENERIC(&item), listing_cache_compare,
+				CACHE_FREE))
+			dir_ni->vol->listing_generation++;
+	}
 #endif
+}
 
 /**
  * ntfs_inode_lookup_by_name - find an inode in a directory given its name
@@ -394,7 +509,7 @@ u64 ntfs_inode_lookup_by_name(ntfs_inode *dir_ni,
 descend_into_child_node:
 
 	/* Read the index block starting at vcn. */
-	br = ntfs_attr_mst_pread(ia_na, vcn << index_vcn_size_bits, 1,
+	br = ntfs_index_block_pread(ia_na, vcn << index_vcn_size_bits,
 			index_block_size, ia);
 	if (br != 1) {
 		if (br != -1)
@@ -552,6 +667,7 @@ u64 ntfs_inode_lookup_by_mbsname(ntfs_inode *dir_ni, const char *name)
 	u64 inum;
 	char *cached_name;
 	const char *const_name;
+	int err;
 
 	if (!NVolCaseSensitive(dir_ni->vol)) {
 		cached_name = ntfs_uppercase_mbs(name,
@@ -582,18 +698,45 @@ u64 ntfs_inode_lookup_by_mbsname(ntfs_inode *dir_ni, const char *name)
 				inum = cached->inum;
 				if (inum == (u64)-1)
 					errno = ENOENT;
+#if CACHE_NEGATIVE_SIZE
+			} else if (dir_ni->vol->negative_cache
+				    && ntfs_fetch_cache(
+					dir_ni->vol->negative_cache,
+					GENERIC(&item), lookup_cache_compare)) {
+				/* known to be missing */
+				inum = (u64)-1;
+				errno = ENOENT;
+#endif
 			} else {
 				/* Generate unicode name. */
 				uname_len = ntfs_mbstoucs(name, &uname);
 				if (uname_len >= 0) {
 					inum = ntfs_inode_lookup_by_name(dir_ni,
 							uname, uname_len);
+					err = errno;
 					item.inum = inum;
+#if CACHE_NEGATIVE_SIZE
+				/* missing names are cached separately */
+					if (inum != (u64)-1)
+						ntfs_enter_cache(
+							dir_ni->vol->lookup_cache,
+							GENERIC(&item),
+							lookup_cache_compare);
+					else
+						if ((err == ENOENT)
+						    && dir_ni->vol->negative_cache)
+							ntfs_enter_cache(
+							dir_ni->vol->negative_cache,
+							GENERIC(&item),
+							lookup_cache_compare);
+#else
 				/* enter into cache, even if not found */
 					ntfs_enter_cache(dir_ni->vol->lookup_cache,
 							GENERIC(&item),
 							lookup_cache_compare);
+#endif
 					free(uname);
+					errno = err;
 				} else
 					inum = (s64)-1;
 			}
@@ -681,6 +824,7 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 	struct CACHED_INODE item;
 	struct CACHED_INODE *cached;
 	char *fullname;
+	char *cut;
 #endif
 
 	if (!vol || !pathname) {
@@ -711,38 +855,62 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 	} else {
 #if CACHE_INODE_SIZE
 			/*
-			 * fetch inode for full path from cache
+			 * fetch inode for full path from cache, and if
+			 * not found, for the longest cached partial path,
+			 * shortening the path one name at a time.
 			 */
+		cached = (struct CACHED_INODE*)NULL;
+		q = (char*)NULL;
 		if (*fullname) {
 			item.pathname = fullname;
-			item.varsize = strlen(fullname) + 1;
-			cached = (struct CACHED_INODE*)ntfs_fetch_cache(
-				vol->xinode_cache, GENERIC(&item),
-				inode_cache_compare);
-		} else
-			cached = (struct CACHED_INODE*)NULL;
+			do {
+				item.varsize = strlen(fullname) + 1;
+				cached = (struct CACHED_INODE*)ntfs_fetch_cache(
+					vol->xinode_cache, GENERIC(&item),
+					inode_cache_compare);
+				if (!cached) {
+					cut = strrchr(fullname, PATH_SEP);
+					if (q)
+						*q = PATH_SEP;
+					q = cut;
+					if (q)
+						*q = '\0';
+				}
+			} while (!cached && q);
+		}
 		if (cached) {
-			/*
-			 * return opened inode if found in cache
-			 */
 			inum = MREF(cached->inum);
 			ni = ntfs_inode_open(vol, inum);
 			if (!ni) {
 				ntfs_log_debug("Cannot open inode %llu: %s.\n",
 						(unsigned long long)inum, p);
 				err = EIO;
+				goto out;
 			}
-			result = ni;
-			goto out;
-		}
+			if (!q) {
+				/*
+				 * return opened inode if full path
+				 * was found in cache
+				 */
+				result = ni;
+				goto out;
+			}
+				/* search the remaining names from there */
+			*q++ = PATH_SEP;
+			p = q;
+			while (*p == PATH_SEP)
+				p++;
+		} else
 #endif
-		ni = ntfs_inode_open(vol, FILE_root);
-		if (!ni) {
-			ntfs_log_debug("Couldn't open the inode of the root "
-					"directory.\n");
-			err = EIO;
-			result = (ntfs_inode*)NULL;
-			goto out;
+		{
+			ni = ntfs_inode_open(vol, FILE_root);
+			if (!ni) {
+				ntfs_log_debug("Couldn't open the inode of "
+					"the root directory.\n");
+				err = EIO;
+				result = (ntfs_inode*)NULL;
+				goto out;
+			}
 		}
 	}
 
@@ -752,45 +920,6 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 		if (q != NULL) {
 			*q = '\0';
 		}
-#if CACHE_INODE_SIZE
-			/*
-			 * fetch inode for partial path from cache
-			 */
-		cached = (struct CACHED_INODE*)NULL;
-		if (!parent) {
-			item.pathname = fullname;
-			item.varsize = strlen(fullname) + 1;
-			cached = (struct CACHED_INODE*)ntfs_fetch_cache(
-					vol->xinode_cache, GENERIC(&item),
-					inode_cache_compare);
-			if (cached) {
-				inum = cached->inum;
-			}
-		}
-			/*
-			 * if not in cache, translate, search, then
-			 * insert into cache if found
-			 */
-		if (!cached) {
-			len = ntfs_mbstoucs(p, &unicode);
-			if (len < 0) {
-				ntfs_log_perror("Could not convert filename to Unicode:"
-					" '%s'", p);
-				err = errno;
-				goto close;
-			} else if (len > NTFS_MAX_NAME_LEN) {
-				err = ENAMETOOLONG;
-				goto close;
-			}
-			inum = ntfs_inode_lookup_by_name(ni, unicode, len);
-			if (!parent && (inum != (u64) -1)) {
-				item.inum = inum;
-				ntfs_enter_cache(vol->xinode_cache,
-						GENERIC(&item),
-						inode_cache_compare);
-			}
-		}
-#else
 		len = ntfs_mbstoucs(p, &unicode);
 		if (len < 0) {
 			ntfs_log_perror("Could not convert filename to Unicode:"
@@ -802,6 +931,19 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 			goto close;
 		}
 		inum = ntfs_inode_lookup_by_name(ni, unicode, len);
+#if CACHE_INODE_SIZE
+			/*
+			 * The partial paths were not found in cache,
+			 * insert them when found in directory
+			 */
+		if (!parent && (inum != (u64) -1)) {
+			item.pathname = fullname;
+			item.varsize = strlen(fullname) + 1;
+			item.inum = inum;
+			ntfs_enter_cache(vol->xinode_cache,
+					GENERIC(&item),
+					inode_cache_compare);
+		}
 #endif
 		if (inum == (u64) -1) {
 			ntfs_log_debug("Couldn't find name '%s' in pathname "
@@ -1086,25 +1228,13 @@ err_out:
 	return ERR_MREF(-1);
 }
 
-/**
- * ntfs_readdir - read the contents of an ntfs directory
- * @dir_ni:	ntfs inode of current directory
- * @pos:	current position in directory
- * @dirent:	context for filldir callback supplied by the caller
- * @filldir:	filldir callback supplied by the caller
- *
- * Parse the index root and the index blocks that are marked in use in the
- * index bitmap and hand each found directory entry to the @filldir callback
- * supplied by the caller.
- *
- * Return 0 on success or -1 on error with errno set to the error code.
- * On success, the value at address 'pos' gets updated to the position of the
- * next entry in the directory or -1 if no more entries are available.
+/*
+ *		Read the contents of a directory from its index
  *
- * Note: Index blocks are parsed in ascending vcn order, from which follows
- * that the directory entries are not returned sorted.
+ *	See ntfs_readdir() for the arguments and the returned values.
  */
-int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
+
+static int ntfs_readdir_index(ntfs_inode *dir_ni, s64 *pos,
 		void *dirent, ntfs_filldir_t filldir)
 {
 	s64 i_size, br, ia_pos, bmp_pos, ia_start, ia_offset;
@@ -1332,7 +1462,7 @@ find_next_index_buffer:
 	ntfs_log_debug("Handling index block 0x%llx.\n", (long long)bmp_pos);
 
 	/* Read the index block starting at bmp_pos. */
-	br = ntfs_attr_mst_pread(ia_na, bmp_pos << index_block_size_bits, 1,
+	br = ntfs_index_block_pread(ia_na, bmp_pos << index_block_size_bits,
 			index_block_size, ia);
 	if (br != 1) {
 		if (br != -1)
@@ -1448,6 +1578,581 @@ err_out:
 	return -1;
 }
 
+/*
+ *		Read the contents of a directory from its index in collation
+ *	order, starting after a name (or from the beginning if NULL)
+ *
+ *	"." and ".." are not returned. See ntfs_readdir_after() for the
+ *	returned values.
+ */
+
+static int ntfs_readdir_index_after(ntfs_inode *dir_ni, const ntfschar *name,
+		int name_len, void *dirent, ntfs_filldir_t filldir)
+{
+	ntfs_index_context *icx;
+	INDEX_ENTRY *entry;
+	s64 pos;
+	int lkup;
+	int olderrno;
+	int rc;
+	struct {
+		FILE_NAME_ATTR_BASE attr;
+		ntfschar file_name[NTFS_MAX_NAME_LEN + 1];
+	} find;
+
+	rc = 0;
+	icx = ntfs_index_ctx_get(dir_ni, NTFS_INDEX_I30, 4);
+	if (!icx)
+		return (-1);
+		/* an empty name collates before all names */
+	memset(&find.attr, 0, sizeof(find.attr));
+	if (name) {
+		find.attr.file_name_length = name_len;
+		memcpy(find.file_name, name, name_len*sizeof(ntfschar));
+	}
+	olderrno = errno;
+	lkup = ntfs_index_lookup((char*)&find, sizeof(find.attr)
+			+ find.attr.file_name_length*sizeof(ntfschar), icx);
+	if (!lkup)
+		entry = ntfs_index_next(icx->entry, icx);
+	else
+		if (errno == ENOENT) {
+			errno = olderrno;
+			/* get next entry if reaching end of block */
+			entry = icx->entry;
+			if (entry && (entry->ie_flags & INDEX_ENTRY_END))
+				entry = ntfs_index_next(entry, icx);
+		} else {
+			entry = (INDEX_ENTRY*)NULL;
+			rc = -1;
+		}
+	while (entry && !rc) {
+		pos = 2;
+		rc = ntfs_filldir(dir_ni, &pos, entry, dirent, filldir);
+		if (!rc)
+			entry = ntfs_index_next(entry, icx);
+	}
+	ntfs_index_ctx_put(icx);
+	return (rc < 0 ? -1 : 0);
+}
+
+
+#if CACHE_LISTING_SIZE
+
+/*
+ *		Context for building the listing of a directory
+ */
+
+struct LISTING_BUILDER {
+	struct LISTED_ENTRY *entries;
+	ntfschar *names;
+	int count;
+	int allocated;
+	u32 names_len;
+	u32 names_allocated;
+	BOOL overflow;
+} ;
+
+/*
+ *		Record an entry into a listing being built
+ *
+ *	Returns 0 to go on, or 1 if the listing is too big or there is
+ *		not enough memory, so that building is abandoned
+ */
+
+static int ntfs_listing_filldir(void *dirent, const ntfschar *name,
+		const int name_len, const int name_type, const s64 pos,
+		const MFT_REF mref, const unsigned dt_type)
+{
+	struct LISTING_BUILDER *builder;
+	struct LISTED_ENTRY *entries;
+	struct LISTED_ENTRY *entry;
+	ntfschar *names;
+	u32 size;
+
+	builder = (struct LISTING_BUILDER*)dirent;
+	if (builder->count >= builder->allocated) {
+		size = (builder->allocated ? 2*builder->allocated : 64);
+		entries = (struct LISTED_ENTRY*)realloc(builder->entries,
+				size*sizeof(struct LISTED_ENTRY));
+		if (entries) {
+			builder->entries = entries;
+			builder->allocated = size;
+		} else
+			builder->overflow = TRUE;
+	}
+	if ((builder->names_len + name_len) > builder->names_allocated) {
+		size = (builder->names_allocated
+				? 2*builder->names_allocated : 1024);
+		while (size < (builder->names_len + name_len))
+			size <<= 1;
+		names = (ntfschar*)realloc(builder->names,
+				size*sizeof(ntfschar));
+		if (names) {
+			builder->names = names;
+			builder->names_allocated = size;
+		} else
+			builder->overflow = TRUE;
+	}
+	if ((builder->count*(sizeof(struct LISTED_ENTRY) + sizeof(u32))
+			+ (builder->names_len + name_len)*sizeof(ntfschar))
+		    > CACHE_LISTING_MAX)
+		builder->overflow = TRUE;
+	if (!builder->overflow) {
+		entry = &builder->entries[builder->count++];
+		entry->pos = pos;
+		entry->mref = mref;
+		entry->name_offset = builder->names_len;
+		entry->dt_type = dt_type;
+		entry->name_len = name_len;
+		entry->name_type = name_type;
+		memcpy(&builder->names[builder->names_len], name,
+				name_len*sizeof(ntfschar));
+		builder->names_len += name_len;
+	}
+	return (builder->overflow ? 1 : 0);
+}
+
+/*
+ *		Compare two entries of a listing in collation order
+ *
+ *	The names are compared as in the index, "." and ".." come first.
+ */
+
+static int ntfs_listed_collate(ntfs_volume *vol, const char *listing,
+			u32 first, u32 second)
+{
+	const struct LISTED_ENTRY *entry1;
+	const struct LISTED_ENTRY *entry2;
+
+	entry1 = &((const struct LISTED_ENTRY*)listing)[first];
+	entry2 = &((const struct LISTED_ENTRY*)listing)[second];
+	if ((entry1->pos < 2) || (entry2->pos < 2))
+		return (entry1->pos < entry2->pos
+			? -1 : (entry1->pos > entry2->pos ? 1 : 0));
+	return (ntfs_names_full_collate(
+			(const ntfschar*)(listing + entry1->name_offset),
+			entry1->name_len,
+			(const ntfschar*)(listing + entry2->name_offset),
+			entry2->name_len,
+			CASE_SENSITIVE, vol->upcase, vol->upcase_len));
+}
+
+/*
+ *		Sort the entries of a listing in collation order
+ *
+ *	This is a merge sort of the indexes of the entries, the entries
+ *	of each index block being already in collation order.
+ *
+ *	Returns 0 if successful, -1 if there is not enough memory
+ */
+
+static int ntfs_listing_sort(ntfs_volume *vol, const char *listing,
+			u32 *order, int count)
+{
+	u32 *work;
+	u32 *src;
+	u32 *dst;
+	u32 *tmp;
+	int width;
+	int left, mid, right;
+	int i, j, k;
+
+	work = (u32*)ntfs_malloc(count*sizeof(u32));
+	if (!work)
+		return (-1);
+	for (i=0; i<count; i++)
+		order[i] = i;
+	src = order;
+	dst = work;
+	for (width=1; width<count; width<<=1) {
+		for (left=0; left<count; left+=2*width) {
+			mid = min(left + width, count);
+			right = min(left + 2*width, count);
+			i = left;
+			j = mid;
+			for (k=left; k<right; k++) {
+				if ((i < mid)
+				    && ((j >= right)
+					|| (ntfs_listed_collate(vol, listing,
+						src[i], src[j]) <= 0)))
+					dst[k] = src[i++];
+				else
+					dst[k] = src[j++];
+			}
+		}
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if (src != order)
+		memcpy(order, src, count*sizeof(u32));
+	free(work);
+	return (0);
+}
+
+/*
+ *		Get the cached listing of a directory
+ *
+ *	When starting a new listing of a directory which is not cached
+ *	(@build is TRUE), the full listing is built and entered into the
+ *	cache. Only the directories which have an index allocation are
+ *	cached, listing a directory from its index root is already fast,
+ *	and the size of the index allocation is limited so that the cache
+ *	does not grow too big, and the first entries are not delayed too
+ *	much.
+ *
+ *	Returns the cached listing, or NULL if there is none
+ */
+
+static const struct CACHED_LISTING *ntfs_dir_listing(ntfs_inode *dir_ni,
+			BOOL build)
+{
+	const struct CACHED_LISTING *cached;
+	struct CACHED_LISTING item;
+	struct LISTING_BUILDER builder;
+	struct LISTED_ENTRY *entry;
+	ntfs_volume *vol;
+	ntfs_attr *ia_na;
+	size_t size;
+	size_t order_size;
+	s64 build_pos;
+	int i;
+
+	vol = dir_ni->vol;
+	item.inum = dir_ni->mft_no;
+	cached = (const struct CACHED_LISTING*)ntfs_fetch_cache(
+			vol->listing_cache, GENERIC(&item),
+			listing_cache_compare);
+	if (!cached && build) {
+		ia_na = ntfs_attr_open(dir_ni, AT_INDEX_ALLOCATION,
+				NTFS_INDEX_I30, 4);
+		if (ia_na
+		    && (ia_na->data_size <= CACHE_LISTING_MAX)) {
+			builder.entries = (struct LISTED_ENTRY*)NULL;
+			builder.names = (ntfschar*)NULL;
+			builder.count = 0;
+			builder.allocated = 0;
+			builder.names_len = 0;
+			builder.names_allocated = 0;
+			builder.overflow = FALSE;
+			build_pos = 0;
+			if (!ntfs_readdir_index(dir_ni, &build_pos, &builder,
+					ntfs_listing_filldir)
+			    && (build_pos < 0)
+			    && !builder.overflow
+			    && builder.count) {
+				/*
+				 * Append the collation order and the
+				 * names to the entries and make the
+				 * offsets of names relative to the
+				 * beginning of the listing
+				 */
+				size = builder.count*sizeof(struct LISTED_ENTRY);
+				order_size = builder.count*sizeof(u32);
+				item.size = size + order_size
+					+ builder.names_len*sizeof(ntfschar);
+				item.listing = (char*)ntfs_malloc(item.size);
+				if (item.listing) {
+					entry = (struct LISTED_ENTRY*)
+							item.listing;
+					memcpy(entry, builder.entries, size);
+					for (i=0; i<builder.count; i++)
+						entry[i].name_offset = size
+						    + order_size
+						    + entry[i].name_offset
+							*sizeof(ntfschar);
+					memcpy((char*)item.listing + size
+							+ order_size,
+						builder.names,
+						builder.names_len
+							*sizeof(ntfschar));
+					item.count = builder.count;
+					if (!ntfs_listing_sort(vol,
+						    item.listing,
+						    (u32*)(item.listing + size),
+						    builder.count))
+						cached = (const struct CACHED_LISTING*)
+							ntfs_enter_cache(
+							vol->listing_cache,
+							GENERIC(&item),
+							listing_cache_compare);
+					free((char*)item.listing);
+						/* may have recycled a listing */
+					vol->listing_generation++;
+				}
+			}
+			free(builder.entries);
+			free(builder.names);
+		}
+		if (ia_na)
+			ntfs_attr_close(ia_na);
+	}
+	return (cached);
+}
+
+/*
+ *		Read the contents of a directory from its cached listing
+ *
+ *	The filldir callback may lead to the listing being dropped, in
+ *	which case the reading goes on from the index.
+ *
+ *	See ntfs_readdir() for the arguments and the returned values.
+ */
+
+static int ntfs_readdir_cached(ntfs_inode *dir_ni,
+		const struct CACHED_LISTING *cached, s64 *pos,
+		void *dirent, ntfs_filldir_t filldir)
+{
+	const struct LISTED_ENTRY *entries;
+	const struct LISTED_ENTRY *entry;
+	u32 generation;
+	s64 next_pos;
+	int low, high, mid;
+	int count;
+	int rc;
+
+	entries = (const struct LISTED_ENTRY*)cached->listing;
+	count = cached->count;
+		/* locate the first entry at or beyond the position */
+	low = 0;
+	high = count;
+	while (low < high) {
+		mid = (low + high) >> 1;
+		if (entries[mid].pos < *pos)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	generation = dir_ni->vol->listing_generation;
+	rc = 0;
+	*pos = (low < count ? entries[low].pos : -1);
+	while ((*pos >= 0) && !rc
+	    && (generation == dir_ni->vol->listing_generation)) {
+		entry = &entries[low++];
+		next_pos = (low < count ? entries[low].pos : -1);
+		rc = filldir(dirent, (const ntfschar*)(cached->listing
+				+ entry->name_offset), entry->name_len,
+				entry->name_type, entry->pos, entry->mref,
+				entry->dt_type);
+		*pos = next_pos;
+	}
+	if (rc > 0)
+		rc = 0;
+	if (!rc && (*pos >= 0)
+	    && (generation != dir_ni->vol->listing_generation))
+		rc = ntfs_readdir_index(dir_ni, pos, dirent, filldir);
+	return (rc < 0 ? -1 : 0);
+}
+
+/*
+ *		Read the contents of a directory from its cached listing in
+ *	collation order, starting after a name (or from the beginning
+ *	if NULL)
+ *
+ *	The place of the name is searched in the collation order of the
+ *	listing, the name does not have to be present. The last name
+ *	submitted to filldir is kept, so that the reading can go on from
+ *	the index if the listing is dropped by the filldir callback.
+ *
+ *	"." and ".." are not returned. See ntfs_readdir_after() for the
+ *	returned values.
+ */
+
+static int ntfs_readdir_cached_after(ntfs_inode *dir_ni,
+		const struct CACHED_LISTING *cached,
+		const ntfschar *name, int name_len,
+		void *dirent, ntfs_filldir_t filldir)
+{
+	const struct LISTED_ENTRY *entries;
+	const struct LISTED_ENTRY *entry;
+	const u32 *order;
+	ntfs_volume *vol;
+	const ntfschar *entry_name;
+	ntfschar last[NTFS_MAX_NAME_LEN];
+	int last_len;
+	u32 generation;
+	int low, high, mid;
+	int count;
+	int rc;
+
+	vol = dir_ni->vol;
+	entries = (const struct LISTED_ENTRY*)cached->listing;
+	count = cached->count;
+	order = (const u32*)&entries[count];
+		/* skip "." and "..", which come first */
+	low = 0;
+	while ((low < count) && (entries[order[low]].pos < 2))
+		low++;
+		/* locate the first entry collating after the name */
+	if (name) {
+		high = count;
+		while (low < high) {
+			mid = (low + high) >> 1;
+			entry = &entries[order[mid]];
+			if (ntfs_names_full_collate((const ntfschar*)
+					(cached->listing + entry->name_offset),
+					entry->name_len, name, name_len,
+					CASE_SENSITIVE, vol->upcase,
+					vol->upcase_len) <= 0)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+	}
+	generation = vol->listing_generation;
+	rc = 0;
+	last_len = 0;
+	while ((low < count) && !rc
+	    && (generation == vol->listing_generation)) {
+		entry = &entries[order[low++]];
+		entry_name = (const ntfschar*)(cached->listing
+					+ entry->name_offset);
+		last_len = entry->name_len;
+		memcpy(last, entry_name, last_len*sizeof(ntfschar));
+		rc = filldir(dirent, entry_name, entry->name_len,
+				entry->name_type, 2, entry->mref,
+				entry->dt_type);
+	}
+	if (rc > 0)
+		rc = 0;
+	if (!rc && (low < count)
+	    && (generation != vol->listing_generation))
+		rc = ntfs_readdir_index_after(dir_ni, last, last_len,
+					dirent, filldir);
+	return (rc < 0 ? -1 : 0);
+}
+
+#endif /* CACHE_LISTING_SIZE */
+
+/**
+ * ntfs_readdir - read the contents of an ntfs directory
+ * @dir_ni:	ntfs inode of current directory
+ * @pos:	current position in directory
+ * @dirent:	context for filldir callback supplied by the caller
+ * @filldir:	filldir callback supplied by the caller
+ *
+ * Parse the index root and the index blocks that are marked in use in the
+ * index bitmap and hand each found directory entry to the @filldir callback
+ * supplied by the caller.
+ *
+ * When the directory has a cached listing, the entries are taken from
+ * it instead of the index, with the same positions.
+ *
+ * Return 0 on success or -1 on error with errno set to the error code.
+ * On success, the value at address 'pos' gets updated to the position of the
+ * next entry in the directory or -1 if no more entries are available.
+ *
+ * Note: Index blocks are parsed in ascending vcn order, from which follows
+ * that the directory entries are not returned sorted.
+ */
+int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
+		void *dirent, ntfs_filldir_t filldir)
+{
+#if CACHE_LISTING_SIZE
+	const struct CACHED_LISTING *cached;
+#endif
+	int ret;
+
+#if CACHE_LISTING_SIZE
+	cached = (const struct CACHED_LISTING*)NULL;
+	if (dir_ni && pos && filldir && (*pos >= 0)
+	    && dir_ni->vol->listing_cache
+	    && (dir_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY))
+		cached = ntfs_dir_listing(dir_ni, !*pos);
+	if (cached)
+		ret = ntfs_readdir_cached(dir_ni, cached, pos,
+				dirent, filldir);
+	else
+#endif
+		ret = ntfs_readdir_index(dir_ni, pos, dirent, filldir);
+	return (ret);
+}
+
+/*
+ *		Read the contents of a directory in collation order,
+ *	resuming after a designated name
+ *
+ *	The entries are returned in the order of the index, starting
+ *	after the name given, which is searched in the index, and does
+ *	not have to be present any more. So a listing made of several
+ *	calls neither skips nor duplicates entries when the directory
+ *	is modified between calls, such as when the entries already
+ *	listed are deleted, or when an index block is split. When the
+ *	directory has a cached listing, the entries are taken from it,
+ *	in the same order.
+ *
+ *	"." and ".." are returned first. A NULL name means starting
+ *	from ".", and the names "." and "..", which cannot be found in
+ *	the index, mean resuming after them. The position submitted to
+ *	filldir is 0 for ".", 1 for ".." and 2 for the other entries,
+ *	it cannot be used for resuming.
+ *
+ *	Returns 0 if successful (the listing stops when filldir returns
+ *		a positive value, or at the end of the directory)
+ *		-1 if there was an error (errno set)
+ */
+
+int ntfs_readdir_after(ntfs_inode *dir_ni, const ntfschar *name,
+		int name_len, void *dirent, ntfs_filldir_t filldir)
+{
+#if CACHE_LISTING_SIZE
+	const struct CACHED_LISTING *cached;
+#endif
+	MFT_REF parent_mref;
+	int start;
+	int rc;
+
+	if (!dir_ni || !filldir
+	    || (name && ((name_len <= 0) || (name_len > NTFS_MAX_NAME_LEN)))) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (!(dir_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
+		errno = ENOTDIR;
+		return (-1);
+	}
+		/* start with ".", or after "." or "..", or after a name */
+	if (!name)
+		start = 0;
+	else
+		if ((name_len <= 2)
+		    && !memcmp(name, dotdot, name_len*sizeof(ntfschar)))
+			start = name_len;
+		else
+			start = 3;
+	rc = 0;
+	if (!start)
+		rc = filldir(dirent, dotdot, 1, FILE_NAME_POSIX, 0,
+				MK_MREF(dir_ni->mft_no,
+				le16_to_cpu(dir_ni->mrec->sequence_number)),
+				NTFS_DT_DIR);
+	if (!rc && (start < 2)) {
+		parent_mref = ntfs_mft_get_parent_ref(dir_ni);
+		if (parent_mref == ERR_MREF(-1)) {
+			ntfs_log_perror("Parent directory not found\n");
+			return (-1);
+		}
+		rc = filldir(dirent, dotdot, 2, FILE_NAME_POSIX, 1,
+				parent_mref, NTFS_DT_DIR);
+	}
+	if (!rc) {
+		if (start < 3)
+			name = (const ntfschar*)NULL;
+#if CACHE_LISTING_SIZE
+		cached = (dir_ni->vol->listing_cache
+			? ntfs_dir_listing(dir_ni, !name)
+			: (const struct CACHED_LISTING*)NULL);
+		if (cached)
+			rc = ntfs_readdir_cached_after(dir_ni, cached,
+					name, name_len, dirent, filldir);
+		else
+#endif
+			rc = ntfs_readdir_index_after(dir_ni, name, name_len,
+					dirent, filldir);
+	}
+	return (rc < 0 ? -1 : 0);
+}
 
 /**
  * __ntfs_create - create object on ntfs volume
@@ -1780,6 +2485,10 @@ static ntfs_inode *__ntfs_create(ntfs_inode *dir_ni, le32 securid,
 		}
 	}
 	ntfs_inode_mark_dirty(ni);
+#if CACHE_SYMLINK_SIZE
+	ntfs_forget_symlinks(dir_ni);
+#endif
+	ntfs_dir_forget_missing(dir_ni);
 	/* Done! */
 	free(fn);
 	free(si);
@@ -2074,6 +2783,8 @@ search:
 	ntfs_invalidate_cache(vol->lookup_cache, GENERIC(&lkitem),
 			lookup_cache_inv_compare, CACHE_NOHASH);
 #endif
+	if (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)
+		ntfs_dir_forget_listing(ni);
 #if CACHE_INODE_SIZE
 	inum = ni->mft_no;
 	if (pathname) {
@@ -2117,6 +2828,8 @@ search:
 		 */
 		err = errno;
 	}
+		/* the index blocks must not be written to freed clusters */
+	ntfs_index_drop_deferred(ni);
 	ntfs_attr_reinit_search_ctx(actx);
 	while (!ntfs_attrs_walk(actx)) {
 		if (actx->attr->non_resident) {
@@ -2180,6 +2893,10 @@ search:
 ok:	
 	ntfs_inode_update_times(dir_ni, NTFS_UPDATE_MCTIME);
 out:
+#if CACHE_SYMLINK_SIZE
+		/* the target of a cached symlink may have been deleted */
+	ntfs_forget_symlinks(dir_ni);
+#endif
 	if (actx)
 		ntfs_attr_put_search_ctx(actx);
 	if (ntfs_inode_close(dir_ni) && !err)
@@ -2283,6 +3000,16 @@ static int ntfs_link_i(ntfs_inode *ni, ntfs_inode *dir_ni, const ntfschar *name,
 			ni->mrec->link_count) + 1);
 	/* Done! */
 	ntfs_inode_mark_dirty(ni);
+#if CACHE_SYMLINK_SIZE
+	ntfs_forget_symlinks(dir_ni);
+		/* ".." of a renamed directory has changed */
+	if (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)
+		ntfs_forget_symlinks(ni);
+#endif
+	ntfs_dir_forget_missing(dir_ni);
+		/* ".." of a renamed directory has changed */
+	if (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)
+		ntfs_dir_forget_listing(ni);
 	free(fn);
 	ntfs_log_trace("Done.\n");
 	return 0;
@@ -2553,6 +3280,7 @@ static int set_namespace(ntfs_inode *ni, ntfs_inode *dir_ni,
 					fnx->file_name_type = nametype;
 					ntfs_inode_mark_dirty(ni);
 					ntfs_index_entry_mark_dirty(icx);
+					ntfs_dir_forget_listing(dir_ni);
 				}
 			ntfs_index_ctx_put(icx);
 			}
@@ -2883,6 +3611,9 @@ static int nlink_increment(void *nlink_ptr,
 
 int ntfs_dir_link_cnt(ntfs_inode *ni)
 {
+#if CACHE_LISTING_SIZE
+	const struct CACHED_LISTING *cached;
+#endif
 	ntfs_attr_search_ctx *actx;
 	FILE_NAME_ATTR *fn;
 	s64 pos;
@@ -2901,10 +3632,21 @@ int ntfs_dir_link_cnt(ntfs_inode *ni)
 		 * Directory : scan the directory and count
 		 * subdirectories whose name is not DOS-only.
 		 * The directory names are ignored, but "." and ".."
-		 * are taken into account.
+		 * are taken into account. A cached listing is used,
+		 * but none is built for this.
 		 */
 		pos = 0;
-		err = ntfs_readdir(ni, &pos, &nlink, nlink_increment);
+#if CACHE_LISTING_SIZE
+		cached = (ni->vol->listing_cache
+			? ntfs_dir_listing(ni, FALSE)
+			: (const struct CACHED_LISTING*)NULL);
+		if (cached)
+			err = ntfs_readdir_cached(ni, cached, &pos,
+					&nlink, nlink_increment);
+		else
+#endif
+			err = ntfs_readdir_index(ni, &pos,
+					&nlink, nlink_increment);
 		if (err)
 			nlink = 0;
 	} else {
@@ -253,6 +253,8 @@ int ntfs_set_ntfs_ea(ntfs_inode *ni, const char *value, size_t size, int flags)
 	const EA_ATTR *p_ea;
 
 	res = -1;
+	if (ni)
+		clear_nino_flag(ni, KnownWslDev);
 	if (value && (size > 0)) {
 					/* do consistency checks */
 		offs = 0;
@@ -355,6 +357,7 @@ int ntfs_remove_ntfs_ea(ntfs_inode *ni)
 
 	res = 0;
 	if (ni) {
+		clear_nino_flag(ni, KnownWslDev);
 		/*
 		 * open and delete the EA_INFORMATION and the EA
 		 */
@@ -407,6 +410,9 @@ int ntfs_remove_ntfs_ea(ntfs_inode *ni)
  *		Check for the presence of an EA "$LXDEV" (used by WSL)
  *	and return its value as a device address
  *
+ *	The device is kept along with the inode, so that the EA
+ *	does not have to be read again for each getattr.
+ *
  *	Returns zero if successful
  *		-1 if failed, with errno set
  */
@@ -427,43 +433,55 @@ int ntfs_ea_check_wsldev(ntfs_inode *ni, dev_t *rdevp)
 	} device;
 
 	res = -EOPNOTSUPP;
-	bufsize = 256; /* expected to be enough */
-	buf = (char*)malloc(bufsize);
-	if (buf) {
-		lth = ntfs_get_ntfs_ea(ni, buf, bufsize);
-			/* retry if short buf */
-		if (lth > bufsize) {
-			free(buf);
-			bufsize = lth;
-			buf = (char*)malloc(bufsize);
-			if (buf)
-				lth = ntfs_get_ntfs_ea(ni, buf, bufsize);
+	if (test_nino_flag(ni, KnownWslDev)) {
+		*rdevp = ni->wsl_rdev;
+		res = 0;
+	} else {
+		bufsize = 256; /* expected to be enough */
+		buf = (char*)malloc(bufsize);
+		if (buf) {
+			lth = ntfs_get_ntfs_ea(ni, buf, bufsize);
+				/* retry if short buf */
+			if (lth > bufsize) {
+				free(buf);
+				bufsize = lth;
+				buf = (char*)malloc(bufsize);
+				if (buf)
+					lth = ntfs_get_ntfs_ea(ni, buf,
+							bufsize);
+			}
 		}
-	}
-	if (buf && (lth > 0) && (lth <= bufsize)) {
-		offset = 0;
-		found = FALSE;
-		do {
-			p_ea = (const EA_ATTR*)&buf[offset];
-			next = le32_to_cpu(p_ea->next_entry_offset);
-			found = ((next > (int)(sizeof(lxdev) + sizeof(device)))
-				&& (p_ea->name_length == (sizeof(lxdev) - 1))
-				&& (p_ea->value_length
-					== const_cpu_to_le16(sizeof(device)))
-				&& !memcmp(p_ea->name_value, lxdev, sizeof(lxdev)));
-			if (!found)
-				offset += next;
-		} while (!found && (next > 0) && (offset < lth));
-		if (found) {
-				/* beware of alignment */
-			memcpy(&device, &p_ea->name_value[p_ea->name_length + 1],
-					sizeof(device));
-			*rdevp = makedev(le32_to_cpu(device.major),
-					le32_to_cpu(device.minor));
-			res = 0;
+		if (buf && (lth > 0) && (lth <= bufsize)) {
+			offset = 0;
+			found = FALSE;
+			do {
+				p_ea = (const EA_ATTR*)&buf[offset];
+				next = le32_to_cpu(p_ea->next_entry_offset);
+				found = ((next > (int)(sizeof(lxdev)
+							+ sizeof(device)))
+					&& (p_ea->name_length
+						== (sizeof(lxdev) - 1))
+					&& (p_ea->value_length
+					    == const_cpu_to_le16(sizeof(device)))
+					&& !memcmp(p_ea->name_value, lxdev,
+							sizeof(lxdev)));
+				if (!found)
+					offset += next;
+			} while (!found && (next > 0) && (offset < lth));
+			if (found) {
+					/* beware of alignment */
+				memcpy(&device,
+				    &p_ea->name_value[p_ea->name_length + 1],
+				    sizeof(device));
+				*rdevp = makedev(le32_to_cpu(device.major),
+						le32_to_cpu(device.minor));
+				ni->wsl_rdev = *rdevp;
+				set_nino_flag(ni, KnownWslDev);
+				res = 0;
+			}
 		}
+		free(buf);
 	}
-	free(buf);
 	return (res);
 }
 
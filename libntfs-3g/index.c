@@ -40,6 +40,7 @@
 #include "attrib.h"
 #include "debug.h"
 #include "index.h"
+#include "cache.h"
 #include "collate.h"
 #include "mst.h"
 #include "dir.h"
@@ -47,6 +48,8 @@
 #include "bitmap.h"
 #include "reparse.h"
 #include "misc.h"
+#include "ntfstime.h"
+#include "stats.h"
 
 /**
  * ntfs_index_entry_mark_dirty - mark an index entry dirty
@@ -70,6 +73,19 @@ void ntfs_index_entry_mark_dirty(ntfs_index_context *ictx)
 		ictx->ib_dirty = TRUE;
 }
 
+/*
+ *		Forget the cached listing of a directory when entries are
+ *	inserted into or removed from its index, as the positions of
+ *	the entries may change.
+ */
+
+static void ntfs_icx_forget_listing(ntfs_index_context *icx)
+{
+	if ((icx->name_len == 4)
+	    && !memcmp(icx->name, NTFS_INDEX_I30, 4*sizeof(ntfschar)))
+		ntfs_dir_forget_listing(icx->ni);
+}
+
 static s64 ntfs_ib_vcn_to_pos(ntfs_index_context *icx, VCN vcn)
 {
 	return vcn << icx->vcn_size_bits;
@@ -80,6 +96,462 @@ static VCN ntfs_ib_pos_to_vcn(ntfs_index_context *icx, s64 pos)
 	return pos >> icx->vcn_size_bits;
 }
 
+/*
+ *		Deferred writing of directory index blocks
+ *
+ *	Creating, deleting or closing files updates the index blocks of
+ *	their parent directory, and writing a block on each update makes
+ *	busy directories write the same blocks again and again. When the
+ *	volume is mounted with option defer_index, while directory inodes
+ *	are kept in the idata cache, the in-place updates of the blocks
+ *	of their $I30 index are kept in memory, and the readers of index
+ *	blocks are given the copy in memory.
+ *
+ *	The blocks are kept in a list attached to the volume, one entry
+ *	per directory, so that they are seen by all the copies of a
+ *	directory inode (the parent of a file being closed may be opened
+ *	again for updating the file name, while already open).
+ *
+ *	Only the updates which touch a single block are deferred. The
+ *	updates which touch several index nodes (splitting a block, moving
+ *	the root to a new block, removing an entry from a node, ...) write
+ *	all their blocks immediately, as the blocks must not be out of
+ *	sync with the index root written along with the inode, or with
+ *	each other. The removals are not deferred either, as the inode of
+ *	the removed entry is freed immediately and may be reused.
+ *
+ *	The blocks are written when the inode is really closed (which
+ *	also happens when unmounting), when more than DEFERRED_INDEX_BLOCKS
+ *	blocks are waiting for a directory, on fsync, and when the first
+ *	one has been waiting for more than DEFERRED_INDEX_DELAY seconds.
+ *	This is checked when an inode is closed and by the drivers after
+ *	each request and periodically when idle. They are dropped without
+ *	being written when the directory is deleted. When unmounting, the
+ *	directories still in use are opened again for writing them.
+ */
+
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+
+static BOOL ntfs_ib_deferrable(ntfs_attr *ia_na)
+{
+	return (ia_na->ni->vol->nidata_cache
+		&& NVolDeferIndex(ia_na->ni->vol)
+		&& (ia_na->type == AT_INDEX_ALLOCATION)
+		&& (ia_na->name_len == 4)
+		&& !memcmp(ia_na->name, NTFS_INDEX_I30, 4*sizeof(ntfschar)));
+}
+
+static INDEX_BLOCK *ntfs_ib_deferred(struct DEFERRED_INDEX_BLOCK *dib)
+{
+	return ((INDEX_BLOCK*)&dib[1]);
+}
+
+/*
+ *		Find the deferred blocks of a directory
+ *
+ *	The directory found is moved to the head of the list, as it is
+ *	likely to be used again soon.
+ */
+
+static struct DEFERRED_INDEX *ntfs_ib_find_deferred(ntfs_volume *vol,
+			u64 inum)
+{
+	struct DEFERRED_INDEX *di;
+	struct DEFERRED_INDEX *prev;
+
+	prev = (struct DEFERRED_INDEX*)NULL;
+	di = vol->deferred_index;
+	while (di && (di->inum != inum)) {
+		prev = di;
+		di = di->next;
+	}
+	if (di && prev) {
+		prev->next = di->next;
+		di->next = vol->deferred_index;
+		vol->deferred_index = di;
+	}
+	return (di);
+}
+
+/*
+ *		Free the deferred blocks of a directory
+ */
+
+static void ntfs_ib_free_deferred(ntfs_volume *vol, struct DEFERRED_INDEX *di)
+{
+	struct DEFERRED_INDEX **pdi;
+	struct DEFERRED_INDEX_BLOCK *dib;
+	s64 oldest;
+
+	pdi = &vol->deferred_index;
+	while (*pdi && (*pdi != di))
+		pdi = &(*pdi)->next;
+	if (*pdi)
+		*pdi = di->next;
+	while (di->blocks) {
+		dib = di->blocks;
+		di->blocks = dib->next;
+		free(dib);
+	}
+	free(di);
+		/* get the oldest stamp of the remaining directories */
+	oldest = 0;
+	for (di=vol->deferred_index; di; di=di->next)
+		if (!oldest || (di->stamp < oldest))
+			oldest = di->stamp;
+	vol->deferred_index_stamp = oldest;
+}
+
+/*
+ *		Write the deferred blocks of an index allocation
+ *
+ *	The blocks are freed, even if they could not be written. The
+ *	blocks beyond the end of the allocation known to this copy of
+ *	the inode are left for another copy.
+ *
+ *	Returns 0 if successful, -1 otherwise
+ */
+
+static int ntfs_ib_flush(ntfs_attr *ia_na)
+{
+	struct DEFERRED_INDEX *di;
+	struct DEFERRED_INDEX_BLOCK *dib;
+	struct DEFERRED_INDEX_BLOCK **pdib;
+	ntfs_inode *ni;
+	int res;
+
+	res = 0;
+	ni = ia_na->ni;
+	di = ntfs_ib_find_deferred(ni->vol, ni->mft_no);
+	if (di) {
+		pdib = &di->blocks;
+		while (*pdib) {
+			dib = *pdib;
+			if ((dib->pos + dib->size) > ia_na->data_size)
+				pdib = &dib->next;
+			else {
+				if (ntfs_attr_mst_pwrite(ia_na, dib->pos, 1,
+					dib->size, ntfs_ib_deferred(dib)) != 1) {
+					ntfs_log_perror("Failed to write index"
+						" block at %lld, inode %llu",
+						(long long)dib->pos,
+						(unsigned long long)ni->mft_no);
+					res = -1;
+				}
+				*pdib = dib->next;
+				di->count--;
+				free(dib);
+			}
+		}
+		if (!di->blocks)
+			ntfs_ib_free_deferred(ni->vol, di);
+	}
+	return (res);
+}
+
+/*
+ *		Forget the deferred copy of a block being written
+ */
+
+static void ntfs_ib_forget(ntfs_attr *ia_na, s64 pos)
+{
+	struct DEFERRED_INDEX *di;
+	struct DEFERRED_INDEX_BLOCK *dib;
+	struct DEFERRED_INDEX_BLOCK **pdib;
+	ntfs_volume *vol;
+
+	vol = ia_na->ni->vol;
+	di = (vol->deferred_index
+		? ntfs_ib_find_deferred(vol, ia_na->ni->mft_no)
+		: (struct DEFERRED_INDEX*)NULL);
+	if (di) {
+		pdib = &di->blocks;
+		while (*pdib && ((*pdib)->pos < pos))
+			pdib = &(*pdib)->next;
+		dib = *pdib;
+		if (dib && (dib->pos == pos)) {
+			*pdib = dib->next;
+			di->count--;
+			free(dib);
+			if (!di->blocks)
+				ntfs_ib_free_deferred(vol, di);
+		}
+	}
+}
+
+/*
+ *		Defer the writing of an index block
+ *
+ *	If there is no memory for keeping it, the block is written.
+ *
+ *	Returns 1 if successful, -1 otherwise (as ntfs_attr_mst_pwrite())
+ */
+
+static s64 ntfs_ib_defer(ntfs_attr *ia_na, s64 pos, u32 size,
+			INDEX_BLOCK *ib)
+{
+	struct DEFERRED_INDEX *di;
+	struct DEFERRED_INDEX_BLOCK *dib;
+	struct DEFERRED_INDEX_BLOCK **pdib;
+	ntfs_inode *ni;
+	ntfs_volume *vol;
+	s64 ret;
+
+	ni = ia_na->ni;
+	vol = ni->vol;
+	di = ntfs_ib_find_deferred(vol, ni->mft_no);
+	if (!di) {
+		di = (struct DEFERRED_INDEX*)ntfs_malloc(
+				sizeof(struct DEFERRED_INDEX));
+		if (di) {
+			di->blocks = (struct DEFERRED_INDEX_BLOCK*)NULL;
+			di->inum = ni->mft_no;
+			di->count = 0;
+			di->stamp = sle64_to_cpu(ntfs_current_time());
+			di->next = vol->deferred_index;
+			vol->deferred_index = di;
+			if (!vol->deferred_index_stamp)
+				vol->deferred_index_stamp = di->stamp;
+		}
+	}
+	if (di) {
+		pdib = &di->blocks;
+		while (*pdib && ((*pdib)->pos < pos))
+			pdib = &(*pdib)->next;
+		dib = *pdib;
+		if (!dib || (dib->pos != pos)) {
+			dib = (struct DEFERRED_INDEX_BLOCK*)ntfs_malloc(
+				sizeof(struct DEFERRED_INDEX_BLOCK) + size);
+			if (dib) {
+				dib->pos = pos;
+				dib->size = size;
+				dib->next = *pdib;
+				*pdib = dib;
+				di->count++;
+			}
+		}
+	} else
+		dib = (struct DEFERRED_INDEX_BLOCK*)NULL;
+	if (dib) {
+		memcpy(ntfs_ib_deferred(dib), ib, size);
+		ret = 1;
+		if ((di->count > DEFERRED_INDEX_BLOCKS)
+		    && ntfs_ib_flush(ia_na))
+			ret = -1;
+	} else {
+		if (di && !di->blocks)
+			ntfs_ib_free_deferred(vol, di);
+		ret = ntfs_attr_mst_pwrite(ia_na, pos, 1, size, ib);
+	}
+	return (ret);
+}
+
+/*
+ *		Get a cached copy of a directory inode
+ *
+ *	Only the inodes in the idata cache can be used for writing the
+ *	deferred blocks of a directory, the other ones are in use.
+ */
+
+static ntfs_inode *ntfs_ib_cached_inode(ntfs_volume *vol, u64 inum)
+{
+	struct CACHED_NIDATA *cached;
+
+	cached = (struct CACHED_NIDATA*)vol->nidata_cache->most_recent_entry;
+	while (cached && (cached->inum != inum))
+		cached = cached->next;
+	return (cached ? cached->ni : (ntfs_inode*)NULL);
+}
+
+#endif /* CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS */
+
+/*
+ *		Read an index block, taking the deferred blocks into account
+ *
+ *	Returns 1 if successful, as ntfs_attr_mst_pread() otherwise
+ */
+
+s64 ntfs_index_block_pread(ntfs_attr *ia_na, s64 pos, u32 size,
+			INDEX_BLOCK *dst)
+{
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	struct DEFERRED_INDEX *di;
+	struct DEFERRED_INDEX_BLOCK *dib;
+
+	if (ia_na->ni->vol->deferred_index && ntfs_ib_deferrable(ia_na)) {
+		di = ntfs_ib_find_deferred(ia_na->ni->vol, ia_na->ni->mft_no);
+		dib = (di ? di->blocks : (struct DEFERRED_INDEX_BLOCK*)NULL);
+		while (dib && (dib->pos < pos))
+			dib = dib->next;
+		if (dib && (dib->pos == pos) && (dib->size == size)) {
+			memcpy(dst, ntfs_ib_deferred(dib), size);
+			return (1);
+		}
+	}
+#endif
+	return (ntfs_attr_mst_pread(ia_na, pos, 1, size, (u8*)dst));
+}
+
+/*
+ *		Write the deferred index blocks of a directory
+ *
+ *	Returns 0 if successful, -1 otherwise
+ */
+
+int ntfs_index_flush_deferred(ntfs_inode *ni)
+{
+	int res;
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	struct DEFERRED_INDEX *di;
+	ntfs_attr *na;
+
+	res = 0;
+	di = (ni->vol->deferred_index
+		? ntfs_ib_find_deferred(ni->vol, ni->mft_no)
+		: (struct DEFERRED_INDEX*)NULL);
+	if (di) {
+		na = ntfs_attr_open(ni, AT_INDEX_ALLOCATION,
+					NTFS_INDEX_I30, 4);
+		if (na) {
+			res = ntfs_ib_flush(na);
+			ntfs_attr_close(na);
+		} else {
+			ntfs_log_perror("Could not write the index blocks"
+				" of inode %llu",
+				(unsigned long long)ni->mft_no);
+			ntfs_ib_free_deferred(ni->vol, di);
+			res = -1;
+		}
+	}
+#else
+	res = 0;
+#endif
+	return (res);
+}
+
+/*
+ *		Drop the deferred index blocks of a directory being deleted
+ */
+
+void ntfs_index_drop_deferred(ntfs_inode *ni)
+{
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	struct DEFERRED_INDEX *di;
+
+	di = (ni->vol->deferred_index
+		? ntfs_ib_find_deferred(ni->vol, ni->mft_no)
+		: (struct DEFERRED_INDEX*)NULL);
+	if (di)
+		ntfs_ib_free_deferred(ni->vol, di);
+#endif
+}
+
+/*
+ *		Write the deferred index blocks of the directories in cache
+ *
+ *	If @all is FALSE, only the directories whose first deferred block
+ *	has been waiting for more than DEFERRED_INDEX_DELAY seconds are
+ *	flushed. The directories in use are left for being flushed when
+ *	they are closed.
+ *
+ *	Returns 0 if successful, -1 otherwise
+ */
+
+int ntfs_index_sync_deferred(ntfs_volume *vol, BOOL all)
+{
+	int res;
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	struct DEFERRED_INDEX *di;
+	struct DEFERRED_INDEX *next;
+	ntfs_inode *ni;
+	s64 limit;
+
+	res = 0;
+	if (vol->deferred_index) {
+		limit = sle64_to_cpu(ntfs_current_time())
+				- (s64)DEFERRED_INDEX_DELAY*10000000;
+		if (all || (vol->deferred_index_stamp <= limit)) {
+			di = vol->deferred_index;
+			while (di) {
+				/* flushing may free or move the entry */
+				next = di->next;
+				if (all || (di->stamp <= limit)) {
+					ni = ntfs_ib_cached_inode(vol,
+							di->inum);
+					if (ni && ntfs_index_flush_deferred(ni))
+						res = -1;
+				}
+				di = next;
+			}
+		}
+	}
+#else
+	res = 0;
+#endif
+	return (res);
+}
+
+/*
+ *		Check whether there are deferred index blocks
+ *
+ *	The drivers use this for checking periodically whether some
+ *	blocks are waiting for too long when the mount is idle.
+ */
+
+BOOL ntfs_index_has_deferred(ntfs_volume *vol)
+{
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	return (vol->deferred_index != (struct DEFERRED_INDEX*)NULL);
+#else
+	return (FALSE);
+#endif
+}
+
+/*
+ *		Write all the deferred index blocks when unmounting
+ *
+ *	The directories which are still in use are opened again for
+ *	writing their blocks.
+ *
+ *	Returns 0 if successful, -1 otherwise
+ */
+
+int ntfs_index_release_deferred(ntfs_volume *vol)
+{
+	int res;
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	struct DEFERRED_INDEX *di;
+	ntfs_inode *ni;
+#endif
+
+	res = ntfs_index_sync_deferred(vol, TRUE);
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	while (vol->deferred_index) {
+		di = vol->deferred_index;
+		ni = ntfs_inode_open(vol, di->inum);
+		if (!ni || ntfs_index_flush_deferred(ni))
+			res = -1;
+		if (ni && ntfs_inode_close(ni))
+			res = -1;
+			/* make sure not to loop on an unwritable directory */
+		if (vol->deferred_index == di) {
+			ntfs_log_error("Index blocks of inode %llu could not"
+				" be written\n", (unsigned long long)di->inum);
+			ntfs_ib_free_deferred(vol, di);
+		}
+	}
+#endif
+	return (res);
+}
+
+/*
+ *		Write an index block
+ *
+ *	This is used for the updates which touch several index nodes,
+ *	the block is written immediately, and its deferred copy, if any,
+ *	is dropped.
+ */
+
 static int ntfs_ib_write(ntfs_index_context *icx, INDEX_BLOCK *ib)
 {
 	s64 ret, vcn = sle64_to_cpu(ib->index_block_vcn);
@@ -88,6 +560,10 @@ static int ntfs_ib_write(ntfs_index_context *icx, INDEX_BLOCK *ib)
 	
 	ret = ntfs_attr_mst_pwrite(icx->ia_na, ntfs_ib_vcn_to_pos(icx, vcn),
 				   1, icx->block_size, ib);
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	if (ret == 1)
+		ntfs_ib_forget(icx->ia_na, ntfs_ib_vcn_to_pos(icx, vcn));
+#endif
 	if (ret != 1) {
 		ntfs_log_perror("Failed to write index block %lld, inode %llu",
 			(long long)vcn, (unsigned long long)icx->ni->mft_no);
@@ -97,14 +573,35 @@ static int ntfs_ib_write(ntfs_index_context *icx, INDEX_BLOCK *ib)
 	return STATUS_OK;
 }
 
+/*
+ *		Write the current index block after an update in place
+ *
+ *	Such an update only touches the current block, so its writing
+ *	can be deferred.
+ */
+
 static int ntfs_icx_ib_write(ntfs_index_context *icx)
 {
+	s64 ret, vcn = sle64_to_cpu(icx->ib->index_block_vcn);
+
+#if CACHE_NIDATA_SIZE && DEFERRED_INDEX_BLOCKS
+	if (ntfs_ib_deferrable(icx->ia_na)) {
+		ret = ntfs_ib_defer(icx->ia_na, ntfs_ib_vcn_to_pos(icx, vcn),
+				   icx->block_size, icx->ib);
+		if (ret != 1) {
+			ntfs_log_perror("Failed to write index block %lld,"
+				" inode %llu", (long long)vcn,
+				(unsigned long long)icx->ni->mft_no);
+			return STATUS_ERROR;
+		}
+	} else
+#endif
 		if (ntfs_ib_write(icx, icx->ib))
 			return STATUS_ERROR;
-		
-		icx->ib_dirty = FALSE;
-		
-		return STATUS_OK;
+
+	icx->ib_dirty = FALSE;
+
+	return STATUS_OK;
 }
 
 /**
@@ -152,7 +649,7 @@ static void ntfs_index_ctx_free(ntfs_index_context *icx)
 	if (!icx->is_in_root) {
 		if (icx->ib_dirty) {
 			/* FIXME: Error handling!!! */
-			ntfs_ib_write(icx, icx->ib);
+			ntfs_icx_ib_write(icx);
 		}
 		free(icx->ib);
 	}
@@ -596,7 +1093,7 @@ static int ntfs_ib_read(ntfs_index_context *icx, VCN vcn, INDEX_BLOCK *dst)
 	
 	pos = ntfs_ib_vcn_to_pos(icx, vcn);
 
-	ret = ntfs_attr_mst_pread(icx->ia_na, pos, 1, icx->block_size, (u8 *)dst);
+	ret = ntfs_index_block_pread(icx->ia_na, pos, icx->block_size, dst);
 	if (ret != 1) {
 		if (ret == -1)
 			ntfs_log_perror("Failed to read index block");
@@ -634,39 +1131,12 @@ static int ntfs_icx_parent_dec(ntfs_index_context *icx)
 	return STATUS_OK;
 }
 	
-/**
- * ntfs_index_lookup - find a key in an index and return its index entry
- * @key:	[IN] key for which to search in the index
- * @key_len:	[IN] length of @key in bytes
- * @icx:	[IN/OUT] context describing the index and the returned entry
- *
- * Before calling ntfs_index_lookup(), @icx must have been obtained from a
- * call to ntfs_index_ctx_get().
- *
- * Look for the @key in the index specified by the index lookup context @icx.
- * ntfs_index_lookup() walks the contents of the index looking for the @key.
- *
- * If the @key is found in the index, 0 is returned and @icx is setup to
- * describe the index entry containing the matching @key.  @icx->entry is the
- * index entry and @icx->data and @icx->data_len are the index entry data and
- * its length in bytes, respectively.
- *
- * If the @key is not found in the index, -1 is returned, errno = ENOENT and
- * @icx is setup to describe the index entry whose key collates immediately
- * after the search @key, i.e. this is the position in the index at which
- * an index entry with a key of @key would need to be inserted.
- *
- * If an error occurs return -1, set errno to error code and @icx is left
- * untouched.
- *
- * When finished with the entry and its data, call ntfs_index_ctx_put() to free
- * the context and other associated resources.
- *
- * If the index entry was modified, call ntfs_index_entry_mark_dirty() before
- * the call to ntfs_index_ctx_put() to ensure that the changes are written
- * to disk.
+/*
+ *		Look up an index entry, see ntfs_index_lookup() below
  */
-int ntfs_index_lookup(const void *key, const int key_len, ntfs_index_context *icx)
+
+static int ntfs_index_lookup_i(const void *key, const int key_len,
+			ntfs_index_context *icx)
 {
 	VCN old_vcn, vcn;
 	ntfs_inode *ni = icx->ni;
@@ -800,6 +1270,49 @@ done:
 
 }
 
+/**
+ * ntfs_index_lookup - find a key in an index and return its index entry
+ * @key:	[IN] key for which to search in the index
+ * @key_len:	[IN] length of @key in bytes
+ * @icx:	[IN/OUT] context describing the index and the returned entry
+ *
+ * Before calling ntfs_index_lookup(), @icx must have been obtained from a
+ * call to ntfs_index_ctx_get().
+ *
+ * Look for the @key in the index specified by the index lookup context @icx.
+ * ntfs_index_lookup() walks the contents of the index looking for the @key.
+ *
+ * If the @key is found in the index, 0 is returned and @icx is setup to
+ * describe the index entry containing the matching @key.  @icx->entry is the
+ * index entry and @icx->data and @icx->data_len are the index entry data and
+ * its length in bytes, respectively.
+ *
+ * If the @key is not found in the index, -1 is returned, errno = ENOENT and
+ * @icx is setup to describe the index entry whose key collates immediately
+ * after the search @key, i.e. this is the position in the index at which
+ * an index entry with a key of @key would need to be inserted.
+ *
+ * If an error occurs return -1, set errno to error code and @icx is left
+ * untouched.
+ *
+ * When finished with the entry and its data, call ntfs_index_ctx_put() to free
+ * the context and other associated resources.
+ *
+ * If the index entry was modified, call ntfs_index_entry_mark_dirty() before
+ * the call to ntfs_index_ctx_put() to ensure that the changes are written
+ * to disk.
+ */
+int ntfs_index_lookup(const void *key, const int key_len, ntfs_index_context *icx)
+{
+	int ret;
+	s64 stamp;
+
+	stamp = ntfs_stats_begin();
+	ret = ntfs_index_lookup_i(key, key_len, icx);
+	ntfs_stats_end(&ntfs_stats[STATS_INDEX_LOOKUP], stamp, ret);
+	return (ret);
+}
+
 static INDEX_BLOCK *ntfs_ib_alloc(VCN ib_vcn, u32 ib_size, 
 				  INDEX_HEADER_FLAGS node_type)
 {
@@ -1464,6 +1977,7 @@ int ntfs_ie_add(ntfs_index_context *icx, INDEX_ENTRY *ie)
 */
 #endif
 	
+	ntfs_icx_forget_listing(icx);
 	while (1) {
 				
 		if (!ntfs_index_lookup(&ie->key, le16_to_cpu(ie->key_length), icx)) {
@@ -1781,9 +2295,12 @@ descend:
 	if (icx->is_in_root) {
 		if (ntfs_ir_truncate(icx, new_size))
 			goto out2;
-	} else
-		if (ntfs_icx_ib_write(icx))
+	} else {
+			/* two blocks are updated, do not defer */
+		if (ntfs_ib_write(icx, icx->ib))
 			goto out2;
+		icx->ib_dirty = FALSE;
+	}
 	
 	ntfs_ie_delete(&ib->index, ie_succ);
 	
@@ -1820,11 +2337,12 @@ int ntfs_index_rm(ntfs_index_context *icx)
 
 	ntfs_log_trace("Entering\n");
 	
-	if (!icx || (icx->is_in_root && !icx->ib) || (!icx->is_in_root && !icx->ir) || ntfs_ie_end(icx->entry)) {
+	if (!icx || (!icx->ib && !icx->ir) || ntfs_ie_end(icx->entry)) {
 		ntfs_log_error("Invalid arguments.\n");
 		errno = EINVAL;
 		goto err_out;
 	}
+	ntfs_icx_forget_listing(icx);
 	if (icx->is_in_root)
 		ih = &icx->ir->index;
 	else
@@ -1842,9 +2360,15 @@ int ntfs_index_rm(ntfs_index_context *icx)
 			err = ntfs_ir_truncate(icx, le32_to_cpu(ih->index_length));
 			if (err != STATUS_OK)
 				goto err_out;
-		} else
-			if (ntfs_icx_ib_write(icx))
+		} else {
+			/*
+			 * Not deferred : the inode of the entry may be
+			 * freed and reused just after its removal
+			 */
+			if (ntfs_ib_write(icx, icx->ib))
 				goto err_out;
+			icx->ib_dirty = FALSE;
+		}
 	} else {
 		if (ntfs_index_rm_leaf(icx))
 			goto err_out;
@@ -54,6 +54,7 @@
 #include "ntfstime.h"
 #include "logging.h"
 #include "misc.h"
+#include "stats.h"
 #include "xattrs.h"
 
 ntfs_inode *ntfs_inode_base(ntfs_inode *ni)
@@ -126,6 +127,7 @@ static void __ntfs_inode_release(ntfs_inode *ni)
 			       (long long)ni->mft_no);
 	if (NInoAttrList(ni) && ni->attr_list)
 		free(ni->attr_list);
+	free(ni->reparse);
 	free(ni->mrec);
 	free(ni);
 	return;
@@ -317,6 +319,8 @@ int ntfs_inode_real_close(ntfs_inode *ni)
 
 	ntfs_log_enter("Entering for inode %lld\n", (long long)ni->mft_no);
 
+	/* Write the deferred index blocks, errors have been logged */
+	ntfs_index_flush_deferred(ni);
 	/* If we have dirty metadata, write it out. */
 	if (NInoDirty(ni) || NInoAttrListDirty(ni)) {
 		if (ntfs_inode_sync(ni)) {
@@ -505,10 +509,14 @@ void debug_double_inode(u64 inum, int add)
 ntfs_inode *ntfs_inode_open(ntfs_volume *vol, const MFT_REF mref)
 {
 	ntfs_inode *ni;
+	s64 stamp;
 #if CACHE_NIDATA_SIZE
 	struct CACHED_NIDATA item;
 	struct CACHED_NIDATA *cached;
+#endif
 
+	stamp = ntfs_stats_begin();
+#if CACHE_NIDATA_SIZE
 		/* fetch idata from cache */
 	item.inum = MREF(mref);
 	debug_double_inode(item.inum, 1);
@@ -530,6 +538,7 @@ ntfs_inode *ntfs_inode_open(ntfs_volume *vol, const MFT_REF mref)
 #else
 	ni = ntfs_inode_real_open(vol, mref);
 #endif
+	ntfs_stats_end(&ntfs_stats[STATS_INODE_OPEN], stamp, (ni ? 0 : -1));
 	return (ni);
 }
 
@@ -576,6 +585,7 @@ int ntfs_inode_close(ntfs_inode *ni)
 				debug_cached_inode(ni);
 				ntfs_enter_cache(ni->vol->nidata_cache,
 					GENERIC(&item), idata_cache_compare);
+				ntfs_index_sync_deferred(ni->vol, FALSE);
 			}
 		} else {
 			/* cache not ready or system file, really close */
@@ -913,6 +923,12 @@ static int ntfs_inode_sync_file_name(ntfs_inode *ni, ntfs_inode *dir_ni)
 		}
 		/* Update flags and file size. */
 		fnx = (FILE_NAME_ATTR *)ictx->data;
+			/* the listed entries depend on these attributes */
+		if (((fnx->file_attributes ^ ni->flags)
+				& (FILE_ATTR_HIDDEN | FILE_ATTR_SYSTEM
+					| FILE_ATTR_REPARSE_POINT))
+		    || (fnx->reparse_point_tag != reparse_tag))
+			ntfs_dir_forget_listing(index_ni);
 		fnx->file_attributes =
 				(fnx->file_attributes & ~FILE_ATTR_VALID_FLAGS) |
 				(ni->flags & FILE_ATTR_VALID_FLAGS);
@@ -36,15 +36,20 @@
 #include <errno.h>
 #endif
 
+#include "param.h"
 #include "types.h"
 #include "attrib.h"
 #include "bitmap.h"
 #include "debug.h"
 #include "runlist.h"
 #include "volume.h"
+#include "inode.h"
+#include "layout.h"
+#include "cache.h"
 #include "lcnalloc.h"
 #include "logging.h"
 #include "misc.h"
+#include "stats.h"
 
 /*
  * Plenty possibilities for big optimizations all over in the cluster
@@ -247,10 +252,12 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 	u8 done_zones = 0;
 	u8 has_guess, used_zone_pos;
 	int err = 0, rlpos, rlsize, buf_size;
+	s64 stamp;
 
 	ntfs_log_enter("Entering with count = 0x%llx, start_lcn = 0x%llx, "
 		       "zone = %s_ZONE.\n", (long long)count, (long long)
 		       start_lcn, zone == MFT_ZONE ? "MFT" : "DATA");
+	stamp = ntfs_stats_begin();
 	
 	if (!vol || count < 0 || start_lcn < -1 || !vol->lcnbmp_na ||
 			(s8)zone < FIRST_ZONE || zone > LAST_ZONE) {
@@ -544,6 +551,8 @@ done_err_ret:
 		rl = NULL;
 	}
 out:	
+	ntfs_stats_end(&ntfs_stats[STATS_CLUSTER_ALLOC], stamp,
+		(rl && vol ? count << vol->cluster_size_bits : -1));
 	ntfs_log_leave("\n");
 	return rl;
 
@@ -774,3 +783,190 @@ leave:
 	ntfs_log_leave("\n");
 	return ret;
 }
+
+/*
+ *		Placement of the data of small files
+ *
+ *	Without a hint, the allocator takes clusters from its current
+ *	position and moves it forward, leaving a gap, so that files
+ *	written concurrently do not interleave. For small files this
+ *	scatters the files of a directory over the volume.
+ *
+ *	So the clusters of small files are allocated next to the last
+ *	ones allocated to a small file of the same directory, the
+ *	directory acting as an allocation group. The first small file
+ *	of a group and big files are allocated from the allocator
+ *	position, so that they are kept apart from the groups.
+ *
+ *	The positions of the groups are only kept in a cache, they
+ *	are lost when the volume is unmounted.
+ */
+
+#if CACHE_PLACEMENT_SIZE
+
+static int placement_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	return (((const struct CACHED_PLACEMENT*)cached)->dir
+			!= ((const struct CACHED_PLACEMENT*)wanted)->dir);
+}
+
+/*
+ *		Placement hashing, based on the directory inode number
+ */
+
+int ntfs_placement_hash(const struct CACHED_GENERIC *cached)
+{
+	const struct CACHED_PLACEMENT *entry;
+
+	entry = (const struct CACHED_PLACEMENT*)cached;
+	return (entry->dir % (2*CACHE_PLACEMENT_SIZE));
+}
+
+#endif /* CACHE_PLACEMENT_SIZE */
+
+/*
+ *		Get the allocation group of the unnamed data of a small file
+ *
+ *	@size is the size of the data after allocation
+ *
+ *	Returns the inode number of the parent directory,
+ *		or zero if the data is not to be grouped
+ */
+
+u64 ntfs_placement_group(ntfs_attr *na __attribute__((unused)),
+			s64 size __attribute__((unused)))
+{
+#if CACHE_PLACEMENT_SIZE
+	ntfs_attr_search_ctx *ctx;
+	FILE_NAME_ATTR *fn;
+	ntfs_inode *ni;
+#endif
+	u64 group;
+
+	group = 0;
+#if CACHE_PLACEMENT_SIZE
+	ni = na->ni;
+	if ((na->type == AT_DATA)
+	    && !na->name_len
+	    && (size <= PLACEMENT_SMALL_FILE)
+	    && ni->vol->placement_cache
+	    && (ni->mft_no >= FILE_first_user)
+	    && !(ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
+		ctx = ntfs_attr_get_search_ctx(ni, NULL);
+		if (ctx) {
+			if (!ntfs_attr_lookup(AT_FILE_NAME, AT_UNNAMED, 0,
+					CASE_SENSITIVE, 0, NULL, 0, ctx)) {
+				fn = (FILE_NAME_ATTR*)((u8*)ctx->attr +
+					le16_to_cpu(ctx->attr->value_offset));
+				group = MREF_LE(fn->parent_directory);
+			}
+			ntfs_attr_put_search_ctx(ctx);
+		}
+	}
+#endif /* CACHE_PLACEMENT_SIZE */
+	return (group);
+}
+
+/*
+ *		Get where to allocate the data of a file in a group
+ *
+ *	Returns the lcn to start from,
+ *		or -1 if the allocator position is to be used
+ */
+
+LCN ntfs_placement_hint(ntfs_volume *vol __attribute__((unused)),
+			u64 group __attribute__((unused)))
+{
+	LCN lcn;
+#if CACHE_PLACEMENT_SIZE
+	struct CACHED_PLACEMENT item;
+	struct CACHED_PLACEMENT *cached;
+#endif
+
+	lcn = -1;
+#if CACHE_PLACEMENT_SIZE
+	if (group) {
+		item.dir = group;
+		cached = (struct CACHED_PLACEMENT*)ntfs_fetch_cache(
+				vol->placement_cache, GENERIC(&item),
+				placement_cache_compare);
+		if (cached && (cached->next_lcn < vol->nr_clusters))
+			lcn = cached->next_lcn;
+	}
+#endif
+	return (lcn);
+}
+
+/*
+ *		Record the clusters allocated to a file in a group
+ */
+
+void ntfs_placement_update(ntfs_volume *vol __attribute__((unused)),
+			u64 group __attribute__((unused)),
+			const runlist *rl __attribute__((unused)))
+{
+#if CACHE_PLACEMENT_SIZE
+	struct CACHED_PLACEMENT item;
+	struct CACHED_PLACEMENT *cached;
+	LCN next_lcn;
+
+	if (group && rl) {
+		next_lcn = -1;
+		for ( ; rl->length; rl++)
+			if (rl->lcn >= 0)
+				next_lcn = rl->lcn + rl->length;
+		if (next_lcn >= 0) {
+			item.dir = group;
+			cached = (struct CACHED_PLACEMENT*)ntfs_fetch_cache(
+					vol->placement_cache, GENERIC(&item),
+					placement_cache_compare);
+			if (cached)
+				cached->next_lcn = next_lcn;
+			else {
+				item.variable = (void*)NULL;
+				item.varsize = 0;
+				item.next_lcn = next_lcn;
+				ntfs_enter_cache(vol->placement_cache,
+					GENERIC(&item),
+					placement_cache_compare);
+			}
+		}
+	}
+#endif
+}
+
+/*
+ *		Get where to go on allocating for a file which stops being
+ *	small, so that it does not spread into the region of its group
+ *
+ *	@lcn is the lcn following the last one allocated
+ *	@allocated is the size allocated so far
+ *	@size is the size of the data after allocation
+ *
+ *	If the clusters following the ones allocated are not free,
+ *	-1 is returned to allocate from the allocator position.
+ */
+
+LCN ntfs_placement_continue(ntfs_attr *na __attribute__((unused)),
+			LCN lcn, s64 allocated __attribute__((unused)),
+			s64 size __attribute__((unused)))
+{
+#if CACHE_PLACEMENT_SIZE
+	ntfs_volume *vol;
+	u8 byte;
+
+	vol = na->ni->vol;
+	if ((lcn >= 0)
+	    && (lcn < vol->nr_clusters)
+	    && (allocated <= PLACEMENT_SMALL_FILE)
+	    && (size > PLACEMENT_SMALL_FILE)
+	    && (na->type == AT_DATA)
+	    && !na->name_len
+	    && vol->placement_cache
+	    && (ntfs_attr_pread(vol->lcnbmp_na, lcn >> 3, 1, &byte) == 1)
+	    && (byte & (1 << (lcn & 7))))
+		lcn = -1;
+#endif
+	return (lcn);
+}
@@ -57,6 +57,7 @@
 #include "lcnalloc.h"
 #include "logging.h"
 #include "misc.h"
+#include "cache.h"
 #include "reparse.h"
 #include "xattrs.h"
 #include "ea.h"
@@ -115,6 +116,34 @@ static ntfschar reparse_index_name[] = { const_cpu_to_le16('$'),
 
 static const char mappingdir[] = ".NTFS-3G/";
 
+/*
+ *		Record a directory which the symlink being resolved
+ *	depends on, so that its cached target is dropped when a name
+ *	is created or deleted in this directory
+ */
+
+static void record_symlink_dir(ntfs_volume *vol __attribute__((unused)),
+			u64 inum __attribute__((unused)))
+{
+#if CACHE_SYMLINK_SIZE
+	struct CACHED_SYMLINK *record;
+	int i;
+
+	record = vol->symlink_record;
+	if (record && (record->dircount >= 0)) {
+		i = 0;
+		while ((i < record->dircount) && (record->dirs[i] != inum))
+			i++;
+		if (i >= record->dircount) {
+			if (record->dircount < CACHE_SYMLINK_DIRS)
+				record->dirs[record->dircount++] = inum;
+			else
+				record->dircount = -1; /* too many to cache */
+		}
+	}
+#endif
+}
+
 /*
  *		Fix a file name with doubtful case in some directory index
  *	and return the name with the casing used in directory.
@@ -147,6 +176,7 @@ static u64 ntfs_fix_file_name(ntfs_inode *dir_ni, ntfschar *uname,
 	} find;
 
 	mref = (u64)-1; /* default return (not found) */
+	record_symlink_dir(vol, dir_ni->mft_no);
 	icx = ntfs_index_ctx_get(dir_ni, NTFS_INDEX_I30, 4);
 	if (icx) {
 		if (uname_len > NTFS_MAX_NAME_LEN)
@@ -303,6 +333,8 @@ static char *search_relative(ntfs_inode *ni, ntfschar *path, int count)
 	ok = TRUE;
 	morelinks = FALSE;
 	curni = ntfs_dir_parent_inode(ni);
+	if (curni)
+		record_symlink_dir(ni->vol, curni->mft_no);
 		/*
 		 * Examine and translate the path, until we reach either
 		 *  - the end,
@@ -333,6 +365,9 @@ static char *search_relative(ntfs_inode *ni, ntfschar *path, int count)
 				curni = newni;
 				if (!curni)
 					ok = FALSE;
+				else
+					record_symlink_dir(ni->vol,
+							curni->mft_no);
 			} else {
 				lth = 0;
 				while (((pos + lth) < count)
@@ -382,6 +417,36 @@ static char *search_relative(ntfs_inode *ni, ntfschar *path, int count)
 	return (target);
 }
 
+/*
+ *		Record the directories a drive letter definition is
+ *	searched in, which are the root and the mapping directory
+ */
+
+static void record_mapping_dir(ntfs_volume *vol __attribute__((unused)))
+{
+#if CACHE_SYMLINK_SIZE
+	char name[sizeof(mappingdir)];
+	ntfs_inode *root_ni;
+	u64 inum;
+	int olderrno;
+
+	if (vol->symlink_record) {
+		record_symlink_dir(vol, FILE_root);
+		strcpy(name, mappingdir);
+		name[sizeof(mappingdir) - 2] = 0; /* no final '/' */
+		olderrno = errno;
+		root_ni = ntfs_inode_open(vol, FILE_root);
+		if (root_ni) {
+			inum = ntfs_inode_lookup_by_mbsname(root_ni, name);
+			if (inum != (u64)-1)
+				record_symlink_dir(vol, MREF(inum));
+			ntfs_inode_close(root_ni);
+		}
+		errno = olderrno;
+	}
+#endif
+}
+
 /*
  *		Check whether a drive letter has been defined in .NTFS-3G
  *
@@ -408,6 +473,7 @@ static int ntfs_drive_letter(ntfs_volume *vol, ntfschar letter)
 			*drive += 'A' - 'a';
 		strcat(defines,drive);
 		strcat(defines,":");
+		record_mapping_dir(vol);
 		olderrno = errno;
 		ni = ntfs_pathname_to_inode(vol, NULL, defines);
 		if (ni && !ntfs_inode_close(ni))
@@ -774,6 +840,171 @@ static char *ntfs_get_rellink(ntfs_inode *ni, ntfschar *junction, int count)
 	return (target);
 }
 
+#if CACHE_SYMLINK_SIZE
+
+/*
+ *		Inode number comparing for symlink cache
+ */
+
+static int symlink_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	const struct CACHED_SYMLINK *c = (const struct CACHED_SYMLINK*)cached;
+	const struct CACHED_SYMLINK *w = (const struct CACHED_SYMLINK*)wanted;
+	return (!c->target || (c->inum != w->inum));
+}
+
+/*
+ *		Symlink hashing
+ *
+ *	Based on the inode number
+ */
+
+int ntfs_symlink_hash(const struct CACHED_GENERIC *cached)
+{
+	const struct CACHED_SYMLINK *entry;
+
+	entry = (const struct CACHED_SYMLINK*)cached;
+	return (entry->inum % (2*CACHE_SYMLINK_SIZE));
+}
+
+/*
+ *		Hash the reparse data, to make sure a cached target
+ *	was resolved from the same reparse data
+ */
+
+static u32 reparse_data_hash(const REPARSE_POINT *reparse_attr)
+{
+	const u8 *p;
+	u32 hash;
+	int size;
+	int i;
+
+	p = (const u8*)reparse_attr;
+	size = le16_to_cpu(reparse_attr->reparse_data_length)
+			+ sizeof(REPARSE_POINT);
+	hash = 0;
+	for (i=0; i<size; i++)
+		hash = ((hash << 3) | (hash >> 29)) + p[i];
+	return (hash);
+}
+
+/*
+ *		Directory comparing for dropping symlink targets
+ */
+
+static int symlink_dir_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	const struct CACHED_SYMLINK *c = (const struct CACHED_SYMLINK*)cached;
+	const struct CACHED_SYMLINK *w = (const struct CACHED_SYMLINK*)wanted;
+	int i;
+
+	i = 0;
+	while ((i < c->dircount) && (c->dirs[i] != w->inum))
+		i++;
+	return (!c->target || (i >= c->dircount));
+}
+
+/*
+ *		Drop the cached symlink targets which were resolved
+ *	through a directory, to be called when a name is created or
+ *	deleted in the directory, or when its reparse data or its
+ *	parent are changed
+ */
+
+void ntfs_forget_symlinks(ntfs_inode *dir_ni)
+{
+	struct CACHED_SYMLINK item;
+
+	if (dir_ni->vol->symlink_cache) {
+		item.inum = MREF(dir_ni->mft_no);
+		ntfs_invalidate_cache(dir_ni->vol->symlink_cache,
+				GENERIC(&item), symlink_dir_compare,
+				CACHE_NOHASH);
+	}
+}
+
+/*
+ *		Get the target of a symlink from the cache
+ *
+ *	A cached target is only valid if it was resolved from the
+ *	same reparse data and for the same mount point, which is
+ *	stored before the target. The targets which depend on a
+ *	directory in which a name was created or deleted since (such
+ *	as by renaming a directory along the target path) have
+ *	already been dropped by ntfs_forget_symlinks().
+ *
+ *	Returns an allocated copy of the target, or NULL if not cached
+ */
+
+static char *fetch_cached_symlink(ntfs_inode *ni,
+			const REPARSE_POINT *reparse_attr, const char *mnt_point)
+{
+	struct CACHED_SYMLINK item;
+	struct CACHED_SYMLINK *cached;
+	ntfs_volume *vol;
+	char *target;
+	size_t mntsize;
+
+	target = (char*)NULL;
+	vol = ni->vol;
+	item.inum = MREF(ni->mft_no);
+	cached = (struct CACHED_SYMLINK*)ntfs_fetch_cache(vol->symlink_cache,
+				GENERIC(&item), symlink_cache_compare);
+	if (cached) {
+		mntsize = strlen(mnt_point) + 1;
+		if ((cached->datahash == reparse_data_hash(reparse_attr))
+		    && (cached->targetsize > mntsize)
+		    && !strcmp(cached->target, mnt_point)) {
+			target = (char*)ntfs_malloc(cached->targetsize
+					- mntsize);
+			if (target)
+				memcpy(target, &cached->target[mntsize],
+						cached->targetsize - mntsize);
+		} else
+			ntfs_remove_cache(vol->symlink_cache,
+				(struct CACHED_GENERIC*)cached, 0);
+	}
+	return (target);
+}
+
+/*
+ *		Enter the resolved target of a symlink into the cache
+ *
+ *	@item has recorded the directories used for resolving, the
+ *	target is not cached if there were too many of them.
+ *	The mount point used for resolving is stored before the target.
+ */
+
+static void enter_cached_symlink(ntfs_inode *ni,
+			const REPARSE_POINT *reparse_attr, const char *mnt_point,
+			const char *target, struct CACHED_SYMLINK *item)
+{
+	size_t mntsize;
+	size_t size;
+	char *stored;
+
+	if (item->dircount >= 0) {
+		mntsize = strlen(mnt_point) + 1;
+		size = mntsize + strlen(target) + 1;
+		stored = (char*)ntfs_malloc(size);
+		if (stored) {
+			memcpy(stored, mnt_point, mntsize);
+			strcpy(&stored[mntsize], target);
+			item->inum = MREF(ni->mft_no);
+			item->target = stored;
+			item->targetsize = size;
+			item->datahash = reparse_data_hash(reparse_attr);
+			ntfs_enter_cache(ni->vol->symlink_cache,
+					GENERIC(item), symlink_cache_compare);
+			free(stored);
+		}
+	}
+}
+
+#endif /* CACHE_SYMLINK_SIZE */
+
 /*
  *		Get the target for a junction point or symbolic link
  *	Should only be called for files or directories with reparse data
@@ -786,7 +1017,6 @@ static char *ntfs_get_rellink(ntfs_inode *ni, ntfschar *junction, int count)
 
 char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point)
 {
-	s64 attr_size = 0;
 	char *target;
 	unsigned int offs;
 	unsigned int lth;
@@ -799,16 +1029,28 @@ char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point)
 	ntfschar *p;
 	BOOL bad;
 	BOOL isdir;
+#if CACHE_SYMLINK_SIZE
+	struct CACHED_SYMLINK record;
+#endif
 
 	target = (char*)NULL;
 	bad = TRUE;
 	isdir = (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)
 			 != const_cpu_to_le16(0);
 	vol = ni->vol;
-	reparse_attr = (REPARSE_POINT*)ntfs_attr_readall(ni,
-			AT_REPARSE_POINT,(ntfschar*)NULL, 0, &attr_size);
-	if (reparse_attr && attr_size
-			&& valid_reparse_data(ni, reparse_attr, attr_size)) {
+	reparse_attr = ntfs_get_reparse_point(ni);
+#if CACHE_SYMLINK_SIZE
+	if (reparse_attr) {
+		target = fetch_cached_symlink(ni, reparse_attr,
+				(mnt_point ? mnt_point : ""));
+		if (target)
+			bad = FALSE;
+	}
+		/* record the directories the target depends on */
+	record.dircount = 0;
+	vol->symlink_record = &record;
+#endif
+	if (reparse_attr && !target) {
 		switch (reparse_attr->reparse_tag) {
 		case IO_REPARSE_TAG_MOUNT_POINT :
 			mount_point_data = (struct MOUNT_POINT_REPARSE_DATA*)
@@ -894,8 +1136,17 @@ char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point)
 			}
 			break;
 		}
-		free(reparse_attr);
+#if CACHE_SYMLINK_SIZE
+		if (target)
+			enter_cached_symlink(ni, reparse_attr,
+					(mnt_point ? mnt_point : ""), target,
+					&record);
+#endif
 	}
+#if CACHE_SYMLINK_SIZE
+	vol->symlink_record = (struct CACHED_SYMLINK*)NULL;
+#endif
+	free(reparse_attr);
 	if (bad)
 		errno = EOPNOTSUPP;
 	return (target);
@@ -932,6 +1183,24 @@ BOOL ntfs_possible_symlink(ntfs_inode *ni)
 }
 
 
+/*
+ *		Forget the reparse data kept along with an inode
+ *	To be called before the reparse data is changed or removed
+ *
+ *	This also makes stale the cached symlink targets, as this inode
+ *	may be a directory along their paths.
+ */
+
+static void forget_reparse_data(ntfs_inode *ni)
+{
+	free(ni->reparse);
+	ni->reparse = (REPARSE_POINT*)NULL;
+	ni->reparse_size = 0;
+#if CACHE_SYMLINK_SIZE
+	ntfs_forget_symlinks(ni);
+#endif
+}
+
 /*
  *			Set the index for new reparse data
  *
@@ -1205,6 +1474,7 @@ int ntfs_set_ntfs_reparse_data(ntfs_inode *ni,
 			 * lead to problems with earlier versions.
 			 */
 	if (ni && valid_reparse_data(ni, (const REPARSE_POINT*)value, size)) {
+		forget_reparse_data(ni);
 		xr = open_reparse_index(ni->vol);
 		if (xr) {
 			if (!ntfs_attr_exist(ni,AT_REPARSE_POINT,
@@ -1276,6 +1546,7 @@ int ntfs_remove_ntfs_reparse_data(ntfs_inode *ni)
 
 	res = 0;
 	if (ni) {
+		forget_reparse_data(ni);
 		/*
 		 * open and delete the reparse data
 		 */
@@ -1434,7 +1705,12 @@ REPARSE_POINT *ntfs_get_reparse_point(ntfs_inode *ni)
 	REPARSE_POINT *reparse_attr;
 
 	reparse_attr = (REPARSE_POINT*)NULL;
-	if (ni) {
+	if (ni && ni->reparse) {
+			/* valid data kept from a previous read */
+		reparse_attr = (REPARSE_POINT*)ntfs_malloc(ni->reparse_size);
+		if (reparse_attr)
+			memcpy(reparse_attr, ni->reparse, ni->reparse_size);
+	} else if (ni) {
 		reparse_attr = (REPARSE_POINT*)ntfs_attr_readall(ni,
 			AT_REPARSE_POINT,(ntfschar*)NULL, 0, &attr_size);
 		if (reparse_attr
@@ -1443,6 +1719,14 @@ REPARSE_POINT *ntfs_get_reparse_point(ntfs_inode *ni)
 			reparse_attr = (REPARSE_POINT*)NULL;
 			errno = EINVAL;
 		}
+			/* keep a copy along with the inode */
+		if (reparse_attr) {
+			ni->reparse = (REPARSE_POINT*)ntfs_malloc(attr_size);
+			if (ni->reparse) {
+				memcpy(ni->reparse, reparse_attr, attr_size);
+				ni->reparse_size = attr_size;
+			}
+		}
 	} else
 		errno = EINVAL;
 	return (reparse_attr);
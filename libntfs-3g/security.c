@@ -613,18 +613,271 @@ static int entersecurity_indexes(ntfs_volume *vol, s64 attrsz,
 	return (res);
 }
 
+static le32 lastsecurityid(ntfs_volume *vol, off_t *poffs, int *psize);
+
 /*
- *	Enter a new security descriptor in $Secure (data and indexes)
- *	Returns id of entry, or zero if there is a problem.
- *	(should not be called for NTFS version < 3.0)
+ *		In-memory index of the security descriptors in $Secure
  *
- *	important : calls have to be serialized, however no locking is
- *	needed while fuse is not multithreaded
+ *	Finding whether a descriptor is already present in $Secure
+ *	implies searching $SDH and reading candidates from $SDS, and
+ *	appending a new one implies searching $SII for the last key.
+ *	When setting many different ownerships (chown -R, extracting
+ *	archives), these index walks are avoided by keeping all the
+ *	descriptors in a hash table, together with the location of
+ *	the last one.
+ *
+ *	The table is built when first needed by walking $SII, and is
+ *	updated when a descriptor is appended. When it cannot be built
+ *	(inconsistent index, too many descriptors or not enough memory)
+ *	or its consistency with $Secure is uncertain, it is dropped
+ *	and the indexes are used as before.
  */
 
-static le32 entersecurityattr(ntfs_volume *vol,
-			const SECURITY_DESCRIPTOR_RELATIVE *attr, s64 attrsz,
+struct SECURE_DESCR {
+	struct SECURE_DESCR *next;
+	le32 hash;
+	le32 securid;
+	u32 size;
+	char attr[1];	/* actually size bytes */
+} ;
+
+struct SECURE_INDEX {
+	BOOL usable;
+	unsigned int count;
+	unsigned int mask;	/* number of hash heads minus one */
+	le32 last_securid;	/* last key in $SII */
+	off_t last_offs;	/* location of last descriptor in $SDS */
+	int last_size;		/* size of last descriptor in $SDS */
+	struct SECURE_DESCR **heads;
+} ;
+
+/*
+ *		Free the in-memory index and mark it as not usable
+ */
+
+static void drop_secure_index(ntfs_volume *vol)
+{
+	struct SECURE_INDEX *index;
+	struct SECURE_DESCR *descr;
+	unsigned int i;
+
+	index = vol->secure_index;
+	if (index && index->heads) {
+		for (i=0; i<=index->mask; i++) {
+			while (index->heads[i]) {
+				descr = index->heads[i];
+				index->heads[i] = descr->next;
+				free(descr);
+			}
+		}
+		free(index->heads);
+		index->heads = (struct SECURE_DESCR**)NULL;
+	}
+	if (index) {
+		index->usable = FALSE;
+		index->count = 0;
+	}
+}
+
+/*
+ *		Insert a descriptor into the in-memory index
+ *
+ *	The hash table is doubled when its load gets too high.
+ *	If there is not enough memory, or the index gets too big, it
+ *	is dropped.
+ */
+
+static void enter_secure_index(ntfs_volume *vol, const char *attr,
+			u32 size, le32 hash, le32 securid)
+{
+	struct SECURE_INDEX *index;
+	struct SECURE_DESCR *descr;
+	struct SECURE_DESCR *next;
+	struct SECURE_DESCR **heads;
+	unsigned int mask;
+	unsigned int i;
+	unsigned int h;
+
+	index = vol->secure_index;
+	if (index->count >= SECURE_INDEX_MAX) {
+		ntfs_log_debug("Too many descriptors, $Secure not"
+				" indexed in memory\n");
+		drop_secure_index(vol);
+	} else
+		if (index->count >= 2*(index->mask + 1)) {
+			mask = 2*index->mask + 1;
+			heads = (struct SECURE_DESCR**)ntfs_calloc(
+					(mask + 1)*sizeof(struct SECURE_DESCR*));
+			if (heads) {
+				for (i=0; i<=index->mask; i++) {
+					for (descr=index->heads[i]; descr;
+							descr=next) {
+						next = descr->next;
+						h = le32_to_cpu(descr->hash)
+								& mask;
+						descr->next = heads[h];
+						heads[h] = descr;
+					}
+				}
+				free(index->heads);
+				index->heads = heads;
+				index->mask = mask;
+			} else
+				drop_secure_index(vol);
+		}
+	if (index->usable) {
+		descr = (struct SECURE_DESCR*)ntfs_malloc(
+				sizeof(struct SECURE_DESCR) + size);
+		if (descr) {
+			descr->hash = hash;
+			descr->securid = securid;
+			descr->size = size;
+			memcpy(descr->attr, attr, size);
+			h = le32_to_cpu(hash) & index->mask;
+			descr->next = index->heads[h];
+			index->heads[h] = descr;
+			index->count++;
+		} else
+			drop_secure_index(vol);
+	}
+}
+
+/*
+ *		Search a descriptor in the in-memory index
+ *
+ *	Returns the security id, or zero if not found
+ */
+
+static le32 find_secure_index(struct SECURE_INDEX *index,
+			const SECURITY_DESCRIPTOR_RELATIVE *attr, u32 size,
 			le32 hash)
+{
+	const struct SECURE_DESCR *descr;
+
+	descr = index->heads[le32_to_cpu(hash) & index->mask];
+	while (descr
+	    && ((descr->hash != hash)
+		|| (descr->size != size)
+		|| memcmp(descr->attr, attr, size)))
+		descr = descr->next;
+	return (descr ? descr->securid : const_cpu_to_le32(0));
+}
+
+/*
+ *		Get the in-memory index of $Secure, building it if needed
+ *
+ *	The descriptors are collected by walking $SII, and the last
+ *	one must be the one found by the usual search for the last key,
+ *	otherwise the index is declared unusable.
+ *
+ *	Returns the index, or NULL if it is not usable.
+ */
+
+static struct SECURE_INDEX *get_secure_index(ntfs_volume *vol)
+{
+	union {
+		struct {
+			le32 dataoffsl;
+			le32 dataoffsh;
+		} parts;
+		le64 all;
+	} realign;
+	struct SECURE_INDEX *index;
+	ntfs_index_context *xsii;
+	INDEX_ENTRY *entry;
+	struct SII sii;
+	char *attr;
+	le32 keyid;
+	le32 lastid;
+	off_t offs;
+	int size;
+	BOOL ok;
+	int olderrno;
+
+	index = vol->secure_index;
+	if (!index) {
+		index = (struct SECURE_INDEX*)ntfs_malloc(
+				sizeof(struct SECURE_INDEX));
+		if (index) {
+			vol->secure_index = index;
+			index->count = 0;
+			index->mask = 255;
+			index->last_securid = const_cpu_to_le32(0);
+			index->heads = (struct SECURE_DESCR**)ntfs_calloc(
+				(index->mask + 1)*sizeof(struct SECURE_DESCR*));
+			index->usable = (index->heads != NULL);
+			ok = index->usable;
+			olderrno = errno;
+			xsii = vol->secure_xsii;
+			ntfs_index_ctx_reinit(xsii);
+			keyid = const_cpu_to_le32(0);
+			lastid = const_cpu_to_le32(0);
+			if (ok && ntfs_index_lookup((char*)&keyid,
+					sizeof(SII_INDEX_KEY), xsii)
+			    && (errno != ENOENT))
+				ok = FALSE;
+			entry = (ok ? xsii->entry : (INDEX_ENTRY*)NULL);
+			if (entry && (entry->ie_flags & INDEX_ENTRY_END))
+				entry = ntfs_index_next(entry, xsii);
+			while (ok && entry) {
+					/* the entry is not aligned */
+				memcpy(&sii, entry, sizeof(struct SII));
+				realign.parts.dataoffsh = sii.dataoffsh;
+				realign.parts.dataoffsl = sii.dataoffsl;
+				offs = le64_to_cpu(realign.all);
+				size = le32_to_cpu(sii.datasize)
+					- sizeof(SECURITY_DESCRIPTOR_HEADER);
+				attr = (size > 0 ? (char*)ntfs_malloc(size)
+						: (char*)NULL);
+				if (attr
+				    && (ntfs_attr_data_read(vol->secure_ni,
+					STREAM_SDS, 4, attr, size,
+					offs + sizeof(SECURITY_DESCRIPTOR_HEADER))
+						== size)) {
+					enter_secure_index(vol, attr, size,
+						sii.hash, sii.keysecurid);
+					lastid = sii.keysecurid;
+					ok = index->usable;
+				} else
+					ok = FALSE;
+				free(attr);
+				entry = ntfs_index_next(entry, xsii);
+			}
+			errno = olderrno;
+				/* check against the usual way to get last key */
+			if (ok) {
+				keyid = lastsecurityid(vol, &offs, &size);
+				if (keyid && (keyid == lastid)) {
+					index->last_securid = keyid;
+					index->last_offs = offs;
+					index->last_size = size;
+				} else
+					ok = FALSE;
+			}
+			ntfs_index_ctx_reinit(xsii);
+			errno = olderrno;
+			if (!ok) {
+				ntfs_log_debug("$Secure not indexed in"
+						" memory\n");
+				drop_secure_index(vol);
+			}
+		}
+	}
+	return (index && index->usable ? index : (struct SECURE_INDEX*)NULL);
+}
+
+/*
+ *	Find the last key in $Secure:$SII
+ *	This also determines the first available location in
+ *	$Secure:$SDS, as this stream is always appended to and
+ *	the id's are allocated in sequence
+ *
+ *	Returns the last key, and its location and size in $SDS
+ *		zero if there is no key
+ *		or -1 if there is an error
+ */
+
+static le32 lastsecurityid(ntfs_volume *vol, off_t *poffs, int *psize)
 {
 	union {
 		struct {
@@ -633,11 +886,8 @@ static le32 entersecurityattr(ntfs_volume *vol,
 		} parts;
 		le64 all;
 	} realign;
-	le32 securid;
 	le32 keyid;
-	u32 newkey;
 	off_t offs;
-	int gap;
 	int size;
 	BOOL found;
 	struct SII *psii;
@@ -645,16 +895,8 @@ static le32 entersecurityattr(ntfs_volume *vol,
 	INDEX_ENTRY *next;
 	ntfs_index_context *xsii;
 	int retries;
-	ntfs_attr *na;
 	int olderrno;
 
-	/* find the first available securid beyond the last key */
-	/* in $Secure:$SII. This also determines the first */
-	/* available location in $Secure:$SDS, as this stream */
-	/* is always appended to and the id's are allocated */
-	/* in sequence */
-
-	securid = const_cpu_to_le32(0);
 	xsii = vol->secure_xsii;
 	ntfs_index_ctx_reinit(xsii);
 	offs = size = 0;
@@ -742,6 +984,44 @@ static le32 entersecurityattr(ntfs_volume *vol,
 			}
 		}
 	}
+	*poffs = offs;
+	*psize = size;
+	return (keyid);
+}
+
+/*
+ *	Enter a new security descriptor in $Secure (data and indexes)
+ *	Returns id of entry, or zero if there is a problem.
+ *	(should not be called for NTFS version < 3.0)
+ *
+ *	important : calls have to be serialized, however no locking is
+ *	needed while fuse is not multithreaded
+ */
+
+static le32 entersecurityattr(ntfs_volume *vol,
+			const SECURITY_DESCRIPTOR_RELATIVE *attr, s64 attrsz,
+			le32 hash)
+{
+	struct SECURE_INDEX *index;
+	le32 securid;
+	le32 keyid;
+	u32 newkey;
+	off_t offs;
+	int gap;
+	int size;
+	ntfs_attr *na;
+
+	/* find the first available securid beyond the last key */
+	/* in $Secure:$SII, unless it is known in memory */
+
+	securid = const_cpu_to_le32(0);
+	index = vol->secure_index;
+	if (index && index->usable && index->last_securid) {
+		keyid = index->last_securid;
+		offs = index->last_offs;
+		size = index->last_size;
+	} else
+		keyid = lastsecurityid(vol, &offs, &size);
 	if (!keyid) {
 		/*
 		 * could not find any entry, before creating the first
@@ -800,6 +1080,18 @@ static le32 entersecurityattr(ntfs_volume *vol,
 		if (entersecurity_data(vol, attr, attrsz, hash, securid, offs, gap)
 		    || entersecurity_indexes(vol, attrsz, hash, securid, offs))
 			securid = const_cpu_to_le32(0);
+	}
+	if (index && index->usable) {
+		if (securid) {
+			index->last_securid = securid;
+			index->last_offs = offs;
+			index->last_size = attrsz
+					+ sizeof(SECURITY_DESCRIPTOR_HEADER);
+			enter_secure_index(vol, (const char*)attr, attrsz,
+						hash, securid);
+		} else
+			/* the state of $Secure is uncertain */
+			drop_secure_index(vol);
 	}
 		/* inode now is dirty, synchronize it all */
 	ntfs_index_entry_mark_dirty(vol->secure_xsii);
@@ -839,6 +1131,7 @@ static le32 setsecurityattr(ntfs_volume *vol,
 	s64 offs;
 	int res;
 	ntfs_index_context *xsdh;
+	struct SECURE_INDEX *index;
 	char *oldattr;
 	SDH_INDEX_KEY key;
 	INDEX_ENTRY *entry;
@@ -851,7 +1144,22 @@ static le32 setsecurityattr(ntfs_volume *vol,
 	securid = const_cpu_to_le32(0);
 	res = 0;
 	xsdh = vol->secure_xsdh;
+	index = (struct SECURE_INDEX*)NULL;
 	if (vol->secure_ni && xsdh && !vol->secure_reentry++) {
+		index = get_secure_index(vol);
+		if (index) {
+			/*
+			 * the descriptors are all known in memory,
+			 * no need to search $SDH
+			 */
+			securid = find_secure_index(index, attr, attrsz, hash);
+			if (!securid)
+				securid = entersecurityattr(vol,
+						attr, attrsz, hash);
+		}
+	}
+	if (vol->secure_ni && xsdh && !index
+	    && (vol->secure_reentry == 1)) {
 		ntfs_index_ctx_reinit(xsdh);
 		/*
 		 * find the nearest key as (hash,0)
@@ -1158,6 +1466,43 @@ static BOOL staticgroupmember(struct SECURITY_CONTEXT *scx, uid_t uid, gid_t gid
 	return (ingroup);
 }
 
+#if CACHE_GROUPS_SIZE
+
+/*
+ *		Groups cache comparing
+ *
+ *	The tid is not enough for identifying a thread, as it may be
+ *	reused after the thread has exited, so the requester's uid and
+ *	gid are compared too. A thread which changes its group list
+ *	without changing its uid and gid is only noticed when the
+ *	entry is expired.
+ */
+
+static int groups_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	const struct CACHED_GROUPS *c = (const struct CACHED_GROUPS*) cached;
+	const struct CACHED_GROUPS *w = (const struct CACHED_GROUPS*) wanted;
+	return ((c->tid != w->tid)
+		|| (c->uid != w->uid)
+		|| (c->gid != w->gid));
+}
+
+/*
+ *		Groups hashing
+ *
+ *	Based on the thread id
+ */
+
+int ntfs_groups_hash(const struct CACHED_GENERIC *cached)
+{
+	const struct CACHED_GROUPS *c = (const struct CACHED_GROUPS*) cached;
+
+	return ((unsigned int)c->tid % (2*CACHE_GROUPS_SIZE));
+}
+
+#endif
+
 #if defined(__sun) && defined (__SVR4)
 
 /*
@@ -1266,9 +1611,12 @@ static BOOL groupmember(struct SECURITY_CONTEXT* scx, uid_t uid, gid_t gid)
  * The following implementation gets the group list from
  *   /proc/$TID/task/$TID/status which apparently exists and
  * contains the same data.
+ *
+ * Returns the number of groups, with the list allocated in *pgroups
+ *		or -1 if the list could not be read
  */
 
-static BOOL groupmember(struct SECURITY_CONTEXT *scx, uid_t uid, gid_t gid)
+static int readgroups(pid_t tid, gid_t **pgroups)
 {
 	static char key[] = "\nGroups:";
 	char buf[BUFSZ+1];
@@ -1277,77 +1625,158 @@ static BOOL groupmember(struct SECURITY_CONTEXT *scx, uid_t uid, gid_t gid)
 	int fd;
 	char c;
 	int matched;
-	BOOL ismember;
 	int got;
+	int cnt;
+	int maxcnt;
 	char *p;
 	gid_t grp;
-	pid_t tid;
+	gid_t *groups;
+	gid_t *newgroups;
+
+	cnt = -1; /* default return */
+	*pgroups = (gid_t*)NULL;
+	sprintf(filename,"/proc/%u/task/%u/status",tid,tid);
+	fd = open(filename,O_RDONLY);
+	if (fd >= 0) {
+		maxcnt = 16;
+		groups = (gid_t*)ntfs_malloc(maxcnt*sizeof(gid_t));
+		cnt = 0;
+		got = read(fd, buf, BUFSZ);
+		buf[got] = 0;
+		state = INKEY;
+		matched = 0;
+		p = buf;
+		grp = 0;
+			/*
+			 *  A simple automaton to process lines like
+			 *  Groups: 14 500 513
+			 */
+		do {
+			c = *p++;
+			if (!c) {
+				/* refill buffer */
+				got = read(fd, buf, BUFSZ);
+				buf[got] = 0;
+				p = buf;
+				c = *p++; /* 0 at end of file */
+			}
+			switch (state) {
+			case INKEY :
+				if (key[matched] == c) {
+					if (!key[++matched])
+						state = INSEP;
+				} else
+					if (key[0] == c)
+						matched = 1;
+					else
+						matched = 0;
+				break;
+			case INSEP :
+				if ((c >= '0') && (c <= '9')) {
+					grp = c - '0';
+					state = INNUM;
+				} else
+					if ((c != ' ') && (c != '\t'))
+						state = INEND;
+				break;
+			case INNUM :
+				if ((c >= '0') && (c <= '9'))
+					grp = grp*10 + c - '0';
+				else {
+					if (groups && (cnt >= maxcnt)) {
+						maxcnt *= 2;
+						newgroups = (gid_t*)ntfs_realloc(
+							groups,
+							maxcnt*sizeof(gid_t));
+						if (!newgroups)
+							free(groups);
+						groups = newgroups;
+					}
+					if (groups)
+						groups[cnt++] = grp;
+					if ((c != ' ') && (c != '\t'))
+						state = INEND;
+					else
+						state = INSEP;
+				}
+			default :
+				break;
+			}
+		} while (c && (state != INEND));
+		close(fd);
+		if (!groups)
+			cnt = -1;
+		else {
+			if (state != INEND) {
+				ntfs_log_error("No group record found in %s\n",
+						filename);
+				free(groups);
+				groups = (gid_t*)NULL;
+				cnt = -1;
+			}
+		}
+		*pgroups = groups;
+	} else
+		ntfs_log_error("Could not open %s\n",filename);
+	return (cnt);
+}
+
+static BOOL groupmember(struct SECURITY_CONTEXT *scx, uid_t uid, gid_t gid)
+{
+	BOOL ismember;
+	int cnt;
+	gid_t *groups;
+#if CACHE_GROUPS_SIZE
+	struct CACHED_GROUPS item;
+	struct CACHED_GROUPS *cached;
+	time_t now;
+#endif
 
 	if (scx->vol->secure_flags & (1 << SECURITY_STATICGRPS))
 		ismember = staticgroupmember(scx, uid, gid);
 	else {
 		ismember = FALSE; /* default return */
-		tid = scx->tid;
-		sprintf(filename,"/proc/%u/task/%u/status",tid,tid);
-		fd = open(filename,O_RDONLY);
-		if (fd >= 0) {
-			got = read(fd, buf, BUFSZ);
-			buf[got] = 0;
-			state = INKEY;
-			matched = 0;
-			p = buf;
-			grp = 0;
-				/*
-				 *  A simple automaton to process lines like
-				 *  Groups: 14 500 513
-				 */
-			do {
-				c = *p++;
-				if (!c) {
-					/* refill buffer */
-					got = read(fd, buf, BUFSZ);
-					buf[got] = 0;
-					p = buf;
-					c = *p++; /* 0 at end of file */
-				}
-				switch (state) {
-				case INKEY :
-					if (key[matched] == c) {
-						if (!key[++matched])
-							state = INSEP;
-					} else
-						if (key[0] == c)
-							matched = 1;
-						else
-							matched = 0;
-					break;
-				case INSEP :
-					if ((c >= '0') && (c <= '9')) {
-						grp = c - '0';
-						state = INNUM;
-					} else
-						if ((c != ' ') && (c != '\t'))
-							state = INEND;
-					break;
-				case INNUM :
-					if ((c >= '0') && (c <= '9'))
-						grp = grp*10 + c - '0';
-					else {
-						ismember = (grp == gid);
-						if ((c != ' ') && (c != '\t'))
-							state = INEND;
-						else
-							state = INSEP;
-					}
-				default :
-					break;
-				}
-			} while (!ismember && c && (state != INEND));
-		close(fd);
-		if (!c)
-			ntfs_log_error("No group record found in %s\n",filename);
-		} else
-			ntfs_log_error("Could not open %s\n",filename);
+#if CACHE_GROUPS_SIZE
+		now = time((time_t*)NULL);
+		item.tid = scx->tid;
+		item.uid = scx->uid;
+		item.gid = scx->gid;
+		cached = (struct CACHED_GROUPS*)ntfs_fetch_cache(
+				scx->vol->groups_cache, GENERIC(&item),
+				groups_cache_compare);
+		if (cached
+		    && ((now - cached->stamp) > CACHE_GROUPS_TTL)) {
+				/* expired, drop and read again */
+			ntfs_remove_cache(scx->vol->groups_cache,
+				(struct CACHED_GENERIC*)cached, 0);
+			cached = (struct CACHED_GROUPS*)NULL;
+		}
+		if (cached) {
+			groups = cached->groups;
+			cnt = cached->groupsize/sizeof(gid_t);
+			while ((--cnt >= 0) && (groups[cnt] != gid)) { }
+			ismember = (cnt >= 0);
+		} else {
+			cnt = readgroups(scx->tid, &groups);
+			if (cnt >= 0) {
+				item.groups = groups;
+				item.groupsize = cnt*sizeof(gid_t);
+				item.stamp = now;
+				ntfs_enter_cache(scx->vol->groups_cache,
+					GENERIC(&item), groups_cache_compare);
+				while ((--cnt >= 0) && (groups[cnt] != gid)) { }
+				ismember = (cnt >= 0);
+				free(groups);
+			}
+		}
+#else
+		cnt = readgroups(scx->tid, &groups);
+		if (cnt >= 0) {
+			while ((--cnt >= 0) && (groups[cnt] != gid)) { }
+			ismember = (cnt >= 0);
+			free(groups);
+		}
+#endif
 	}
 	return (ismember);
 }
@@ -4029,6 +4458,44 @@ static le32 build_inherited_id(struct SECURITY_CONTEXT *scx,
 	return (securid);
 }
 
+#if CACHE_INHERITED_SIZE
+
+/*
+ *		Inherited ids cache comparing
+ */
+
+static int inherited_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *wanted)
+{
+	const struct CACHED_INHERITED *c =
+			(const struct CACHED_INHERITED*) cached;
+	const struct CACHED_INHERITED *w =
+			(const struct CACHED_INHERITED*) wanted;
+	return ((c->parentid != w->parentid)
+		|| (c->uid != w->uid)
+		|| (c->gid != w->gid)
+		|| (c->fordir != w->fordir));
+}
+
+/*
+ *		Inherited ids hashing
+ *
+ *	Based on the parent security id and the creator
+ */
+
+int ntfs_inherited_hash(const struct CACHED_GENERIC *cached)
+{
+	const struct CACHED_INHERITED *c =
+			(const struct CACHED_INHERITED*) cached;
+	unsigned int val;
+
+	val = le32_to_cpu(c->parentid) + c->uid + (c->gid << 1)
+			+ (c->fordir ? 1 : 0);
+	return (val % (2*CACHE_INHERITED_SIZE));
+}
+
+#endif
+
 /*
  *		Get an inherited security id
  *
@@ -4049,6 +4516,10 @@ le32 ntfs_inherited_id(struct SECURITY_CONTEXT *scx,
 			ntfs_inode *dir_ni, BOOL fordir)
 {
 	struct CACHED_PERMISSIONS *cached;
+#if CACHE_INHERITED_SIZE
+	struct CACHED_INHERITED item;
+	struct CACHED_INHERITED *inherited;
+#endif
 	char *parentattr;
 	le32 securid;
 
@@ -4065,6 +4536,26 @@ le32 ntfs_inherited_id(struct SECURITY_CONTEXT *scx,
 		    && (cached->uid == scx->uid) && (cached->gid == scx->gid))
 			securid = (fordir ? cached->inh_dirid
 					: cached->inh_fileid);
+#if CACHE_INHERITED_SIZE
+		/*
+		 * Otherwise try the inherited ids cache, which survives
+		 * new lookups of the parent permissions
+		 */
+		item.parentid = dir_ni->security_id;
+		item.uid = scx->uid;
+		item.gid = scx->gid;
+		item.fordir = fordir;
+		item.variable = (void*)NULL;
+		item.varsize = 0;
+		if (!securid) {
+			inherited = (struct CACHED_INHERITED*)ntfs_fetch_cache(
+					scx->vol->inherited_cache,
+					GENERIC(&item),
+					inherited_cache_compare);
+			if (inherited)
+				securid = inherited->securid;
+		}
+#endif
 	}
 		/*
 		 * Not cached or not available in cache, compute it all
@@ -4090,6 +4581,16 @@ le32 ntfs_inherited_id(struct SECURITY_CONTEXT *scx,
 					else
 						cached->inh_fileid = securid;
 				}
+#if CACHE_INHERITED_SIZE
+				if (test_nino_flag(dir_ni, v3_Extensions)
+				    && dir_ni->security_id) {
+					item.securid = securid;
+					ntfs_enter_cache(
+						scx->vol->inherited_cache,
+						GENERIC(&item),
+						inherited_cache_compare);
+				}
+#endif
 			}
 		}
 	}
@@ -4206,9 +4707,11 @@ static int ntfs_do_default_mapping(struct SECURITY_CONTEXT *scx,
 				usermapping->sid = sid;
 				usermapping->xid = uid;
 				usermapping->next = (struct MAPPING*)NULL;
+				usermapping->index = (struct MAPPING_INDEX*)NULL;
 				groupmapping->sid = sid;
 				groupmapping->xid = gid;
 				groupmapping->next = (struct MAPPING*)NULL;
+				groupmapping->index = (struct MAPPING_INDEX*)NULL;
 				scx->mapping[MAPUSERS] = usermapping;
 				scx->mapping[MAPGROUPS] = groupmapping;
 				res = 0;
@@ -4545,6 +5048,11 @@ int ntfs_close_secure(ntfs_volume *vol)
 {
 	int res = 0;
 
+	if (vol->secure_index) {
+		drop_secure_index(vol);
+		free(vol->secure_index);
+		vol->secure_index = (struct SECURE_INDEX*)NULL;
+	}
 	if (vol->secure_ni) {
 		ntfs_index_ctx_put(vol->secure_xsdh);
 		ntfs_index_ctx_put(vol->secure_xsii);
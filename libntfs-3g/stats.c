@@ -0,0 +1,218 @@
+/**
+ * stats.c : counters and latency histograms of operations
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_TIME_H
+#include <time.h>
+#endif
+#ifdef HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+
+#include "types.h"
+#include "stats.h"
+
+#define STATS_LINE_SIZE 160 /* room for a formatted line */
+
+/*
+ *		Counting operations and their latencies
+ *
+ *	The counters are global, as a process normally mounts a single
+ *	volume. Only a single thread is expected to update them, so
+ *	no locking is done : with several threads, a few updates may
+ *	be lost, which is not significant for statistics.
+ *
+ *	Applications may register further tables (such as for the
+ *	fuse operations), so that they are formatted along with the
+ *	ones of the library.
+ */
+
+struct NTFS_STATS ntfs_stats[STATS_COUNT] = {
+	{ "inode_open" },
+	{ "attr_pread" },
+	{ "attr_pwrite" },
+	{ "cluster_alloc" },
+	{ "index_lookup" },
+	{ "device_read" },
+	{ "device_write" },
+	{ "compress_unit" },
+	{ "compress_skip" },
+} ;
+
+static struct NTFS_STATS_TABLE library_table = {
+	(struct NTFS_STATS_TABLE*)NULL, ntfs_stats, STATS_COUNT
+} ;
+
+static struct NTFS_STATS_TABLE *stats_tables = &library_table;
+
+/*
+ *		Get a time stamp in microseconds at the start of an operation
+ *
+ *	Returns zero if no clock is usable, the latency is then
+ *	recorded as zero. The UEFI clock is too slow to be used.
+ */
+
+s64 ntfs_stats_begin(void)
+{
+	s64 stamp;
+#if !defined(UEFI_DRIVER) && defined(HAVE_CLOCK_GETTIME)
+	struct timespec now;
+
+	if (!clock_gettime(CLOCK_MONOTONIC, &now))
+		stamp = (s64)now.tv_sec*1000000 + now.tv_nsec/1000;
+	else
+		stamp = 0;
+#elif !defined(UEFI_DRIVER) && defined(HAVE_GETTIMEOFDAY)
+	struct timeval now;
+
+	if (!gettimeofday(&now, (struct timezone*)NULL))
+		stamp = (s64)now.tv_sec*1000000 + now.tv_usec;
+	else
+		stamp = 0;
+#else
+	stamp = 0;
+#endif
+	return (stamp);
+}
+
+/*
+ *		Record the end of an operation
+ *
+ *	@begin is the stamp got from ntfs_stats_begin()
+ *	@bytes is the count of bytes transferred, or negative if
+ *		the operation failed
+ */
+
+void ntfs_stats_end(struct NTFS_STATS *st, s64 begin, s64 bytes)
+{
+	s64 us;
+	int n;
+
+	st->count++;
+	if (bytes < 0)
+		st->errors++;
+	else
+		st->bytes += bytes;
+	us = (begin ? ntfs_stats_begin() - begin : 0);
+	if (us < 0)
+		us = 0;
+	st->total_us += us;
+	n = 0;
+	while ((n < (NTFS_STATS_BUCKETS - 1)) && (us >> n))
+		n++;
+	st->hist[n]++;
+}
+
+/*
+ *		Register a further table of counters
+ *
+ *	The table must remain available as long as the library is used
+ */
+
+void ntfs_stats_register(struct NTFS_STATS_TABLE *table)
+{
+	struct NTFS_STATS_TABLE *t;
+
+	t = stats_tables;
+	while (t && (t != table))
+		t = t->next;
+	if (!t) {
+		table->next = stats_tables;
+		stats_tables = table;
+	}
+}
+
+/*
+ *		Append a formatted line to the text, as far as it fits
+ *
+ *	Returns the new size of the full text
+ */
+
+static int stats_append(char *buf, int size, int len,
+			const char *line, int linelen)
+{
+	if (linelen >= STATS_LINE_SIZE)
+		linelen = STATS_LINE_SIZE - 1;
+	if (len < size)
+		memcpy(&buf[len], line,
+			(linelen < (size - len) ? linelen : size - len));
+	return (len + linelen);
+}
+
+/*
+ *		Format the counters as text, one line per operation
+ *	which has been used
+ *
+ *	Each line is formatted into a scratch buffer and only the bytes
+ *	which fit into @size are copied, the text is not null-terminated.
+ *	The counters may be updated concurrently, so a caller sizing
+ *	a buffer by a first call should add NTFS_STATS_MARGIN.
+ *
+ *	Returns the size of the full text, even if it has to be
+ *	truncated to fit into @size bytes.
+ */
+
+int ntfs_stats_format(char *buf, int size)
+{
+	const struct NTFS_STATS_TABLE *t;
+	const struct NTFS_STATS *st;
+	char line[STATS_LINE_SIZE];
+	int len;
+	int i;
+	int n;
+
+	len = 0;
+	for (t=stats_tables; t; t=t->next) {
+		for (i=0; i<t->count; i++) {
+			st = &t->items[i];
+			if (st->count) {
+				len = stats_append(buf, size, len, line,
+					snprintf(line, STATS_LINE_SIZE,
+					"%-16s %lu calls %lu failed %llu bytes"
+					" %llu us\n", st->name, st->count,
+					st->errors,
+					(unsigned long long)st->bytes,
+					(unsigned long long)st->total_us));
+				for (n=0; n<NTFS_STATS_BUCKETS; n++)
+					if (st->hist[n])
+						len = stats_append(buf, size,
+						    len, line,
+						    snprintf(line,
+						    STATS_LINE_SIZE,
+						    "%16s %s%llu us : %lu\n", "",
+						    (n < (NTFS_STATS_BUCKETS - 1)
+							? "< " : ">= "),
+						    (n < (NTFS_STATS_BUCKETS - 1)
+							? 1ULL << n
+							: 1ULL << (n - 1)),
+						    st->hist[n]));
+			}
+		}
+	}
+	return (len);
+}
@@ -0,0 +1,214 @@
+/**
+ * trace.c : binary tracing of requests and device accesses
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "types.h"
+#include "misc.h"
+#include "stats.h"
+#include "trace.h"
+#include "logging.h"
+
+/*
+ *		Tracing events into a ring buffer
+ *
+ *	When tracing is active, each event is stored as a fixed size
+ *	binary record into a ring buffer, the oldest records being
+ *	overwritten when the ring is full. Nothing is formatted
+ *	while recording, the analysis is done offline from a dump
+ *	(see ntfstrace).
+ *
+ *	The drivers process the requests in a single thread, so
+ *	a single ring is used and no locking is done.
+ */
+
+static struct NTFS_TRACE_RECORD *ring = (struct NTFS_TRACE_RECORD*)NULL;
+static u32 ring_size;
+static u32 ring_next;
+static u32 ring_count;
+static u32 ring_lost;
+static u32 current_request;
+
+static char event_names[NTFS_TRACE_EVENTS][NTFS_TRACE_NAME_LTH] = {
+	"attr_pread",
+	"attr_pwrite",
+	"device_read",
+	"device_write",
+} ;
+
+/*
+ *		Start tracing into a ring of @records entries
+ *
+ *	Returns zero if successful, -1 otherwise
+ */
+
+int ntfs_trace_start(unsigned int records)
+{
+	int res;
+
+	res = -1;
+	if (!records)
+		errno = EINVAL;
+	else {
+		ntfs_trace_stop();
+		ring = (struct NTFS_TRACE_RECORD*)ntfs_malloc(records
+				* sizeof(struct NTFS_TRACE_RECORD));
+		if (ring) {
+			ring_size = records;
+			ring_next = 0;
+			ring_count = 0;
+			ring_lost = 0;
+			res = 0;
+		}
+	}
+	return (res);
+}
+
+void ntfs_trace_stop(void)
+{
+	free(ring);
+	ring = (struct NTFS_TRACE_RECORD*)NULL;
+	ring_size = 0;
+}
+
+/*
+ *		Name an event defined by the driver
+ */
+
+void ntfs_trace_name(int event, const char *name)
+{
+	if ((event >= 0) && (event < NTFS_TRACE_EVENTS)) {
+		strncpy(event_names[event], name, NTFS_TRACE_NAME_LTH - 1);
+		event_names[event][NTFS_TRACE_NAME_LTH - 1] = 0;
+	}
+}
+
+/*
+ *		Define the request being processed, for relating
+ *	the subsequent library events to it
+ */
+
+void ntfs_trace_request(u32 request)
+{
+	current_request = request;
+}
+
+/*
+ *		Record an event
+ *
+ *	@begin is the time stamp got from ntfs_stats_begin() when the
+ *		event started, the event being considered as terminated
+ *		now.
+ */
+
+void ntfs_trace_record(int event, u64 inode, s64 offset, u32 size,
+			s64 result, s64 begin)
+{
+	struct NTFS_TRACE_RECORD *rec;
+	s64 now;
+
+	if (ring) {
+		now = (begin ? ntfs_stats_begin() : 0);
+		rec = &ring[ring_next];
+		rec->stamp = begin;
+		rec->inode = inode;
+		rec->offset = offset;
+		rec->result = result;
+		rec->duration = (now > begin ? now - begin : 0);
+		rec->size = size;
+		rec->request = current_request;
+		rec->event = event;
+		rec->filler = 0;
+		if (++ring_next >= ring_size)
+			ring_next = 0;
+		if (ring_count < ring_size)
+			ring_count++;
+		else
+			ring_lost++;
+	}
+}
+
+/*
+ *		Dump the ring into a file
+ *
+ *	The records are kept, so that dumps can be made periodically.
+ *
+ *	Returns zero if successful, -1 otherwise
+ */
+
+int ntfs_trace_dump(const char *path)
+{
+#ifndef UEFI_DRIVER
+	struct NTFS_TRACE_HEADER header;
+	FILE *f;
+	u32 first;
+	int res;
+
+	res = -1;
+	if (!ring)
+		errno = EINVAL;
+	else {
+		f = fopen(path, "wb");
+		if (f) {
+			header.magic = NTFS_TRACE_MAGIC;
+			header.version = NTFS_TRACE_VERSION;
+			header.record_size = sizeof(struct NTFS_TRACE_RECORD);
+			header.events = NTFS_TRACE_EVENTS;
+			header.count = ring_count;
+			header.lost = ring_lost;
+			first = (ring_count < ring_size ? 0 : ring_next);
+			if ((fwrite(&header, sizeof(header), 1, f) == 1)
+			    && (fwrite(event_names, sizeof(event_names),
+					1, f) == 1)
+			    && (fwrite(&ring[first],
+					sizeof(struct NTFS_TRACE_RECORD),
+					ring_count - first, f)
+						== (ring_count - first))
+			    && (fwrite(ring,
+					sizeof(struct NTFS_TRACE_RECORD),
+					first, f) == first))
+				res = 0;
+			if (fclose(f))
+				res = -1;
+		}
+		if (res)
+			ntfs_log_perror("Could not dump the trace to %s",
+					path);
+	}
+	return (res);
+#else
+	errno = EOPNOTSUPP;
+	return (-1);
+#endif
+}
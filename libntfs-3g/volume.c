@@ -70,6 +70,7 @@
 #include "runlist.h"
 #include "logfile.h"
 #include "dir.h"
+#include "index.h"
 #include "logging.h"
 #include "cache.h"
 #include "realpath.h"
@@ -173,8 +174,12 @@ static int __ntfs_volume_release(ntfs_volume *v)
 {
 	int err = 0;
 
+		/* the directories in cache may have unwritten index blocks */
+	if (ntfs_index_release_deferred(v))
+		ntfs_error_set(&err);
 	if (ntfs_close_secure(v))
 		ntfs_error_set(&err);
+	ntfs_attr_release_reservations(v);
 
 	if (ntfs_inode_free(&v->vol_ni))
 		ntfs_error_set(&err);
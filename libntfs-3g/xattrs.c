@@ -55,6 +55,7 @@
 #include "object_id.h"
 #include "ea.h"
 #include "misc.h"
+#include "stats.h"
 #include "logging.h"
 #include "xattrs.h"
 
@@ -93,6 +94,7 @@ static const char nf_ns_xattr_times_be[] = "system.ntfs_times_be";
 static const char nf_ns_xattr_crtime[] = "system.ntfs_crtime";
 static const char nf_ns_xattr_crtime_be[] = "system.ntfs_crtime_be";
 static const char nf_ns_xattr_ea[] = "system.ntfs_ea";
+static const char nf_ns_xattr_stats[] = "system.ntfs_stats";
 static const char nf_ns_xattr_posix_access[] = "system.posix_acl_access";
 static const char nf_ns_xattr_posix_default[] = "system.posix_acl_default";
 
@@ -116,6 +118,7 @@ static struct XATTRNAME nf_ns_xattr_names[] = {
 	{ XATTR_NTFS_CRTIME, nf_ns_xattr_crtime },
 	{ XATTR_NTFS_CRTIME_BE, nf_ns_xattr_crtime_be },
 	{ XATTR_NTFS_EA, nf_ns_xattr_ea },
+	{ XATTR_NTFS_STATS, nf_ns_xattr_stats },
 	{ XATTR_POSIX_ACC, nf_ns_xattr_posix_access },
 	{ XATTR_POSIX_DEF, nf_ns_xattr_posix_default },
 	{ XATTR_UNMAPPED, (char*)NULL } /* terminator */
@@ -591,6 +594,20 @@ int ntfs_xattr_system_getxattr(struct SECURITY_CONTEXT *scx,
 	case XATTR_NTFS_EA :
 		res = ntfs_get_ntfs_ea(ni, value, size);
 		break;
+	case XATTR_NTFS_STATS :
+			/*
+			 * not related to the inode, same on all files.
+			 * When only the size is requested, allow for the
+			 * counters to grow until the text is requested.
+			 */
+		res = ntfs_stats_format(value, size);
+		if (!size)
+			res += NTFS_STATS_MARGIN;
+		else if (res > (int)size) {
+			errno = ERANGE;
+			res = -errno;
+		}
+		break;
 	default :
 		errno = EOPNOTSUPP;
 		res = -errno;
@@ -733,6 +750,10 @@ int ntfs_xattr_system_setxattr(struct SECURITY_CONTEXT *scx,
 	case XATTR_NTFS_EA :
 		res = ntfs_set_ntfs_ea(ni, value, size, flags);
 		break;
+	case XATTR_NTFS_STATS :
+		errno = EPERM;
+		res = -errno;
+		break;
 	default :
 		errno = EOPNOTSUPP;
 		res = -errno;
@@ -750,7 +771,7 @@ int ntfs_xattr_system_removexattr(struct SECURITY_CONTEXT *scx,
 	res = 0;
 	switch (attr) {
 		/*
-		 * Removal of NTFS ACL, ATTRIB, EFSINFO or TIMES
+		 * Removal of NTFS ACL, ATTRIB, EFSINFO, TIMES or STATS
 		 * is never allowed
 		 */
 	case XATTR_NTFS_ACL :
@@ -761,6 +782,7 @@ int ntfs_xattr_system_removexattr(struct SECURITY_CONTEXT *scx,
 	case XATTR_NTFS_TIMES_BE :
 	case XATTR_NTFS_CRTIME :
 	case XATTR_NTFS_CRTIME_BE :
+	case XATTR_NTFS_STATS :
 		res = -EPERM;
 		break;
 #if POSIXACLS
@@ -0,0 +1,1419 @@
+/*
+ *		Measure the performance of libntfs-3g on an image
+ *
+ *	The operations which matter most to the drivers (creating and
+ *	looking up files, opening inodes, reading directories, reading
+ *	and writing data, allocating clusters, ...) are timed directly
+ *	through the library, without fuse, on a newly formatted image.
+ *
+ *	When a driver is designated, the image is mounted through it
+ *	instead, and the timings of common workloads (sequential and
+ *	random reads and writes, creating, listing and deleting many
+ *	files, writing and reading a tree of small files) are taken
+ *	through fuse, so that drivers or mount options can be compared.
+ *
+ *	Each benchmark is output as a single line of "key=value" fields,
+ *	so that the results can be compared from one version to another.
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define BENCHVERSION "1.0.0"
+#define DEFAULT_FILES 10000
+#define DATA_TOTAL (16 << 20)	/* bytes written for each size */
+#define FRAG_BLOCKS 2048	/* blocks interleaved into two files */
+#define SPARSE_STEPS 256	/* data blocks in the sparse file */
+#define COMPRESSED_UNITS 256	/* compression units written */
+#define READDIR_LOOPS 10
+#define MAPPING_ENTRIES 10000	/* users and groups in the mapping file */
+#define MAPPING_LOOKUPS 100000
+#define SEQ_TOTAL (64 << 20)	/* size of file for read and write through fuse */
+#define RANDOM_COUNT 4096	/* random reads or writes through fuse */
+#define TREE_DIRS 50		/* directories of the tree of small files */
+#define TREE_FILES 40		/* files per directory in the tree */
+#define FIND_UID 65534		/* user walking the tree when run as root */
+#define FIND_GROUPS 16		/* supplementary groups of this user */
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_GRP_H
+#include <grp.h>
+#endif
+#include <sys/wait.h>
+#include <dirent.h>
+#include <time.h>
+
+#include "types.h"
+#include "layout.h"
+#include "volume.h"
+#include "inode.h"
+#include "attrib.h"
+#include "dir.h"
+#include "lcnalloc.h"
+#include "compress.h"
+#include "security.h"
+#include "acls.h"
+#include "stats.h"
+#include "unistr.h"
+#include "misc.h"
+
+struct RESULT {
+	const char *name;
+	unsigned long count;
+	unsigned long errors;
+	u64 bytes;
+	u64 total_ns;
+	u64 *ns;		/* for getting percentiles */
+	unsigned long max;
+	s64 stored;		/* space used on device, if relevant */
+} ;
+
+static u32 seed = 1;
+
+static void usage(void)
+{
+	fprintf(stderr,"ntfsbench version %s\n",BENCHVERSION);
+	fprintf(stderr,"Usage : ntfsbench [-n files] image\n");
+	fprintf(stderr,"   or : ntfsbench [-n files] -d driver [-o options]"
+			" image mountpoint\n");
+	fprintf(stderr,"   -n : count of files in the big directory"
+			" (default %d)\n",DEFAULT_FILES);
+	fprintf(stderr,"   -d : mount the image with this driver and run"
+			" the benchmarks through fuse\n");
+	fprintf(stderr,"   -o : mount options for the driver\n");
+	fprintf(stderr,"   image : a newly formatted image, such as made by\n"
+			"           mkntfs -F -f -q image\n");
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u64)ts.tv_sec*1000000000 + ts.tv_nsec);
+}
+
+/*
+ *		Get a pseudo-random number, the same sequence is used
+ *	on every run for the results to be comparable
+ */
+
+static u32 pseudo_random(void)
+{
+	seed = seed*1103515245 + 12345;
+	return (seed >> 8);
+}
+
+static void fill_text(char *buf, u32 size)
+{
+	static const char *words[] = {
+		"ntfs ", "index ", "cluster ", "the ", "of ", "runlist ",
+		"attribute ", "inode ", "a ", "file ", "directory\n", "mft ",
+	} ;
+	const char *w;
+	u32 i;
+
+	i = 0;
+	while (i < size) {
+		w = words[pseudo_random() % 12];
+		while (*w && (i < size))
+			buf[i++] = *w++;
+	}
+}
+
+static void start(struct RESULT *res, const char *name, unsigned long max)
+{
+	memset(res, 0, sizeof(struct RESULT));
+	res->name = name;
+	res->max = max;
+	res->ns = (u64*)ntfs_malloc((max + 1)*sizeof(u64));
+}
+
+/*
+ *		Account for an operation started at @begin
+ *
+ *	@bytes is the count of bytes transferred, or negative if
+ *		the operation failed
+ */
+
+static void sample(struct RESULT *res, u64 begin, s64 bytes)
+{
+	u64 ns;
+
+	ns = now_ns() - begin;
+	if (bytes < 0)
+		res->errors++;
+	else {
+		res->bytes += bytes;
+		if (res->ns && (res->count < res->max)) {
+			res->ns[res->count++] = ns;
+			res->total_ns += ns;
+		}
+	}
+}
+
+static int compare_ns(const void *p1, const void *p2)
+{
+	u64 d1 = *(const u64*)p1;
+	u64 d2 = *(const u64*)p2;
+
+	return (d1 < d2 ? -1 : (d1 > d2 ? 1 : 0));
+}
+
+/*
+ *		Output the results of a benchmark on a single line
+ */
+
+static void report(struct RESULT *res)
+{
+	u64 ops;
+
+	if (res->count) {
+		qsort(res->ns, res->count, sizeof(u64), compare_ns);
+		ops = (res->total_ns
+			? ((u64)res->count*1000000000)/res->total_ns : 0);
+		printf("bench=%s ops=%lu errors=%lu bytes=%llu ops_per_s=%llu"
+			" mb_per_s=%llu p50_ns=%llu p90_ns=%llu p99_ns=%llu"
+			" max_ns=%llu",
+			res->name, res->count, res->errors,
+			(unsigned long long)res->bytes,
+			(unsigned long long)ops,
+			(unsigned long long)(res->total_ns
+				? (res->bytes*1000)/res->total_ns : 0),
+			(unsigned long long)res->ns[res->count/2],
+			(unsigned long long)res->ns[(res->count*9)/10],
+			(unsigned long long)res->ns[(res->count*99)/100],
+			(unsigned long long)res->ns[res->count - 1]);
+		if (res->stored)
+			printf(" stored=%llu",
+				(unsigned long long)res->stored);
+		printf("\n");
+	} else
+		printf("bench=%s ops=0 errors=%lu\n",res->name,res->errors);
+	fflush(stdout);
+	free(res->ns);
+	res->ns = (u64*)NULL;
+}
+
+/*
+ *		Create a file or directory, and return it open
+ *
+ *	An inode must not be opened twice, so while a directory is
+ *	kept open, the files within are closed by ntfs_inode_close_in_dir()
+ */
+
+static ntfs_inode *create(ntfs_inode *dir_ni, const char *name, mode_t type)
+{
+	ntfs_inode *ni;
+	ntfschar *uname;
+	int len;
+
+	ni = (ntfs_inode*)NULL;
+	uname = (ntfschar*)NULL;
+	len = ntfs_mbstoucs(name, &uname);
+	if (len > 0)
+		ni = ntfs_create(dir_ni, const_cpu_to_le32(0), uname, len,
+				type);
+	free(uname);
+	return (ni);
+}
+
+/*
+ *		Open the unnamed data attribute of a new file
+ */
+
+static ntfs_attr *create_data(ntfs_inode *dir_ni, const char *name)
+{
+	ntfs_inode *ni;
+	ntfs_attr *na;
+
+	na = (ntfs_attr*)NULL;
+	ni = create(dir_ni, name, S_IFREG);
+	if (ni) {
+		na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+		if (!na)
+			ntfs_inode_close_in_dir(ni, dir_ni);
+	}
+	if (!na)
+		fprintf(stderr,"Could not create %s : %s\n",
+				name, strerror(errno));
+	return (na);
+}
+
+static void close_data(ntfs_attr *na, ntfs_inode *dir_ni)
+{
+	ntfs_inode *ni;
+
+	ni = na->ni;
+	ntfs_attr_close(na);
+	ntfs_inode_close_in_dir(ni, dir_ni);
+}
+
+static void timed_pwrite(struct RESULT *res, ntfs_attr *na, s64 pos,
+			s64 size, const char *buf)
+{
+	u64 begin;
+	s64 done;
+
+	begin = now_ns();
+	done = ntfs_attr_pwrite(na, pos, size, buf);
+	sample(res, begin, (done == size ? done : -1));
+}
+
+static void timed_pread(struct RESULT *res, ntfs_attr *na, s64 pos,
+			s64 size, char *buf)
+{
+	u64 begin;
+	s64 done;
+
+	begin = now_ns();
+	done = ntfs_attr_pread(na, pos, size, buf);
+	sample(res, begin, (done == size ? done : -1));
+}
+
+static int count_entry(void *dirent, const ntfschar *name __attribute__((unused)),
+			const int name_len __attribute__((unused)),
+			const int name_type __attribute__((unused)),
+			const s64 pos __attribute__((unused)),
+			const MFT_REF mref __attribute__((unused)),
+			const unsigned dt_type __attribute__((unused)))
+{
+	(*(unsigned long*)dirent)++;
+	return (0);
+}
+
+/*
+ *		Create, look up, open and list the files of a big directory
+ *
+ *	Returns the inode numbers of the files, for deleting them later
+ */
+
+static MFT_REF *big_directory(ntfs_volume *vol, ntfs_inode *dir_ni,
+			unsigned long files)
+{
+	struct RESULT res;
+	ntfs_inode *ni;
+	MFT_REF *mrefs;
+	char name[32];
+	unsigned long entries;
+	unsigned long i;
+	u64 begin;
+	s64 pos;
+	int loop;
+
+	mrefs = (MFT_REF*)ntfs_malloc(files*sizeof(MFT_REF));
+	if (mrefs) {
+		start(&res, "create", files);
+		for (i=0; i<files; i++) {
+			snprintf(name, sizeof(name), "f%06lu", i);
+			begin = now_ns();
+			ni = create(dir_ni, name, S_IFREG);
+			if (ni) {
+				mrefs[i] = ni->mft_no;
+				ntfs_inode_close_in_dir(ni, dir_ni);
+			} else
+				mrefs[i] = 0;
+			sample(&res, begin, (ni ? 0 : -1));
+		}
+		report(&res);
+
+		start(&res, "pathname_to_inode", files);
+		for (i=0; i<files; i++) {
+			snprintf(name, sizeof(name), "f%06lu",
+				(unsigned long)(pseudo_random() % files));
+			begin = now_ns();
+			ni = ntfs_pathname_to_inode(vol, dir_ni, name);
+			if (ni)
+				ntfs_inode_close_in_dir(ni, dir_ni);
+			sample(&res, begin, (ni ? 0 : -1));
+		}
+		report(&res);
+
+		start(&res, "inode_open_close", files);
+		for (i=0; i<files; i++) {
+			begin = now_ns();
+			ni = ntfs_inode_open(vol,
+					mrefs[pseudo_random() % files]);
+			if (ni)
+				ntfs_inode_close_in_dir(ni, dir_ni);
+			sample(&res, begin, (ni ? 0 : -1));
+		}
+		report(&res);
+
+		start(&res, "readdir", READDIR_LOOPS);
+		for (loop=0; loop<READDIR_LOOPS; loop++) {
+			pos = 0;
+			entries = 0;
+			begin = now_ns();
+			if (ntfs_readdir(dir_ni, &pos, &entries, count_entry)
+			    || (entries < files))
+				sample(&res, begin, -1);
+			else
+				sample(&res, begin, 0);
+		}
+		report(&res);
+	}
+	return (mrefs);
+}
+
+/*
+ *		Write and read a file with requests of various sizes
+ *
+ *	The file is written sequentially, so clusters are allocated
+ *	while writing, then it is read at random positions.
+ */
+
+static void data_access(ntfs_inode *dir_ni, char *buf)
+{
+	static const struct {
+		const char *wname;
+		const char *rname;
+		s64 size;
+	} sizes[] = {
+		{ "pwrite_512", "pread_512", 512 },
+		{ "pwrite_4096", "pread_4096", 4096 },
+		{ "pwrite_65536", "pread_65536", 65536 },
+		{ "pwrite_1048576", "pread_1048576", 1048576 },
+	} ;
+	struct RESULT res;
+	ntfs_attr *na;
+	char name[32];
+	unsigned long count;
+	unsigned long i;
+	unsigned int k;
+
+	for (k=0; k<sizeof(sizes)/sizeof(sizes[0]); k++) {
+		snprintf(name, sizeof(name), "data%lld",
+				(long long)sizes[k].size);
+		na = create_data(dir_ni, name);
+		if (na) {
+			count = DATA_TOTAL/sizes[k].size;
+			start(&res, sizes[k].wname, count);
+			for (i=0; i<count; i++)
+				timed_pwrite(&res, na, i*sizes[k].size,
+						sizes[k].size, buf);
+			report(&res);
+			start(&res, sizes[k].rname, count);
+			for (i=0; i<count; i++)
+				timed_pread(&res, na,
+					(pseudo_random() % count)
+						*sizes[k].size,
+					sizes[k].size, buf);
+			report(&res);
+			close_data(na, dir_ni);
+		}
+	}
+}
+
+/*
+ *		Write two files in parallel, so that their clusters are
+ *	interleaved, then read one of them at random positions
+ */
+
+static void fragmented(ntfs_inode *dir_ni, char *buf)
+{
+	struct RESULT res;
+	ntfs_attr *na1;
+	ntfs_attr *na2;
+	unsigned long i;
+
+	na1 = create_data(dir_ni, "frag1");
+	na2 = create_data(dir_ni, "frag2");
+	if (na1 && na2) {
+		start(&res, "frag_pwrite_4096", 2*FRAG_BLOCKS);
+		for (i=0; i<FRAG_BLOCKS; i++) {
+			timed_pwrite(&res, na1, i*4096, 4096, buf);
+			timed_pwrite(&res, na2, i*4096, 4096, buf);
+		}
+		report(&res);
+		start(&res, "frag_pread_4096", FRAG_BLOCKS);
+		for (i=0; i<FRAG_BLOCKS; i++)
+			timed_pread(&res, na1,
+				(pseudo_random() % FRAG_BLOCKS)*4096,
+				4096, buf);
+		report(&res);
+	}
+	if (na1)
+		close_data(na1, dir_ni);
+	if (na2)
+		close_data(na2, dir_ni);
+}
+
+/*
+ *		Write isolated blocks one megabyte apart, then read
+ *	the file, mostly made of holes, at random positions
+ */
+
+static void sparse(ntfs_inode *dir_ni, char *buf)
+{
+	struct RESULT res;
+	ntfs_attr *na;
+	unsigned long i;
+
+	na = create_data(dir_ni, "sparse");
+	if (na) {
+		start(&res, "sparse_pwrite_4096", SPARSE_STEPS);
+		for (i=0; i<SPARSE_STEPS; i++)
+			timed_pwrite(&res, na, (s64)i << 20, 4096, buf);
+		report(&res);
+			/* the last megabyte is not fully written */
+		start(&res, "sparse_pread_65536", 16*SPARSE_STEPS);
+		for (i=0; i<16*SPARSE_STEPS; i++)
+			timed_pread(&res, na,
+				(pseudo_random() % (16*SPARSE_STEPS - 16))
+					*65536,
+				65536, buf);
+		report(&res);
+		close_data(na, dir_ni);
+	}
+}
+
+/*
+ *		Write and read a compressed file, one compression unit
+ *	(with the default cluster size) per request, with each
+ *	compression level, and get the space used by the file
+ *
+ *	The file is made of text, of random data, or of both in
+ *	alternate compression units, and the count of units which
+ *	were compressed, could not be compressed, or were skipped
+ *	as incompressible without trying is output on a "stats" line.
+ */
+
+static void compressed(ntfs_inode *dir_ni, char *buf)
+{
+	static const struct {
+		int level;
+		const char *name;
+	} levels[] = {
+		{ COMPRESSION_LEVEL_FAST, "fast" },
+		{ COMPRESSION_LEVEL_NORMAL, "normal" },
+		{ COMPRESSION_LEVEL_BEST, "best" },
+	} ;
+	static const char *kinds[] = { "text", "random", "mixed" } ;
+	struct RESULT res;
+	ntfs_volume *vol;
+	ntfs_inode *cdir_ni;
+	ntfs_attr *na;
+	char *rbuf;
+	char *random;
+	const char *data;
+	char wname[48];
+	char rname[48];
+	unsigned long units;
+	unsigned long failed;
+	unsigned long skipped;
+	unsigned long i;
+	unsigned int j;
+	unsigned int k;
+	int level;
+
+	na = (ntfs_attr*)NULL;
+		/* do not read into the data to write with next level */
+	rbuf = (char*)ntfs_malloc(65536);
+	random = (char*)ntfs_malloc(1048576);
+	if (random)
+		for (i=0; i<1048576; i++)
+			random[i] = pseudo_random();
+	cdir_ni = (rbuf && random
+		? create(dir_ni, "compressed", S_IFDIR)
+		: (ntfs_inode*)NULL);
+	if (cdir_ni) {
+		cdir_ni->flags |= FILE_ATTR_COMPRESSED;
+		NInoSetDirty(cdir_ni);
+		na = create_data(cdir_ni, "data");
+	}
+	if (na && !(na->data_flags & ATTR_COMPRESSION_MASK)) {
+		fprintf(stderr,"Compression is not possible on this"
+				" image\n");
+		close_data(na, cdir_ni);
+		na = (ntfs_attr*)NULL;
+	}
+	if (na) {
+		vol = na->ni->vol;
+		level = vol->compression_level;
+		for (j=0; (j<sizeof(kinds)/sizeof(kinds[0])) && na; j++) {
+			for (k=0; k<sizeof(levels)/sizeof(levels[0]); k++) {
+				/* the file is written again for each level */
+				if (ntfs_attr_truncate(na, 0)) {
+					fprintf(stderr,"Could not truncate the"
+						" compressed file : %s\n",
+						strerror(errno));
+					close_data(na, cdir_ni);
+					na = (ntfs_attr*)NULL;
+					break;
+				}
+				vol->compression_level = levels[k].level;
+				snprintf(wname, sizeof(wname),
+					"compress_pwrite_65536_%s_%s",
+					kinds[j], levels[k].name);
+				snprintf(rname, sizeof(rname),
+					"decompress_pread_65536_%s_%s",
+					kinds[j], levels[k].name);
+				units = ntfs_stats[STATS_COMPRESS_UNIT].count;
+				failed = ntfs_stats[STATS_COMPRESS_UNIT].errors;
+				skipped = ntfs_stats[STATS_COMPRESS_SKIP].count;
+				start(&res, wname, COMPRESSED_UNITS);
+				for (i=0; i<COMPRESSED_UNITS; i++) {
+					switch (j) {
+					case 0 :
+						data = buf;
+						break;
+					case 1 :
+						data = random;
+						break;
+					default :
+						data = (i & 1 ? random : buf);
+						break;
+					}
+					timed_pwrite(&res, na, i*65536, 65536,
+						&data[(i & 15)*65536]);
+				}
+				ntfs_attr_pclose(na);
+				res.stored = na->compressed_size;
+				report(&res);
+				failed = ntfs_stats[STATS_COMPRESS_UNIT].errors
+						- failed;
+				printf("stats=%s compress_unit=%lu"
+					" compress_failed=%lu"
+					" compress_skip=%lu\n", wname,
+					ntfs_stats[STATS_COMPRESS_UNIT].count
+						- units - failed,
+					failed,
+					ntfs_stats[STATS_COMPRESS_SKIP].count
+						- skipped);
+				start(&res, rname, COMPRESSED_UNITS);
+				for (i=0; i<COMPRESSED_UNITS; i++)
+					timed_pread(&res, na,
+						(pseudo_random()
+							% COMPRESSED_UNITS)
+							*65536,
+						65536, rbuf);
+				report(&res);
+			}
+		}
+		vol->compression_level = level;
+		if (na)
+			close_data(na, cdir_ni);
+	}
+	if (cdir_ni)
+		ntfs_inode_close_in_dir(cdir_ni, dir_ni);
+	free(random);
+	free(rbuf);
+}
+
+/*
+ *		Create many hard links to a file, then look them up
+ */
+
+static void hard_links(ntfs_volume *vol, ntfs_inode *dir_ni,
+			unsigned long links)
+{
+	struct RESULT res;
+	ntfs_inode *ni;
+	ntfs_inode *lni;
+	ntfschar *uname;
+	char name[32];
+	unsigned long i;
+	u64 begin;
+	int len;
+
+	ni = create(dir_ni, "target", S_IFREG);
+	if (ni) {
+		start(&res, "link", links);
+		for (i=0; i<links; i++) {
+			snprintf(name, sizeof(name), "l%06lu", i);
+			uname = (ntfschar*)NULL;
+			len = ntfs_mbstoucs(name, &uname);
+			begin = now_ns();
+			sample(&res, begin, ((len > 0)
+				&& !ntfs_link(ni, dir_ni, uname, len)
+					? 0 : -1));
+			free(uname);
+		}
+		report(&res);
+		ntfs_inode_close_in_dir(ni, dir_ni);
+		start(&res, "link_lookup", links);
+		for (i=0; i<links; i++) {
+			snprintf(name, sizeof(name), "l%06lu",
+				(unsigned long)(pseudo_random() % links));
+			begin = now_ns();
+			lni = ntfs_pathname_to_inode(vol, dir_ni, name);
+			if (lni)
+				ntfs_inode_close_in_dir(lni, dir_ni);
+			sample(&res, begin, (lni ? 0 : -1));
+		}
+		report(&res);
+	}
+}
+
+/*
+ *		Allocate runs of clusters, then free them
+ */
+
+static void cluster_alloc(ntfs_volume *vol, unsigned long runs)
+{
+	struct RESULT res;
+	runlist **rls;
+	unsigned long i;
+	u64 begin;
+
+	rls = (runlist**)ntfs_malloc(runs*sizeof(runlist*));
+	if (rls) {
+		start(&res, "cluster_alloc_16", runs);
+		for (i=0; i<runs; i++) {
+			begin = now_ns();
+			rls[i] = ntfs_cluster_alloc(vol, 0, 16, -1,
+						DATA_ZONE);
+			sample(&res, begin, (rls[i]
+				? 16 << vol->cluster_size_bits : -1));
+		}
+		report(&res);
+		start(&res, "cluster_free_16", runs);
+		for (i=0; i<runs; i++) {
+			if (rls[i]) {
+				begin = now_ns();
+				sample(&res, begin,
+					(ntfs_cluster_free_from_rl(vol, rls[i])
+					? -1 : 16 << vol->cluster_size_bits));
+				free(rls[i]);
+			}
+		}
+		report(&res);
+		free(rls);
+	}
+}
+
+/*
+ *		Read a user mapping file from memory
+ */
+
+struct MAPPING_TEXT {
+	const char *text;
+	size_t size;
+} ;
+
+static int mapping_read(void *fileid, char *buf, size_t size, off_t pos)
+{
+	const struct MAPPING_TEXT *mt = (const struct MAPPING_TEXT*)fileid;
+
+	if (pos >= (off_t)mt->size)
+		size = 0;
+	else
+		if ((pos + size) > mt->size)
+			size = mt->size - pos;
+	memcpy(buf, &mt->text[pos], size);
+	return (size);
+}
+
+/*
+ *		Load a user mapping file with many domain accounts, as
+ *	generated for a big organization, and translate between ids
+ *	and SIDs
+ */
+
+static void user_mapping(void)
+{
+	struct RESULT res;
+	struct MAPPING_TEXT mt;
+	struct MAPPING *mapping[MAPCOUNT];
+	struct MAPLIST *firstitem;
+	struct MAPLIST *item;
+	const SID *usid;
+	BIGSID defsid;
+	char *text;
+	unsigned long i;
+	uid_t uid;
+	u64 begin;
+	size_t size;
+
+	size = 64*(MAPPING_ENTRIES + 1);
+	text = (char*)ntfs_malloc(size);
+	if (text) {
+			/* half users, half groups, then the implicit pattern */
+		mt.size = 0;
+		for (i=0; i<MAPPING_ENTRIES; i++)
+			mt.size += snprintf(&text[mt.size], size - mt.size,
+				((i & 1) ? ":%lu:%s-%lu\n" : "%lu::%s-%lu\n"),
+				1000 + i/2, "S-1-5-21-3141592653-589793238"
+				"-462643383", ((i & 1) ? 600000 : 500000) + i/2);
+		mt.size += snprintf(&text[mt.size], size - mt.size,
+				"::%s-%d\n", "S-1-5-21-3141592653-589793238"
+				"-462643383", 10000);
+		mt.text = text;
+
+		start(&res, "usermap_load", 1);
+		begin = now_ns();
+		firstitem = ntfs_read_mapping(mapping_read, &mt);
+		mapping[MAPUSERS] = ntfs_do_user_mapping(firstitem);
+		mapping[MAPGROUPS] = ntfs_do_group_mapping(firstitem);
+		while (firstitem) {
+			item = firstitem->next;
+			free(firstitem);
+			firstitem = item;
+		}
+		sample(&res, begin, (mapping[MAPUSERS] && mapping[MAPGROUPS]
+				? (s64)mt.size : -1));
+		report(&res);
+
+		if (mapping[MAPUSERS]) {
+			start(&res, "uid_to_sid", MAPPING_LOOKUPS);
+			for (i=0; i<MAPPING_LOOKUPS; i++) {
+				uid = 1000 + pseudo_random()
+						% (MAPPING_ENTRIES/2);
+				begin = now_ns();
+				usid = ntfs_find_usid(mapping[MAPUSERS], uid,
+						(SID*)&defsid);
+				sample(&res, begin, (usid ? 0 : -1));
+			}
+			report(&res);
+
+			start(&res, "sid_to_uid", MAPPING_LOOKUPS);
+			for (i=0; i<MAPPING_LOOKUPS; i++) {
+				uid = 1000 + pseudo_random()
+						% (MAPPING_ENTRIES/2);
+				usid = ntfs_find_usid(mapping[MAPUSERS], uid,
+						(SID*)&defsid);
+				begin = now_ns();
+				sample(&res, begin, (usid
+				    && (ntfs_find_user(mapping[MAPUSERS],
+						usid) == uid) ? 0 : -1));
+			}
+			report(&res);
+		}
+		ntfs_free_mapping(mapping);
+		free(text);
+	}
+}
+
+/*
+ *		Delete the files of the big directory
+ *
+ *	The directory is closed by ntfs_delete(), so it has to be
+ *	opened again for each file, as the drivers do.
+ */
+
+static void delete_files(ntfs_volume *vol, MFT_REF dir_mref,
+			const MFT_REF *mrefs, unsigned long files)
+{
+	struct RESULT res;
+	ntfs_inode *ni;
+	ntfs_inode *dir_ni;
+	ntfschar *uname;
+	char name[32];
+	unsigned long i;
+	u64 begin;
+	int len;
+
+	start(&res, "delete", files);
+	for (i=0; i<files; i++) {
+		snprintf(name, sizeof(name), "f%06lu", i);
+		uname = (ntfschar*)NULL;
+		len = ntfs_mbstoucs(name, &uname);
+		ni = (mrefs[i] ? ntfs_inode_open(vol, mrefs[i])
+				: (ntfs_inode*)NULL);
+		dir_ni = ntfs_inode_open(vol, dir_mref);
+		begin = now_ns();
+			/* both inodes are closed by ntfs_delete() */
+		if (ni && dir_ni && (len > 0))
+			sample(&res, begin, (ntfs_delete(vol, (char*)NULL,
+				ni, dir_ni, uname, len) ? -1 : 0));
+		else {
+			ntfs_inode_close(ni);
+			ntfs_inode_close(dir_ni);
+			sample(&res, begin, -1);
+		}
+		free(uname);
+	}
+	report(&res);
+}
+
+/*
+ *		Library benchmarks, run on the image
+ *
+ *	Returns zero if the benchmarks could be run
+ */
+
+static int library_bench(const char *image, unsigned long files, char *buf)
+{
+	ntfs_volume *vol;
+	ntfs_inode *root_ni;
+	ntfs_inode *dir_ni;
+	MFT_REF *mrefs;
+	MFT_REF dir_mref;
+	int res;
+
+	res = 1;
+	vol = ntfs_mount(image, NTFS_MNT_EXCLUSIVE);
+	if (!vol)
+		fprintf(stderr,"Could not mount %s : %s\n",
+				image, strerror(errno));
+	else {
+		NVolSetCompression(vol);
+		ntfs_volume_get_free_space(vol);
+			/* an inode must not be open twice, close the root now */
+		root_ni = ntfs_inode_open(vol, FILE_root);
+		dir_ni = (root_ni
+			? create(root_ni, "bench", S_IFDIR)
+			: (ntfs_inode*)NULL);
+		if (root_ni)
+			ntfs_inode_close(root_ni);
+		if (dir_ni) {
+			mrefs = big_directory(vol, dir_ni, files);
+			data_access(dir_ni, buf);
+			fragmented(dir_ni, buf);
+			sparse(dir_ni, buf);
+			compressed(dir_ni, buf);
+			hard_links(vol, dir_ni,
+				(files < 1000 ? files : 1000));
+			cluster_alloc(vol, 256);
+			user_mapping();
+			dir_mref = dir_ni->mft_no;
+			ntfs_inode_close(dir_ni);
+			if (mrefs)
+				delete_files(vol, dir_mref, mrefs, files);
+			free(mrefs);
+			res = 0;
+		} else
+			fprintf(stderr,"Could not create the directory"
+				" \"bench\", the image should be"
+				" newly formatted\n");
+		if (ntfs_umount(vol, FALSE))
+			res = 1;
+	}
+	return (res);
+}
+
+/*
+ *		Run a command and wait for its completion
+ *
+ *	Returns zero if the command succeeded
+ */
+
+static int run(const char *argv[])
+{
+	pid_t pid;
+	int status;
+	int res;
+
+	res = -1;
+	fflush(stdout);
+	pid = fork();
+	if (!pid) {
+		execvp(argv[0], (char* const*)argv);
+		fprintf(stderr,"Could not run %s : %s\n",
+				argv[0], strerror(errno));
+		_exit(1);
+	}
+	if ((pid > 0)
+	    && (waitpid(pid, &status, 0) == pid)
+	    && WIFEXITED(status)
+	    && !WEXITSTATUS(status))
+		res = 0;
+	return (res);
+}
+
+/*
+ *		Drop the cached pages of a file, for the next reads to
+ *	be processed by the driver
+ */
+
+static void uncache(int fd)
+{
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+}
+
+/*
+ *		Drop the names and inodes cached by the kernel, so that
+ *	the driver is requested to forget all the nodes it knows
+ *	(only possible for root)
+ *
+ *	Returns zero if successful
+ */
+
+static int drop_nodes(void)
+{
+	int fd;
+	int res;
+
+	res = -1;
+	sync();
+	fd = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	if (fd >= 0) {
+		if (write(fd, "2", 1) == 1)
+			res = 0;
+		close(fd);
+	}
+	return (res);
+}
+
+/*
+ *		Sequential and random reads and writes to a big file
+ */
+
+static void fuse_data(const char *dir, char *buf)
+{
+	struct RESULT res;
+	char path[PATH_MAX];
+	unsigned long count;
+	unsigned long i;
+	u64 begin;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/seq", dir);
+	fd = open(path, O_CREAT | O_RDWR, 0644);
+	if (fd < 0)
+		fprintf(stderr,"Could not create %s : %s\n",
+				path, strerror(errno));
+	else {
+		count = SEQ_TOTAL/1048576;
+		start(&res, "seq_write_1048576", count);
+		for (i=0; i<count; i++) {
+			begin = now_ns();
+			sample(&res, begin, (pwrite(fd, buf, 1048576,
+				(off_t)i*1048576) == 1048576 ? 1048576 : -1));
+		}
+		report(&res);
+		start(&res, "fsync", 1);
+		begin = now_ns();
+		sample(&res, begin, (fsync(fd) ? -1 : 0));
+		report(&res);
+
+		uncache(fd);
+		start(&res, "seq_read_1048576", count);
+		for (i=0; i<count; i++) {
+			begin = now_ns();
+			sample(&res, begin, (pread(fd, buf, 1048576,
+				(off_t)i*1048576) == 1048576 ? 1048576 : -1));
+		}
+		report(&res);
+
+		count = SEQ_TOTAL/4096;
+		start(&res, "rand_write_4096", RANDOM_COUNT);
+		for (i=0; i<RANDOM_COUNT; i++) {
+			begin = now_ns();
+			sample(&res, begin, (pwrite(fd, buf, 4096,
+				(off_t)(pseudo_random() % count)*4096)
+					== 4096 ? 4096 : -1));
+		}
+		report(&res);
+		fsync(fd);
+
+		uncache(fd);
+		start(&res, "rand_read_4096", RANDOM_COUNT);
+		for (i=0; i<RANDOM_COUNT; i++) {
+			begin = now_ns();
+			sample(&res, begin, (pread(fd, buf, 4096,
+				(off_t)(pseudo_random() % count)*4096)
+					== 4096 ? 4096 : -1));
+		}
+		report(&res);
+		close(fd);
+	}
+}
+
+/*
+ *		Create, stat, list and unlink the files of a big directory
+ */
+
+static void fuse_metadata(const char *dir, unsigned long files)
+{
+	struct RESULT res;
+	struct stat st;
+	struct dirent *dp;
+	DIR *dirp;
+	char path[PATH_MAX];
+	unsigned long entries;
+	unsigned long i;
+	u64 begin;
+	int loop;
+	int fd;
+	int dfd;
+
+	snprintf(path, sizeof(path), "%s/meta", dir);
+	if (mkdir(path, 0755))
+		fprintf(stderr,"Could not create %s : %s\n",
+				path, strerror(errno));
+	else {
+		start(&res, "create", files);
+		for (i=0; i<files; i++) {
+			snprintf(path, sizeof(path), "%s/meta/f%06lu", dir, i);
+			begin = now_ns();
+			fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+			sample(&res, begin, ((fd >= 0) && !close(fd) ? 0 : -1));
+		}
+		report(&res);
+
+		start(&res, "stat", files);
+		for (i=0; i<files; i++) {
+			snprintf(path, sizeof(path), "%s/meta/f%06lu", dir,
+				(unsigned long)(pseudo_random() % files));
+			begin = now_ns();
+			sample(&res, begin, (stat(path, &st) ? -1 : 0));
+		}
+		report(&res);
+
+			/* the nodes are forgotten, then created again */
+		start(&res, "forget", 1);
+		begin = now_ns();
+		sample(&res, begin, drop_nodes());
+		report(&res);
+		start(&res, "stat_forgotten", files);
+		for (i=0; i<files; i++) {
+			snprintf(path, sizeof(path), "%s/meta/f%06lu", dir, i);
+			begin = now_ns();
+			sample(&res, begin, (stat(path, &st) ? -1 : 0));
+		}
+		report(&res);
+
+			/* as "ls -l" does */
+		snprintf(path, sizeof(path), "%s/meta", dir);
+		start(&res, "list_stat", READDIR_LOOPS);
+		for (loop=0; loop<READDIR_LOOPS; loop++) {
+			entries = 0;
+			begin = now_ns();
+			dirp = opendir(path);
+			if (dirp) {
+				dfd = dirfd(dirp);
+				while ((dp = readdir(dirp)))
+					if (!fstatat(dfd, dp->d_name, &st,
+						    AT_SYMLINK_NOFOLLOW))
+						entries++;
+				closedir(dirp);
+			}
+				/* "." and ".." are also listed */
+			sample(&res, begin, (entries >= files ? 0 : -1));
+		}
+		report(&res);
+
+		start(&res, "unlink", files);
+		for (i=0; i<files; i++) {
+			snprintf(path, sizeof(path), "%s/meta/f%06lu", dir, i);
+			begin = now_ns();
+			sample(&res, begin, (unlink(path) ? -1 : 0));
+		}
+		report(&res);
+	}
+}
+
+/*
+ *		Write a tree of small text files, as when extracting
+ *	a source archive, then read them all
+ */
+
+static void fuse_tree(const char *dir, char *buf)
+{
+	struct RESULT res;
+	char path[PATH_MAX];
+	u32 sizes[TREE_FILES];
+	unsigned long i;
+	unsigned long j;
+	u64 begin;
+	ssize_t done;
+	u32 size;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/tree", dir);
+	if (mkdir(path, 0755))
+		fprintf(stderr,"Could not create %s : %s\n",
+				path, strerror(errno));
+	else {
+		for (j=0; j<TREE_FILES; j++)
+			sizes[j] = pseudo_random() % 32768 + 1;
+		start(&res, "tree_write", TREE_DIRS*(TREE_FILES + 1));
+		for (i=0; i<TREE_DIRS; i++) {
+			snprintf(path, sizeof(path), "%s/tree/d%03lu", dir, i);
+			begin = now_ns();
+			sample(&res, begin, (mkdir(path, 0755) ? -1 : 0));
+			for (j=0; j<TREE_FILES; j++) {
+				snprintf(path, sizeof(path),
+					"%s/tree/d%03lu/f%03lu.c", dir, i, j);
+				size = sizes[j];
+				begin = now_ns();
+				fd = open(path, O_CREAT | O_EXCL | O_WRONLY,
+						0644);
+				done = (fd >= 0 ? write(fd, buf, size) : -1);
+				if ((fd >= 0) && close(fd))
+					done = -1;
+				sample(&res, begin, (done == (ssize_t)size
+						? size : -1));
+			}
+		}
+		report(&res);
+		sync();
+
+		for (i=0; i<TREE_DIRS; i++)
+			for (j=0; j<TREE_FILES; j++) {
+				snprintf(path, sizeof(path),
+					"%s/tree/d%03lu/f%03lu.c", dir, i, j);
+				fd = open(path, O_RDONLY);
+				if (fd >= 0) {
+					uncache(fd);
+					close(fd);
+				}
+			}
+		start(&res, "small_read", TREE_DIRS*TREE_FILES);
+		for (i=0; i<TREE_DIRS; i++)
+			for (j=0; j<TREE_FILES; j++) {
+				snprintf(path, sizeof(path),
+					"%s/tree/d%03lu/f%03lu.c", dir, i, j);
+				begin = now_ns();
+				fd = open(path, O_RDONLY);
+				done = (fd >= 0 ? read(fd, buf, 1048576) : -1);
+				if ((fd >= 0) && close(fd))
+					done = -1;
+				sample(&res, begin, (done == (ssize_t)sizes[j]
+						? done : -1));
+			}
+		report(&res);
+	}
+}
+
+/*
+ *		Walk the tree of small files and get the attributes
+ *	of every file, as "find -type f" does
+ *
+ *	When run as root, the walk is done in a child process switched
+ *	to an unprivileged user with supplementary groups, so that with
+ *	mount options enforcing permissions in the driver (such as "acl")
+ *	the checks for files owned by another user go through the groups
+ *	of the requester.
+ */
+
+static void fuse_find(const char *dir)
+{
+	struct RESULT res;
+	struct stat st;
+	struct dirent *dp;
+	struct dirent *fp;
+	DIR *dirp;
+	DIR *subp;
+	char path[PATH_MAX];
+	gid_t groups[FIND_GROUPS];
+	unsigned long files;
+	BOOL child;
+	pid_t pid;
+	u64 begin;
+	int status;
+	int loop;
+	int i;
+
+	pid = 0;
+	child = FALSE;
+	if (!geteuid()) {
+		fflush(stdout);
+		pid = fork();
+		if (!pid) {
+			child = TRUE;
+			for (i=0; i<FIND_GROUPS; i++)
+				groups[i] = FIND_UID - FIND_GROUPS + i;
+			if (setgroups(FIND_GROUPS, groups)
+			    || setgid(FIND_UID)
+			    || setuid(FIND_UID)) {
+				fprintf(stderr,"Could not switch to user %d :"
+					" %s\n", FIND_UID, strerror(errno));
+				_exit(1);
+			}
+		}
+	}
+	if (!pid) {
+		snprintf(path, sizeof(path), "%s/tree", dir);
+		start(&res, "find", READDIR_LOOPS);
+		for (loop=0; loop<READDIR_LOOPS; loop++) {
+			files = 0;
+			begin = now_ns();
+			dirp = opendir(path);
+			while (dirp && (dp = readdir(dirp))) {
+				if (dp->d_name[0] == '.')
+					continue;
+				snprintf(path, sizeof(path), "%s/tree/%s",
+					dir, dp->d_name);
+				subp = opendir(path);
+				while (subp && (fp = readdir(subp)))
+					if (!fstatat(dirfd(subp), fp->d_name,
+						&st, AT_SYMLINK_NOFOLLOW)
+					    && S_ISREG(st.st_mode))
+						files++;
+				if (subp)
+					closedir(subp);
+			}
+			if (dirp)
+				closedir(dirp);
+			snprintf(path, sizeof(path), "%s/tree", dir);
+			sample(&res, begin,
+				(files == TREE_DIRS*TREE_FILES ? 0 : -1));
+		}
+		report(&res);
+		if (child)
+			_exit(0);
+	} else
+		if (pid > 0)
+			waitpid(pid, &status, 0);
+		else
+			fprintf(stderr,"Could not fork : %s\n",
+					strerror(errno));
+}
+
+/*
+ *		End-to-end benchmarks, run through a driver
+ *
+ *	The image is mounted by the driver, which is detached when
+ *	the mount is done, the benchmarks are run on the mounted file
+ *	system, and the image is unmounted (the time to unmount is
+ *	shown, as it includes writing the data still in caches).
+ *
+ *	Returns zero if the benchmarks could be run
+ */
+
+static int fuse_bench(const char *driver, const char *options,
+			const char *image, const char *mountpoint,
+			unsigned long files, char *buf)
+{
+	struct RESULT umnt;
+	struct stat st;
+	const char *argv[6];
+	char dir[PATH_MAX/2];	/* leaving space for names within */
+	dev_t dev;
+	u64 begin;
+	int res;
+
+	res = 1;
+	argv[0] = driver;
+	argv[1] = image;
+	argv[2] = mountpoint;
+	argv[3] = (options ? "-o" : (const char*)NULL);
+	argv[4] = options;
+	argv[5] = (const char*)NULL;
+	if (stat(mountpoint, &st))
+		fprintf(stderr,"Could not access %s : %s\n",
+				mountpoint, strerror(errno));
+	else {
+		dev = st.st_dev;
+		if (run(argv)
+		    || stat(mountpoint, &st)
+		    || (st.st_dev == dev))
+			fprintf(stderr,"Could not mount %s on %s\n",
+					image, mountpoint);
+		else {
+			printf("run driver=%s options=%s files=%lu\n",
+				driver, (options ? options : ""), files);
+			if ((snprintf(dir, sizeof(dir), "%s/bench",
+					mountpoint) >= (int)sizeof(dir))
+			    || mkdir(dir, 0755))
+				fprintf(stderr,"Could not create the"
+					" directory \"bench\", the image"
+					" should be newly formatted\n");
+			else {
+				fuse_data(dir, buf);
+				fuse_metadata(dir, files);
+				fuse_tree(dir, buf);
+				fuse_find(dir);
+				res = 0;
+			}
+			argv[0] = (geteuid() ? "fusermount" : "umount");
+			argv[1] = (geteuid() ? "-u" : mountpoint);
+			argv[2] = (geteuid() ? mountpoint : (const char*)NULL);
+			argv[3] = (const char*)NULL;
+			start(&umnt, "unmount", 1);
+			begin = now_ns();
+			if (run(argv)) {
+				fprintf(stderr,"Could not unmount %s\n",
+						mountpoint);
+				sample(&umnt, begin, -1);
+				res = 1;
+			} else
+				sample(&umnt, begin, 0);
+			report(&umnt);
+		}
+	}
+	return (res);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *driver;
+	const char *options;
+	char *buf;
+	unsigned long files;
+	int res;
+	int c;
+
+	res = 1;
+	files = DEFAULT_FILES;
+	driver = options = (const char*)NULL;
+	while ((c = getopt(argc, argv, "d:n:o:")) != -1) {
+		switch (c) {
+		case 'd' :
+			driver = optarg;
+			break;
+		case 'n' :
+			files = strtoul(optarg, (char**)NULL, 10);
+			break;
+		case 'o' :
+			options = optarg;
+			break;
+		default :
+			files = 0;
+			break;
+		}
+	}
+	if (!files
+	    || (!driver && (optind != (argc - 1)))
+	    || (driver && (optind != (argc - 2)))
+	    || (options && !driver))
+		usage();
+	else {
+		buf = (char*)ntfs_malloc(1048576);
+		if (buf) {
+			fill_text(buf, 1048576);
+			if (driver)
+				res = fuse_bench(driver, options,
+					argv[optind], argv[optind + 1],
+					files, buf);
+			else
+				res = library_bench(argv[optind], files, buf);
+			free(buf);
+		}
+	}
+	return (res);
+}
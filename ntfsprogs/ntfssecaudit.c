@@ -1833,9 +1833,11 @@ static int do_default_mapping(struct MAPPING *mapping[],
 				usermapping->sid = sid;
 				usermapping->xid = 0;
 				usermapping->next = (struct MAPPING*)NULL;
+				usermapping->index = (struct MAPPING_INDEX*)NULL;
 				groupmapping->sid = sid;
 				groupmapping->xid = 0;
 				groupmapping->next = (struct MAPPING*)NULL;
+				groupmapping->index = (struct MAPPING_INDEX*)NULL;
 				mapping[MAPUSERS] = usermapping;
 				mapping[MAPGROUPS] = groupmapping;
 				res = 0;
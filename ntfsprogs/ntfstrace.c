@@ -0,0 +1,405 @@
+/*
+ *		Analyze the traces recorded by ntfs-3g
+ *
+ *	The traces are dumped by ntfs-3g or lowntfs-3g when mounted
+ *	with the option "trace=file" (see trace.c in libntfs-3g).
+ *	This tool summarizes the latencies of every kind of event,
+ *	splits the time spent by the fuse requests between device
+ *	accesses and other processing, and shows how the device and
+ *	the files are accessed (sizes and sequentiality).
+ */
+
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#define TRACEVERSION "1.0.0"
+#define SIZE_BUCKETS 24
+
+#include "config.h"
+
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+
+#include "types.h"
+#include "trace.h"
+
+struct EVENT_SUMMARY {
+	unsigned long count;
+	unsigned long errors;
+	u64 bytes;
+	u64 total_us;
+	u32 *durations;		/* for getting percentiles */
+	u64 device_us;		/* device time, for fuse events */
+} ;
+
+struct IO_PATTERN {
+	unsigned long count;
+	unsigned long sequential;
+	u64 bytes;
+	unsigned long sizes[SIZE_BUCKETS];
+} ;
+
+struct TRACE {
+	struct NTFS_TRACE_HEADER header;
+	char (*names)[NTFS_TRACE_NAME_LTH];
+	struct NTFS_TRACE_RECORD *records;
+} ;
+
+static void usage(void)
+{
+	fprintf(stderr,"ntfstrace version %s\n",TRACEVERSION);
+	fprintf(stderr,"Usage : ntfstrace [-l] trace-file\n");
+	fprintf(stderr,"   -l : list all the records\n");
+}
+
+/*
+ *		Load a trace file
+ *
+ *	Returns zero if successful
+ */
+
+static int load(struct TRACE *trace, const char *path)
+{
+	FILE *f;
+	size_t namesz;
+	int res;
+
+	res = -1;
+	trace->names = NULL;
+	trace->records = (struct NTFS_TRACE_RECORD*)NULL;
+	f = fopen(path, "rb");
+	if (!f)
+		fprintf(stderr,"Could not open %s : %s\n",
+				path, strerror(errno));
+	else {
+		if (fread(&trace->header, sizeof(trace->header), 1, f) != 1)
+			fprintf(stderr,"%s is not a trace file\n",path);
+		else if (trace->header.magic != NTFS_TRACE_MAGIC)
+			fprintf(stderr,"%s is not a trace file, or it was"
+				" made on a computer with another"
+				" endianness\n", path);
+		else if ((trace->header.version != NTFS_TRACE_VERSION)
+		    || (trace->header.record_size
+				!= sizeof(struct NTFS_TRACE_RECORD))
+		    || (trace->header.events > NTFS_TRACE_EVENTS))
+			fprintf(stderr,"Unsupported version of trace file\n");
+		else {
+			namesz = (size_t)trace->header.events
+					* NTFS_TRACE_NAME_LTH;
+			trace->names = calloc(NTFS_TRACE_EVENTS,
+					NTFS_TRACE_NAME_LTH);
+			trace->records = (struct NTFS_TRACE_RECORD*)malloc(
+				(trace->header.count + 1)
+					* sizeof(struct NTFS_TRACE_RECORD));
+			if (!trace->names || !trace->records)
+				fprintf(stderr,"Not enough memory\n");
+			else if ((fread(trace->names, namesz, 1, f) != 1)
+			    || (fread(trace->records,
+					sizeof(struct NTFS_TRACE_RECORD),
+					trace->header.count, f)
+						!= trace->header.count))
+				fprintf(stderr,"Truncated trace file\n");
+			else
+				res = 0;
+		}
+		fclose(f);
+	}
+	return (res);
+}
+
+static const char *event_name(const struct TRACE *trace, int event)
+{
+	static char name[NTFS_TRACE_NAME_LTH + 1];
+
+	if ((event < NTFS_TRACE_EVENTS) && trace->names[event][0]) {
+		memcpy(name, trace->names[event], NTFS_TRACE_NAME_LTH);
+		name[NTFS_TRACE_NAME_LTH] = 0;
+	} else
+		snprintf(name, sizeof(name), "event%d", event);
+	return (name);
+}
+
+static void list(const struct TRACE *trace)
+{
+	const struct NTFS_TRACE_RECORD *rec;
+	u32 i;
+
+	printf("%-10s %-8s %-16s %10s %12s %8s %10s %8s\n",
+		"stamp", "request", "event", "inode", "offset",
+		"size", "result", "us");
+	for (i=0; i<trace->header.count; i++) {
+		rec = &trace->records[i];
+		printf("%10llu %8lu %-16s %10llu %12lld %8lu %10lld %8lu\n",
+			(unsigned long long)rec->stamp,
+			(unsigned long)rec->request,
+			event_name(trace, rec->event),
+			(unsigned long long)rec->inode,
+			(long long)rec->offset,
+			(unsigned long)rec->size,
+			(long long)rec->result,
+			(unsigned long)rec->duration);
+	}
+}
+
+static int compare_durations(const void *p1, const void *p2)
+{
+	u32 d1 = *(const u32*)p1;
+	u32 d2 = *(const u32*)p2;
+
+	return (d1 < d2 ? -1 : (d1 > d2 ? 1 : 0));
+}
+
+/*
+ *		Show the latencies of every kind of event
+ *
+ *	For fuse requests, the time spent in device accesses while
+ *	processing the request is also shown, device events being
+ *	related to the fuse request active when they were recorded.
+ */
+
+static int latencies(const struct TRACE *trace)
+{
+	struct EVENT_SUMMARY *sum;
+	struct EVENT_SUMMARY *s;
+	const struct NTFS_TRACE_RECORD *rec;
+	u64 pending_us;
+	u32 request;
+	u32 i;
+	int ev;
+	int res;
+
+	res = -1;
+	sum = (struct EVENT_SUMMARY*)calloc(NTFS_TRACE_EVENTS,
+				sizeof(struct EVENT_SUMMARY));
+	if (sum) {
+		res = 0;
+		for (ev=0; ev<NTFS_TRACE_EVENTS; ev++) {
+			sum[ev].durations = (u32*)malloc((trace->header.count
+						+ 1)*sizeof(u32));
+			if (!sum[ev].durations)
+				res = -1;
+		}
+	}
+	if (!res) {
+		pending_us = 0;
+		request = 0;
+		for (i=0; i<trace->header.count; i++) {
+			rec = &trace->records[i];
+			if (rec->event >= NTFS_TRACE_EVENTS)
+				continue;
+			s = &sum[rec->event];
+			s->durations[s->count++] = rec->duration;
+			if (rec->result < 0)
+				s->errors++;
+			else
+				s->bytes += rec->result;
+			s->total_us += rec->duration;
+			if (rec->request != request) {
+				pending_us = 0;
+				request = rec->request;
+			}
+				/* fuse events are recorded when completed */
+			if ((rec->event == TRACE_DEVICE_READ)
+			    || (rec->event == TRACE_DEVICE_WRITE))
+				pending_us += rec->duration;
+			else if (rec->event >= TRACE_FUSE) {
+				s->device_us += pending_us;
+				pending_us = 0;
+			}
+		}
+		printf("%-16s %8s %6s %12s %10s %8s %8s %8s %8s %8s\n",
+			"event", "count", "errors", "bytes", "total us",
+			"avg us", "p50 us", "p99 us", "max us", "device%");
+		for (ev=0; ev<NTFS_TRACE_EVENTS; ev++) {
+			s = &sum[ev];
+			if (!s->count)
+				continue;
+			qsort(s->durations, s->count, sizeof(u32),
+					compare_durations);
+			printf("%-16s %8lu %6lu %12llu %10llu %8llu %8lu %8lu"
+				" %8lu", event_name(trace, ev),
+				s->count, s->errors,
+				(unsigned long long)s->bytes,
+				(unsigned long long)s->total_us,
+				(unsigned long long)(s->total_us/s->count),
+				(unsigned long)s->durations[s->count/2],
+				(unsigned long)s->durations[
+					(s->count*99)/100],
+				(unsigned long)s->durations[s->count - 1]);
+			if ((ev >= TRACE_FUSE) && s->total_us)
+				printf(" %7d%%\n", (int)((s->device_us*100)
+						/ s->total_us));
+			else
+				printf(" %8s\n", "-");
+		}
+	} else
+		fprintf(stderr,"Not enough memory\n");
+	if (sum) {
+		for (ev=0; ev<NTFS_TRACE_EVENTS; ev++)
+			free(sum[ev].durations);
+		free(sum);
+	}
+	return (res);
+}
+
+static void account_io(struct IO_PATTERN *io, s64 offset, u32 size,
+			s64 *next)
+{
+	int n;
+
+	io->count++;
+	io->bytes += size;
+	if (offset == *next)
+		io->sequential++;
+	*next = offset + size;
+	n = 0;
+	while ((n < (SIZE_BUCKETS - 1)) && (size >> (n + 1)))
+		n++;
+	io->sizes[n]++;
+}
+
+static void show_io(const char *title, const struct IO_PATTERN *io)
+{
+	int n;
+
+	if (io->count) {
+		printf("%-16s %8lu requests %12llu bytes, %lu%% sequential,"
+			" average %llu bytes\n", title, io->count,
+			(unsigned long long)io->bytes,
+			(io->sequential*100)/io->count,
+			(unsigned long long)(io->bytes/io->count));
+		for (n=0; n<SIZE_BUCKETS; n++)
+			if (io->sizes[n]) {
+				if (n < (SIZE_BUCKETS - 1))
+					printf("%16s %10lu of %lu to %lu bytes\n",
+						"", io->sizes[n], 1UL << n,
+						(2UL << n) - 1);
+				else
+					printf("%16s %10lu of %lu bytes or more\n",
+						"", io->sizes[n], 1UL << n);
+			}
+	}
+}
+
+/*
+ *		Show how the device and the files are accessed
+ *
+ *	An access is sequential when it starts where the previous
+ *	one of the same kind ended (for files, the previous one on the
+ *	same inode while no other inode was accessed).
+ */
+
+static void patterns(const struct TRACE *trace)
+{
+	struct IO_PATTERN devread, devwrite, fileread, filewrite;
+	const struct NTFS_TRACE_RECORD *rec;
+	s64 next_devread, next_devwrite, next_fileread, next_filewrite;
+	u64 read_inode, write_inode;
+	u32 i;
+
+	memset(&devread, 0, sizeof(devread));
+	memset(&devwrite, 0, sizeof(devwrite));
+	memset(&fileread, 0, sizeof(fileread));
+	memset(&filewrite, 0, sizeof(filewrite));
+	next_devread = next_devwrite = -1;
+	next_fileread = next_filewrite = -1;
+	read_inode = write_inode = 0;
+	for (i=0; i<trace->header.count; i++) {
+		rec = &trace->records[i];
+		switch (rec->event) {
+		case TRACE_DEVICE_READ :
+			account_io(&devread, rec->offset, rec->size,
+					&next_devread);
+			break;
+		case TRACE_DEVICE_WRITE :
+			account_io(&devwrite, rec->offset, rec->size,
+					&next_devwrite);
+			break;
+		case TRACE_ATTR_PREAD :
+			if (rec->inode != read_inode)
+				next_fileread = -1;
+			read_inode = rec->inode;
+			account_io(&fileread, rec->offset, rec->size,
+					&next_fileread);
+			break;
+		case TRACE_ATTR_PWRITE :
+			if (rec->inode != write_inode)
+				next_filewrite = -1;
+			write_inode = rec->inode;
+			account_io(&filewrite, rec->offset, rec->size,
+					&next_filewrite);
+			break;
+		default :
+			break;
+		}
+	}
+	show_io("device reads", &devread);
+	show_io("device writes", &devwrite);
+	show_io("file reads", &fileread);
+	show_io("file writes", &filewrite);
+}
+
+int main(int argc, char *argv[])
+{
+	struct TRACE trace;
+	const char *path;
+	int listing;
+	int res;
+
+	res = 1;
+	listing = (argc == 3) && !strcmp(argv[1], "-l");
+	if ((argc == 2) && (argv[1][0] != '-'))
+		path = argv[1];
+	else if (listing)
+		path = argv[2];
+	else
+		path = (const char*)NULL;
+	if (!path)
+		usage();
+	else {
+		if (!load(&trace, path)) {
+			printf("%lu records",
+				(unsigned long)trace.header.count);
+			if (trace.header.lost)
+				printf(", %lu older ones were lost",
+					(unsigned long)trace.header.lost);
+			printf("\n\n");
+			if (listing) {
+				list(&trace);
+				printf("\n");
+			}
+			if (!latencies(&trace)) {
+				printf("\n");
+				patterns(&trace);
+				res = 0;
+			}
+		}
+		free(trace.names);
+		free(trace.records);
+	}
+	return (res);
+}
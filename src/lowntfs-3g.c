@@ -60,6 +60,7 @@
 #include <locale.h>
 #endif
 #include <signal.h>
+#include <pthread.h>
 #ifdef HAVE_LIMITS_H
 #include <limits.h>
 #endif
@@ -110,6 +111,8 @@
 #include "misc.h"
 #include "ioctl.h"
 #include "plugin.h"
+#include "stats.h"
+#include "trace.h"
 
 #include "ntfs-3g_common.h"
 
@@ -192,23 +195,22 @@ typedef enum {
 	FSTYPE_FUSEBLK
 } fuse_fstype;
 
-typedef struct fill_item {
-	struct fill_item *next;
-	size_t bufsize;
-	size_t off;
-	char buf[0];
-} ntfs_fuse_fill_item_t;
-
 typedef struct fill_context {
-	struct fill_item *first;
-	struct fill_item *last;
 #ifndef DISABLE_PLUGINS
 	u64 fh;
 #endif /* DISABLE_PLUGINS */
-	off_t off;
+	char *buf;
+	size_t bufsize;
+	size_t off;
+	s64 skip; /* position of the entry to skip (plugins) */
+	s64 first; /* offset of the first entry to insert */
+	s64 count; /* offset of the last entry inserted or passed over */
+	s64 last; /* offset of the last entry returned */
+	int last_len;
+	ntfschar last_name[NTFS_MAX_NAME_LEN]; /* name of last entry returned */
+	BOOL bykey; /* resuming after the last name returned */
 	fuse_req_t req;
 	fuse_ino_t ino;
-	BOOL filled;
 } ntfs_fuse_fill_context_t;
 
 struct open_file {
@@ -218,6 +220,10 @@ struct open_file {
 	fuse_ino_t ino;
 	fuse_ino_t parent;
 	int state;
+	char *dabuf; /* data appended and not written yet */
+	s64 dapos;
+	size_t dasize;
+	int daerr; /* error met when writing delayed data */
 #ifndef DISABLE_PLUGINS
 	struct fuse_file_info fi;
 #endif /* DISABLE_PLUGINS */
@@ -228,7 +234,9 @@ enum {
 	CLOSE_COMPRESSED = 2,
 	CLOSE_ENCRYPTED = 4,
 	CLOSE_DMTIME = 8,
-	CLOSE_REPARSE = 16
+	CLOSE_REPARSE = 16,
+	CLOSE_DELAYED = 32,
+	CLOSE_PREALLOC = 64
 };
 
 enum RM_TYPES {
@@ -441,6 +449,157 @@ static int ntfs_allowed_dir_access(struct SECURITY_CONTEXT *scx,
 
 #endif /* !KERNELPERMS | (POSIXACLS & !KERNELACLS) */
 
+/*
+ *		Counting and tracing the fuse operations
+ *
+ *	Requests are processed one at a time, so a single time
+ *	stamp is needed. The counters are registered to the library,
+ *	so that they can be read through the "system.ntfs_stats"
+ *	extended attribute, and they can be logged by sending
+ *	SIGUSR1. When the option "trace" is set, the requests are
+ *	also recorded into the trace ring, which is dumped on SIGUSR1
+ *	and when unmounting.
+ *
+ *	SIGUSR1 is waited for by a helper thread, as the dump may be
+ *	written to the mounted volume, which requires the requests
+ *	to be processed meanwhile. The records may be updated while
+ *	being dumped, which may only garble the latest ones.
+ */
+
+enum {
+	FOP_LOOKUP, FOP_GETATTR, FOP_READLINK, FOP_OPENDIR, FOP_READDIR,
+	FOP_RELEASEDIR, FOP_OPEN, FOP_RELEASE, FOP_READ, FOP_WRITE,
+	FOP_SETATTR, FOP_STATFS, FOP_CREATE, FOP_MKNOD, FOP_SYMLINK,
+	FOP_LINK, FOP_UNLINK, FOP_RENAME, FOP_MKDIR, FOP_RMDIR,
+	FOP_FSYNC, FOP_IOCTL, FOP_BMAP, FOP_ACCESS, FOP_LISTXATTR,
+	FOP_GETXATTR, FOP_SETXATTR, FOP_REMOVEXATTR, FOP_FLUSH, FOP_COUNT
+} ;
+
+static struct NTFS_STATS fuse_stats[FOP_COUNT] = {
+	{ "fuse_lookup" }, { "fuse_getattr" }, { "fuse_readlink" },
+	{ "fuse_opendir" }, { "fuse_readdir" }, { "fuse_releasedir" },
+	{ "fuse_open" }, { "fuse_release" }, { "fuse_read" },
+	{ "fuse_write" }, { "fuse_setattr" }, { "fuse_statfs" },
+	{ "fuse_create" }, { "fuse_mknod" }, { "fuse_symlink" },
+	{ "fuse_link" }, { "fuse_unlink" }, { "fuse_rename" },
+	{ "fuse_mkdir" }, { "fuse_rmdir" }, { "fuse_fsync" },
+	{ "fuse_ioctl" }, { "fuse_bmap" }, { "fuse_access" },
+	{ "fuse_listxattr" }, { "fuse_getxattr" }, { "fuse_setxattr" },
+	{ "fuse_removexattr" }, { "fuse_flush" },
+} ;
+
+static struct NTFS_STATS_TABLE fuse_stats_table = {
+	(struct NTFS_STATS_TABLE*)NULL, fuse_stats, FOP_COUNT
+} ;
+
+static s64 op_stamp;
+static u64 op_inode;
+static s64 op_offset;
+static u32 op_size;
+#ifndef FUSE_INTERNAL
+static u32 op_request;
+#endif
+static pthread_t stats_thread;
+static BOOL stats_waiting = FALSE;
+
+static void log_stats(void)
+{
+	char *text;
+	int size;
+	int len;
+
+	size = ntfs_stats_format((char*)NULL, 0) + NTFS_STATS_MARGIN;
+	text = (char*)ntfs_malloc(size + 1);
+	if (text) {
+		len = ntfs_stats_format(text, size);
+		text[len < size ? len : size] = 0;
+		ntfs_log_info("Operation statistics :\n%s", text);
+		free(text);
+	}
+}
+
+/*
+ *		Helper thread logging the statistics and dumping
+ *	the trace on SIGUSR1
+ */
+
+static void *stats_waiter(void *arg __attribute__((unused)))
+{
+	sigset_t set;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	while (!sigwait(&set, &sig)) {
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, (int*)NULL);
+		log_stats();
+		if (ctx->trace_path)
+			ntfs_trace_dump(ctx->trace_path);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, (int*)NULL);
+	}
+	return ((void*)NULL);
+}
+
+static void op_begin(fuse_req_t req, fuse_ino_t ino, s64 offset,
+			size_t size)
+{
+	op_inode = INODE(ino);
+	op_offset = offset;
+	op_size = size;
+#ifdef FUSE_INTERNAL
+	ntfs_trace_request((u32)fuse_req_unique(req));
+#else
+	ntfs_trace_request(++op_request);
+#endif
+	op_stamp = ntfs_stats_begin();
+}
+
+/*
+ *		Record the end of a fuse operation
+ *
+ *	@res is the count of bytes transferred (zero for operations
+ *	which do not transfer data) or a negative error code
+ */
+
+static void op_end(int op, s64 res)
+{
+	ntfs_stats_end(&fuse_stats[op], op_stamp, res);
+	ntfs_trace_record(TRACE_FUSE + op, op_inode, op_offset, op_size,
+			res, op_stamp);
+}
+
+static void setup_stats(void)
+{
+	sigset_t set;
+	int i;
+
+	ntfs_stats_register(&fuse_stats_table);
+	if (ctx->trace_path) {
+		for (i=0; i<FOP_COUNT; i++)
+			ntfs_trace_name(TRACE_FUSE + i, fuse_stats[i].name);
+		if (ntfs_trace_start(TRACE_RECORDS))
+			ntfs_log_perror("Could not start tracing");
+	}
+		/* the thread created inherits the blocked signal */
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	if (pthread_sigmask(SIG_BLOCK, &set, (sigset_t*)NULL)
+	    || pthread_create(&stats_thread, (pthread_attr_t*)NULL,
+			stats_waiter, (void*)NULL))
+		ntfs_log_error("Could not set a thread for SIGUSR1\n");
+	else
+		stats_waiting = TRUE;
+}
+
+static void stop_stats(void)
+{
+	if (stats_waiting) {
+		pthread_cancel(stats_thread);
+		pthread_join(stats_thread, (void**)NULL);
+		stats_waiting = FALSE;
+	}
+}
+
 /**
  * ntfs_fuse_statfs - return information about mounted NTFS volume
  * @path:	ignored (but fuse requires it)
@@ -460,13 +619,14 @@ static int ntfs_allowed_dir_access(struct SECURITY_CONTEXT *scx,
  */
 
 static void ntfs_fuse_statfs(fuse_req_t req,
-			fuse_ino_t ino __attribute__((unused)))
+			fuse_ino_t ino)
 {
 	struct statvfs sfs;
 	s64 size;
 	int delta_bits;
 	ntfs_volume *vol;
 
+	op_begin(req, ino, 0, 0);
 	vol = ctx->vol;
 	if (vol) {
 	/* 
@@ -485,8 +645,13 @@ static void ntfs_fuse_statfs(fuse_req_t req,
 	 */
 		sfs.f_blocks = vol->nr_clusters;
 
-	/* Free blocks available for all and for non-privileged processes. */
-		size = vol->free_clusters;
+	/*
+	 * Free blocks available for all and for non-privileged processes,
+	 * excluding the space needed by the delayed data.
+	 */
+		size = vol->free_clusters
+			- ((ctx->delayed_total + vol->cluster_size - 1)
+				>> vol->cluster_size_bits);
 		if (size < 0)
 			size = 0;
 		sfs.f_bavail = sfs.f_bfree = size;
@@ -509,10 +674,12 @@ static void ntfs_fuse_statfs(fuse_req_t req,
 
 	/* Maximum length of filenames. */
 		sfs.f_namemax = NTFS_MAX_NAME_LEN;
+		op_end(FOP_STATFS, 0);
 		fuse_reply_statfs(req, &sfs);
-	} else
+	} else {
+		op_end(FOP_STATFS, -ENODEV);
 		fuse_reply_err(req, ENODEV);
-
+	}
 }
 
 static void set_fuse_error(int *err)
@@ -521,6 +688,151 @@ static void set_fuse_error(int *err)
 		*err = -errno;
 }
 
+/*
+ *		Delayed allocation of appended data
+ *
+ *	When the option delay_alloc is set, data appended to a file
+ *	opened for writing is kept in memory until the file is closed
+ *	or synced, or until the data is needed by another operation on
+ *	the file, or the buffer is full. All the appended data is then
+ *	written by a single ntfs_attr_pwrite(), so that the clusters
+ *	are allocated in a single request and the runlist is only
+ *	updated once.
+ *
+ *	The inode must not be open while its delayed data is written
+ *	by flush_file() or flush_delayed(), a second opening would
+ *	not be coherent with the first one.
+ */
+
+static int write_delayed(struct open_file *of, ntfs_attr *na)
+{
+	s64 written;
+	s64 total;
+	int res;
+
+	res = 0;
+	total = 0;
+	do {
+		written = ntfs_attr_pwrite(na, of->dapos + total,
+				of->dasize - total, of->dabuf + total);
+		if (written > 0)
+			total += written;
+	} while ((written > 0) && (total < (s64)of->dasize));
+	if (written <= 0)
+		res = (errno ? -errno : -EIO);
+	else
+		set_archive(na->ni);
+		/* on error, the data which could not be written is lost */
+	ctx->delayed_total -= of->dasize;
+	of->dasize = 0;
+	return (res);
+}
+
+static int flush_file(struct open_file *of)
+{
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	int res;
+
+	ni = ntfs_inode_open(ctx->vol, INODE(of->ino));
+	if (ni) {
+		na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+		if (na) {
+			res = write_delayed(of, na);
+			ntfs_attr_close(na);
+		} else
+			res = -errno;
+		if (ntfs_inode_close(ni))
+			set_fuse_error(&res);
+	} else
+		res = -errno;
+	ctx->delayed_total -= of->dasize;
+	of->dasize = 0;
+		/* keep the error for reporting on next sync or close */
+	if (res) {
+		ntfs_log_error("Could not write delayed data to inode %lld"
+				" : %s\n", (long long)INODE(of->ino),
+				strerror(-res));
+		if (!of->daerr)
+			of->daerr = res;
+	}
+	return (res);
+}
+
+/*
+ *		Write the delayed data of an inode (or of all inodes if
+ *	ino is zero), except the one appended through a designated file
+ *	descriptor.
+ *
+ *	Returns zero if successful or the first error met
+ */
+
+static int flush_delayed(fuse_ino_t ino, struct open_file *except)
+{
+	struct open_file *of;
+	int res;
+	int err;
+
+	res = 0;
+	if (ctx->delayed_total) {
+		for (of=ctx->open_files; of; of=of->next) {
+			if (of->dasize
+			    && (of != except)
+			    && (!ino || (of->ino == ino))) {
+				err = flush_file(of);
+				if (err && !res)
+					res = err;
+			}
+		}
+	}
+	return (res);
+}
+
+/*
+ *		Append data to the delayed data of a file descriptor
+ *
+ *	Returns the size appended,
+ *		zero if the data has to be written immediately
+ *		or a negative error code if delayed data could not be written
+ */
+
+static int delay_write(struct open_file *of, ntfs_attr *na,
+			const char *buf, size_t size, off_t offset)
+{
+	int res;
+
+	res = 0;
+		/*
+		 * not contiguous, too big, or too much delayed data for
+		 * all files : write the previous data, so that the data
+		 * which cannot be delayed is not written beyond a gap
+		 */
+	if (of->dasize
+	    && ((offset != (of->dapos + (s64)of->dasize))
+		|| ((s64)(of->dasize + size) > ctx->delay_alloc)
+		|| ((ctx->delayed_total + (s64)size)
+			> DELAY_ALLOC_FILES*ctx->delay_alloc)))
+		res = write_delayed(of, na);
+	if (!res
+	    && (offset == (of->dasize
+			? of->dapos + (s64)of->dasize : na->data_size))
+	    && ((s64)(of->dasize + size) <= ctx->delay_alloc)
+	    && ((ctx->delayed_total + (s64)size)
+			<= DELAY_ALLOC_FILES*ctx->delay_alloc)) {
+		if (!of->dabuf)
+			of->dabuf = (char*)ntfs_malloc(ctx->delay_alloc);
+		if (of->dabuf) {
+			if (!of->dasize)
+				of->dapos = offset;
+			memcpy(&of->dabuf[of->dasize], buf, size);
+			of->dasize += size;
+			ctx->delayed_total += size;
+			res = size;
+		}
+	}
+	return (res);
+}
+
 #if 0 && (defined(__APPLE__) || defined(__DARWIN__)) /* Unfinished. */
 static int ntfs_macfuse_getxtimes(const char *org_path,
 		struct timespec *bkuptime, struct timespec *crtime)
@@ -987,15 +1299,21 @@ static void ntfs_fuse_getattr(fuse_req_t req, fuse_ino_t ino,
 	struct stat stbuf;
 	struct SECURITY_CONTEXT security;
 
-	ni = ntfs_inode_open(ctx->vol, INODE(ino));
-	if (!ni)
-		res = -errno;
-	else {
-		ntfs_fuse_fill_security_context(req, &security);
-		res = ntfs_fuse_getstat(&security, ni, &stbuf);
-		if (ntfs_inode_close(ni))
-			set_fuse_error(&res);
+	op_begin(req, ino, 0, 0);
+		/* the size is not known if delayed data was not written */
+	res = flush_delayed(ino, (struct open_file*)NULL);
+	if (!res) {
+		ni = ntfs_inode_open(ctx->vol, INODE(ino));
+		if (!ni)
+			res = -errno;
+		else {
+			ntfs_fuse_fill_security_context(req, &security);
+			res = ntfs_fuse_getstat(&security, ni, &stbuf);
+			if (ntfs_inode_close(ni))
+				set_fuse_error(&res);
+		}
 	}
+	op_end(FOP_GETATTR, res);
 	if (!res)
 		fuse_reply_attr(req, &stbuf, ATTR_TIMEOUT);
 	else
@@ -1009,6 +1327,7 @@ static __inline__ BOOL ntfs_fuse_fillstat(struct SECURITY_CONTEXT *scx,
 	BOOL ok = FALSE;
 
 	pentry->ino = MREF(iref);
+	flush_delayed(pentry->ino, (struct open_file*)NULL);
 	ni = ntfs_inode_open(ctx->vol, pentry->ino);
 	if (ni) {
 		if (!ntfs_fuse_getstat(scx, ni, &pentry->attr)) {
@@ -1033,6 +1352,7 @@ static void ntfs_fuse_lookup(fuse_req_t req, fuse_ino_t parent,
 	u64 iref;
 	BOOL ok = FALSE;
 
+	op_begin(req, parent, 0, 0);
 	if (strlen(name) < 256) {
 		dir_ni = ntfs_inode_open(ctx->vol, INODE(parent));
 		if (dir_ni) {
@@ -1065,9 +1385,21 @@ static void ntfs_fuse_lookup(fuse_req_t req, fuse_ino_t parent,
 		}
 	} else
 		errno = ENAMETOOLONG;
-	if (!ok)
-		fuse_reply_err(req, errno);
-	else
+	op_end(FOP_LOOKUP, (ok ? 0 : -errno));
+	if (!ok) {
+			/*
+			 * Let the kernel remember a missing name for as
+			 * long as it would remember an existing one, it
+			 * is told about the names created through it.
+			 */
+		if ((errno == ENOENT) && (ENTRY_TIMEOUT > 0)) {
+			memset(&entry, 0, sizeof(entry));
+			entry.ino = 0;
+			entry.entry_timeout = ENTRY_TIMEOUT;
+			fuse_reply_entry(req, &entry);
+		} else
+			fuse_reply_err(req, errno);
+	} else
 		fuse_reply_entry(req, &entry);
 }
 
@@ -1122,6 +1454,7 @@ static void ntfs_fuse_readlink(fuse_req_t req, fuse_ino_t ino)
 	char *buf = (char*)NULL;
 	int res = 0;
 
+	op_begin(req, ino, 0, 0);
 	/* Get inode. */
 	ni = ntfs_inode_open(ctx->vol, INODE(ino));
 	if (!ni) {
@@ -1219,6 +1552,7 @@ exit:
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&res);
 
+	op_end(FOP_READLINK, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -1226,20 +1560,44 @@ exit:
 	free(buf);
 }
 
+/*
+ *		Insert a directory entry into the reply buffer
+ *
+ *	When reading from the index, the offset of an entry is its rank
+ *	in the listing, and the name of the last entry inserted is kept
+ *	for resuming after it. When reading through a plugin, the offset
+ *	is the position of the entry plus one, which is where the plugin
+ *	has to resume, the entry itself being skipped.
+ *
+ *	Returns 0 if the entry was inserted or skipped,
+ *		1 if the buffer is full (the entry will be inserted
+ *			on next call),
+ *		-1 if there was an error.
+ */
+
 static int ntfs_fuse_filler(ntfs_fuse_fill_context_t *fill_ctx,
 		const ntfschar *name, const int name_len, const int name_type,
-		const s64 pos __attribute__((unused)), const MFT_REF mref,
+		const s64 pos, const MFT_REF mref,
 		const unsigned dt_type __attribute__((unused)))
 {
 	char *filename = NULL;
 	int ret = 0;
 	int filenamelen = -1;
 	size_t sz;
-	ntfs_fuse_fill_item_t *current;
-	ntfs_fuse_fill_item_t *newone;
+	s64 next;
 
-	if (name_type == FILE_NAME_DOS)
+	if ((name_type == FILE_NAME_DOS) || (pos == fill_ctx->skip))
 		return 0;
+	if (fill_ctx->bykey) {
+			/* pass over the entries already returned */
+		if (((fill_ctx->count + 1) < fill_ctx->first)
+		    && (MREF(mref) > 1)) {
+			fill_ctx->count++;
+			return 0;
+		}
+		next = fill_ctx->count + 1;
+	} else
+		next = pos + 1;
         
 	if ((filenamelen = ntfs_ucstombs(name, name_len, &filename, 0)) < 0) {
 		ntfs_log_perror("Filename decoding failed (inode %llu)",
@@ -1330,42 +1688,29 @@ static int ntfs_fuse_filler(ntfs_fuse_fill_context_t *fill_ctx,
 		}
 #endif /* defined(__APPLE__) || defined(__DARWIN__), ... */
 	
-		current = fill_ctx->last;
 		sz = fuse_add_direntry(fill_ctx->req,
-				&current->buf[current->off],
-				current->bufsize - current->off,
-				filename, &st, current->off + fill_ctx->off);
-		if (!sz || ((current->off + sz) > current->bufsize)) {
-			newone = (ntfs_fuse_fill_item_t*)ntfs_malloc
-				(sizeof(ntfs_fuse_fill_item_t)
-				     + current->bufsize);
-			if (newone) {
-				newone->off = 0;
-				newone->bufsize = current->bufsize;
-				newone->next = (ntfs_fuse_fill_item_t*)NULL;
-				current->next = newone;
-				fill_ctx->last = newone;
-				fill_ctx->off += current->off;
-				current = newone;
-				sz = fuse_add_direntry(fill_ctx->req,
-					current->buf,
-					current->bufsize - current->off,
-					filename, &st, fill_ctx->off);
-				if (!sz) {
-					errno = EIO;
-					ntfs_log_error("Could not add a"
-						" directory entry (inode %lld)\n",
-						(unsigned long long)MREF(mref));
-				}
-			} else {
-				sz = 0;
-				errno = ENOMEM;
+				&fill_ctx->buf[fill_ctx->off],
+				fill_ctx->bufsize - fill_ctx->off,
+				filename, &st, next);
+		if (sz && ((fill_ctx->off + sz) <= fill_ctx->bufsize)) {
+			fill_ctx->off += sz;
+			if (fill_ctx->bykey) {
+				fill_ctx->count = next;
+				fill_ctx->last = next;
+				fill_ctx->last_len = name_len;
+				memcpy(fill_ctx->last_name, name,
+						name_len*sizeof(ntfschar));
 			}
-		}
-		if (sz) {
-			current->off += sz;
 		} else {
-			ret = -1;
+			if (fill_ctx->off)
+				ret = 1;
+			else {
+				errno = EIO;
+				ntfs_log_error("Could not add a directory"
+					" entry (inode %lld)\n",
+					(unsigned long long)MREF(mref));
+				ret = -1;
+			}
 		}
 	}
         
@@ -1382,6 +1727,7 @@ static void ntfs_fuse_opendir(fuse_req_t req, fuse_ino_t ino,
 	ntfs_fuse_fill_context_t *fill;
 	struct SECURITY_CONTEXT security;
 
+	op_begin(req, ino, 0, 0);
 	ni = ntfs_inode_open(ctx->vol, INODE(ino));
 	if (ni) {
 		if (ntfs_fuse_fill_security_context(req, &security)) {
@@ -1414,11 +1760,8 @@ static void ntfs_fuse_opendir(fuse_req_t req, fuse_ino_t ino,
 			if (!fill)
 				res = -errno;
 			else {
-				fill->first = fill->last
-					= (ntfs_fuse_fill_item_t*)NULL;
-				fill->filled = FALSE;
 				fill->ino = ino;
-				fill->off = 0;
+				fill->last = 0;
 #ifndef DISABLE_PLUGINS
 				fill->fh = fi->fh;
 #endif /* DISABLE_PLUGINS */
@@ -1427,6 +1770,7 @@ static void ntfs_fuse_opendir(fuse_req_t req, fuse_ino_t ino,
 		}
 	} else
 		res = -errno;
+	op_end(FOP_OPENDIR, res);
 	if (!res)
 		fuse_reply_open(req, fi);
 	else
@@ -1435,7 +1779,7 @@ static void ntfs_fuse_opendir(fuse_req_t req, fuse_ino_t ino,
 
 
 static void ntfs_fuse_releasedir(fuse_req_t req,
-			fuse_ino_t ino __attribute__((unused)),
+			fuse_ino_t ino,
 			struct fuse_file_info *fi)
 {
 #ifndef DISABLE_PLUGINS
@@ -1443,19 +1787,12 @@ static void ntfs_fuse_releasedir(fuse_req_t req,
 	ntfs_inode *ni;
 #endif /* DISABLE_PLUGINS */
 	ntfs_fuse_fill_context_t *fill;
-	ntfs_fuse_fill_item_t *current;
 	int res;
 
+	op_begin(req, ino, 0, 0);
 	res = 0;
 	fill = (ntfs_fuse_fill_context_t*)(long)fi->fh;
 	if (fill && (fill->ino == ino)) {
-			/* make sure to clear results */
-		current = fill->first;
-		while (current) {
-			current = current->next;
-			free(fill->first);
-			fill->first = current;
-		}
 #ifndef DISABLE_PLUGINS
 		if (fill->fh) {
 			const plugin_operations_t *ops;
@@ -1478,122 +1815,111 @@ static void ntfs_fuse_releasedir(fuse_req_t req,
 		fill->ino = 0;
 		free(fill);
 	}
+	op_end(FOP_RELEASEDIR, res);
 	fuse_reply_err(req, -res);
 }
 
+/*
+ *		Return the next directory entries which fit into a buffer
+ *
+ *	The directory is not read beyond what is needed for filling the
+ *	buffer, so that the memory used does not depend on the size of
+ *	the directory. The entries are read in collation order, and the
+ *	offset got from the kernel is normally the one of the last entry
+ *	returned, whose name is kept, so that reading resumes after
+ *	this name even if entries were deleted or index blocks split
+ *	meanwhile. For another offset (after a seekdir()), the entries
+ *	are read again from the beginning up to the offset.
+ */
+
 static void ntfs_fuse_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
-			off_t off __attribute__((unused)),
-			struct fuse_file_info *fi __attribute__((unused)))
+			off_t off, struct fuse_file_info *fi)
 {
 #ifndef DISABLE_PLUGINS
 	struct fuse_file_info ufi;
 #endif /* DISABLE_PLUGINS */
-	ntfs_fuse_fill_item_t *first;
-	ntfs_fuse_fill_item_t *current;
 	ntfs_fuse_fill_context_t *fill;
 	ntfs_inode *ni;
-	s64 pos = 0;
+#ifndef DISABLE_PLUGINS
+	s64 pos;
+#endif /* DISABLE_PLUGINS */
 	int err = 0;
+	int res;
+	size_t done = 0;
 
+	op_begin(req, ino, off, size);
 	fill = (ntfs_fuse_fill_context_t*)(long)fi->fh;
 	if (fill && (fill->ino == ino)) {
-		if (fill->filled && !off) {
-			/* Rewinding : make sure to clear existing results */   
-			current = fill->first;
-			while (current) {
-				current = current->next;
-				free(fill->first);
-				fill->first = current;
-			}
-			fill->filled = FALSE;
-		}
-		if (!fill->filled) {
-				/* initial call : build the full list */
-			current = (ntfs_fuse_fill_item_t*)NULL;
-			first = (ntfs_fuse_fill_item_t*)ntfs_malloc
-				(sizeof(ntfs_fuse_fill_item_t) + size);
-			if (first) {
-				first->bufsize = size;
-				first->off = 0;
-				first->next = (ntfs_fuse_fill_item_t*)NULL;
-				fill->req = req;
-				fill->first = first;
-				fill->last = first;
-				fill->off = 0;
-				ni = ntfs_inode_open(ctx->vol,INODE(ino));
-				if (!ni)
-					err = -errno;
-				else {
-					if (ni->flags
-						& FILE_ATTR_REPARSE_POINT) {
+		fill->buf = (char*)ntfs_malloc(size);
+		if (fill->buf) {
+			fill->bufsize = size;
+			fill->off = 0;
+			fill->req = req;
+			fill->skip = -1;
+			fill->first = off + 1;
+			ni = ntfs_inode_open(ctx->vol,INODE(ino));
+			if (!ni)
+				err = -errno;
+			else {
+				if (ni->flags & FILE_ATTR_REPARSE_POINT) {
 #ifndef DISABLE_PLUGINS
-						const plugin_operations_t *ops;
-						REPARSE_POINT *reparse;
+					const plugin_operations_t *ops;
+					REPARSE_POINT *reparse;
 
-						memcpy(&ufi, fi, sizeof(ufi));
-						ufi.fh = fill->fh;
-						err = CALL_REPARSE_PLUGIN(ni,
-							readdir, &pos, fill,
-							(ntfs_filldir_t)
-							ntfs_fuse_filler, &ufi);
+						/* resume on the last entry */
+					fill->bykey = FALSE;
+					pos = (off > 0 ? off - 1 : 0);
+					fill->skip = (off > 0 ? pos : -1);
+					memcpy(&ufi, fi, sizeof(ufi));
+					ufi.fh = fill->fh;
+					err = CALL_REPARSE_PLUGIN(ni,
+						readdir, &pos, fill,
+						(ntfs_filldir_t)
+						ntfs_fuse_filler, &ufi);
 #else /* DISABLE_PLUGINS */
-						err = -EOPNOTSUPP;
+					err = -EOPNOTSUPP;
 #endif /* DISABLE_PLUGINS */
-					} else {
-						if (ntfs_readdir(ni, &pos, fill,
+				} else {
+					fill->bykey = TRUE;
+					if (off && (off == fill->last)) {
+						/* resume after the last name */
+						fill->count = off;
+						res = ntfs_readdir_after(ni,
+							fill->last_name,
+							fill->last_len, fill,
 							(ntfs_filldir_t)
-							ntfs_fuse_filler))
-							err = -errno;
+							ntfs_fuse_filler);
+					} else {
+						fill->count = 0;
+						res = ntfs_readdir_after(ni,
+							(ntfschar*)NULL, 0,
+							fill, (ntfs_filldir_t)
+							ntfs_fuse_filler);
 					}
-					fill->filled = TRUE;
+					if (res)
+						err = -errno;
+				}
+				if (!off)
 					ntfs_fuse_update_times(ni,
 						NTFS_UPDATE_ATIME);
-					if (ntfs_inode_close(ni))
-						set_fuse_error(&err);
-				}
-				if (!err) {
-					off_t loc = 0;
-				/*
-				 * In some circumstances, the queue gets
-				 * reinitialized by releasedir() + opendir(),
-				 * apparently always on end of partial buffer.
-				 * Files may be missing or duplicated.
-				 */
-					while (first
-					    && ((loc < off) || !first->off)) {
-						loc += first->off;
-						fill->first = first->next;
-						free(first);
-						first = fill->first;
-					}
-					current = first;
-				}
-			} else
-				err = -errno;
-		} else {
-			/* subsequent call : return next non-empty buffer */
-			current = fill->first;
-			while (current && !current->off) {
-				current = current->next;
-				free(fill->first);
-				fill->first = current;
+				if (ntfs_inode_close(ni))
+					set_fuse_error(&err);
 			}
-		}
-		if (!err) {
-			if (current) {
-				fuse_reply_buf(req, current->buf, current->off);
-				fill->first = current->next;
-				free(current);
-			} else {
-				fuse_reply_buf(req, (char*)NULL, 0);
+			if (!err) {
+				done = fill->off;
+				fuse_reply_buf(req, fill->buf, fill->off);
 				/* reply sent, now must exit with no error */
 			}
-		}
+			free(fill->buf);
+			fill->buf = (char*)NULL;
+		} else
+			err = -errno;
 	} else {
 		errno = EIO;
 		err = -errno;
 		ntfs_log_error("Uninitialized fuse_readdir()\n");
 	}
+	op_end(FOP_READDIR, (err ? err : (s64)done));
 	if (err)
 		fuse_reply_err(req, -err);
 }
@@ -1611,6 +1937,7 @@ static void ntfs_fuse_open(fuse_req_t req, fuse_ino_t ino,
 	struct SECURITY_CONTEXT security;
 #endif
 
+	op_begin(req, ino, 0, 0);
 	ni = ntfs_inode_open(ctx->vol, INODE(ino));
 	if (ni) {
 		if (!(ni->flags & FILE_ATTR_REPARSE_POINT)) {
@@ -1665,6 +1992,14 @@ static void ntfs_fuse_open(fuse_req_t req, fuse_ino_t ino,
 		/* mark a future need to update the mtime */
 			if (ctx->dmtime)
 				state |= CLOSE_DMTIME;
+		/* appended data may be delayed if not compressed */
+			if (ctx->delay_alloc
+			    && !(state & (CLOSE_COMPRESSED | CLOSE_ENCRYPTED)))
+				state |= CLOSE_DELAYED;
+		/* mark a future need to free the space reserved */
+			if (ctx->prealloc
+			    && !(state & (CLOSE_COMPRESSED | CLOSE_ENCRYPTED)))
+				state |= CLOSE_PREALLOC;
 			/* deny opening metadata files for writing */
 			if (ino < FILE_first_user)
 				res = -EPERM;
@@ -1681,6 +2016,9 @@ close:
 			of->parent = 0;
 			of->ino = ino;
 			of->state = state;
+			of->dabuf = (char*)NULL;
+			of->dasize = 0;
+			of->daerr = 0;
 #ifndef DISABLE_PLUGINS
 			memcpy(&of->fi, fi, sizeof(struct fuse_file_info));
 #endif /* DISABLE_PLUGINS */
@@ -1692,6 +2030,7 @@ close:
 			fi->fh = (long)of;
 		}
 	}
+	op_end(FOP_OPEN, res);
 	if (res)
 		fuse_reply_err(req, -res);
 	else
@@ -1709,10 +2048,10 @@ static void ntfs_fuse_read(fuse_req_t req, fuse_ino_t ino, size_t size,
 	s64 total = 0;
 	s64 max_read;
 
-	if (!size) {
-		res = 0;
+	op_begin(req, ino, offset, size);
+	res = flush_delayed(ino, (struct open_file*)NULL);
+	if (res || !size)
 		goto exit;
-	}
 	buf = (char*)ntfs_malloc(size);
 	if (!buf) {
 		res = -errno;
@@ -1785,6 +2124,7 @@ exit:
 		ntfs_attr_close(na);
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&res);
+	op_end(FOP_READ, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -1794,12 +2134,17 @@ exit:
 
 static void ntfs_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf, 
 			size_t size, off_t offset,
-			struct fuse_file_info *fi __attribute__((unused)))
+			struct fuse_file_info *fi)
 {
 	ntfs_inode *ni = NULL;
 	ntfs_attr *na = NULL;
+	struct open_file *of;
 	int res, total = 0;
 
+	op_begin(req, ino, offset, size);
+	of = (struct open_file*)(long)fi->fh;
+		/* data delayed through other descriptors has to be written */
+	flush_delayed(ino, of);
 	ni = ntfs_inode_open(ctx->vol, INODE(ino));
 	if (!ni) {
 		res = -errno;
@@ -1809,9 +2154,7 @@ static void ntfs_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 #ifndef DISABLE_PLUGINS
 		const plugin_operations_t *ops;
 		REPARSE_POINT *reparse;
-		struct open_file *of;
 
-		of = (struct open_file*)(long)fi->fh;
 		res = CALL_REPARSE_PLUGIN(ni, write, buf, size, offset,
 								&of->fi);
 		if (res >= 0) {
@@ -1827,6 +2170,11 @@ static void ntfs_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		res = -errno;
 		goto exit;
 	}
+	if (of && (of->state & CLOSE_DELAYED)) {
+		res = delay_write(of, na, buf, size, offset);
+		if (res)
+			goto stamps;
+	}
 	while (size) {
 		s64 ret = ntfs_attr_pwrite(na, offset, size, buf + total);
 		if (ret <= 0) {
@@ -1838,9 +2186,7 @@ static void ntfs_fuse_write(fuse_req_t req, fuse_ino_t ino, const char *buf,
 		total  += ret;
 	}
 	res = total;
-#ifndef DISABLE_PLUGINS 
 stamps :
-#endif /* DISABLE_PLUGINS */
 	if ((res > 0)
 	    && (!ctx->dmtime
 		|| (sle64_to_cpu(ntfs_current_time())
@@ -1853,6 +2199,7 @@ exit:
 		set_archive(ni);
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&res);
+	op_end(FOP_WRITE, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -2218,10 +2565,11 @@ static void ntfs_fuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 	int res;
 	struct SECURITY_CONTEXT security;
 
-	res = 0;
+	op_begin(req, ino, 0, 0);
+	res = flush_delayed(ino, (struct open_file*)NULL);
 	ntfs_fuse_fill_security_context(req, &security);
 						/* no flags */
-	if (!(to_set
+	if (!res && !(to_set
 		    & (FUSE_SET_ATTR_MODE
 			| FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID
 			| FUSE_SET_ATTR_SIZE
@@ -2236,9 +2584,9 @@ static void ntfs_fuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 		}
 	}
 						/* some set of uid/gid/mode */
-	if (to_set
+	if (!res && (to_set
 		    & (FUSE_SET_ATTR_MODE
-			| FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+			| FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))) {
 		switch (to_set
 			    & (FUSE_SET_ATTR_MODE
 				| FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
@@ -2289,6 +2637,7 @@ static void ntfs_fuse_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
 		res = ntfs_fuse_utime(&security, ino, attr, &stbuf);
 #endif /* defined(HAVE_UTIMENSAT) & defined(FUSE_SET_ATTR_ATIME_NOW) */
 	}
+	op_end(FOP_SETATTR, res);
 	if (res)
 		fuse_reply_err(req, -res);
 	else
@@ -2304,6 +2653,7 @@ static void ntfs_fuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 	ntfs_inode *ni;
 	struct SECURITY_CONTEXT security;
 
+	op_begin(req, ino, 0, 0);
 	  /* JPA return unsupported if no user mapping has been defined */
 	if (!ntfs_fuse_fill_security_context(req, &security)) {
 		if (ctx->silent)
@@ -2328,6 +2678,7 @@ static void ntfs_fuse_access(fuse_req_t req, fuse_ino_t ino, int mask)
 				set_fuse_error(&res);
 		}
 	}
+	op_end(FOP_ACCESS, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -2492,6 +2843,12 @@ static int ntfs_fuse_create(fuse_req_t req, fuse_ino_t parent, const char *name,
 #endif /* HAVE_SETXATTR */
 			if (fi && ctx->dmtime)
 				state |= CLOSE_DMTIME;
+			if (fi && ctx->delay_alloc
+			    && !(state & (CLOSE_COMPRESSED | CLOSE_ENCRYPTED)))
+				state |= CLOSE_DELAYED;
+			if (fi && ctx->prealloc
+			    && !(state & (CLOSE_COMPRESSED | CLOSE_ENCRYPTED)))
+				state |= CLOSE_PREALLOC;
 			ntfs_inode_update_mbsname(dir_ni, name, ni->mft_no);
 			NInoSetDirty(ni);
 			e->ino = ni->mft_no;
@@ -2525,6 +2882,9 @@ exit:
 			of->parent = 0;
 			of->ino = e->ino;
 			of->state = state;
+			of->dabuf = (char*)NULL;
+			of->dasize = 0;
+			of->daerr = 0;
 			of->next = ctx->open_files;
 			of->previous = (struct open_file*)NULL;
 			if (ctx->open_files)
@@ -2543,8 +2903,10 @@ static void ntfs_fuse_create_file(fuse_req_t req, fuse_ino_t parent,
 	int res;
 	struct fuse_entry_param entry;
 
+	op_begin(req, parent, 0, 0);
 	res = ntfs_fuse_create(req, parent, name, mode & (S_IFMT | 07777),
 				0, &entry, NULL, fi);
+	op_end(FOP_CREATE, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -2557,8 +2919,10 @@ static void ntfs_fuse_mknod(fuse_req_t req, fuse_ino_t parent, const char *name,
 	int res;
 	struct fuse_entry_param e;
 
+	op_begin(req, parent, 0, 0);
 	res = ntfs_fuse_create(req, parent, name, mode & (S_IFMT | 07777),
 				rdev, &e,NULL,(struct fuse_file_info*)NULL);
+	op_end(FOP_MKNOD, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -2571,8 +2935,10 @@ static void ntfs_fuse_symlink(fuse_req_t req, const char *target,
 	int res;
 	struct fuse_entry_param entry;
 
+	op_begin(req, parent, 0, 0);
 	res = ntfs_fuse_create(req, parent, name, S_IFLNK, 0,
 			&entry, target, (struct fuse_file_info*)NULL);
+	op_end(FOP_SYMLINK, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -2677,7 +3043,10 @@ static void ntfs_fuse_link(fuse_req_t req, fuse_ino_t ino,
 	struct fuse_entry_param entry;
 	int res;
 
+	op_begin(req, ino, 0, 0);
+	flush_delayed(ino, (struct open_file*)NULL);
 	res = ntfs_fuse_newlink(req, ino, newparent, newname, &entry);
+	op_end(FOP_LINK, res);
 	if (res)
 		fuse_reply_err(req, -res);
 	else
@@ -2885,7 +3254,10 @@ static void ntfs_fuse_unlink(fuse_req_t req, fuse_ino_t parent,
 {
 	int res;
 
+	op_begin(req, parent, 0, 0);
+	flush_delayed(0, (struct open_file*)NULL);
 	res = ntfs_fuse_rm(req, parent, name, RM_LINK);
+	op_end(FOP_UNLINK, res);
 	if (res)
 		fuse_reply_err(req, -res);
 	else
@@ -3014,6 +3386,8 @@ static void ntfs_fuse_rename(fuse_req_t req, fuse_ino_t parent,
 	fuse_ino_t xino;
 	ntfs_inode *ni;
         
+	op_begin(req, parent, 0, 0);
+	flush_delayed(0, (struct open_file*)NULL);
 	ntfs_log_debug("rename: old: '%s'  new: '%s'\n", name, newname);
         
 	/*
@@ -3063,6 +3437,7 @@ static void ntfs_fuse_rename(fuse_req_t req, fuse_ino_t parent,
 			ntfs_fuse_rm(req, newparent, newname, RM_ANY);
 	}
 out:
+	op_end(FOP_RENAME, ret);
 	if (ret)
 		fuse_reply_err(req, -ret);
 	else
@@ -3076,13 +3451,23 @@ static void ntfs_fuse_release(fuse_req_t req, fuse_ino_t ino,
 	ntfs_attr *na = NULL;
 	struct open_file *of;
 	char ghostname[GHOSTLTH];
+	int daerr;
 	int res;
 
+	op_begin(req, ino, 0, 0);
 	of = (struct open_file*)(long)fi->fh;
+		/* write the delayed data, reporting former errors */
+	daerr = 0;
+	if (of && (of->state & CLOSE_DELAYED)) {
+		if (of->dasize)
+			flush_file(of);
+		daerr = of->daerr;
+	}
 	/* Only for marked descriptors there is something to do */
 	if (!of
 	    || !(of->state & (CLOSE_COMPRESSED | CLOSE_ENCRYPTED
-				| CLOSE_DMTIME | CLOSE_REPARSE))) {
+				| CLOSE_DMTIME | CLOSE_REPARSE
+				| CLOSE_PREALLOC))) {
 		res = 0;
 		goto out;
 	}
@@ -3114,6 +3499,8 @@ static void ntfs_fuse_release(fuse_req_t req, fuse_ino_t ino,
 	res = 0;
 	if (of->state & CLOSE_COMPRESSED)
 		res = ntfs_attr_pclose(na);
+	if ((of->state & CLOSE_PREALLOC) && ntfs_attr_trim(na))
+		res = -errno;
 #ifdef HAVE_SETXATTR	/* extended attributes interface required */
 	if (of->state & CLOSE_ENCRYPTED)
 		res = ntfs_efs_fixup_attribute(NULL, na);
@@ -3142,22 +3529,55 @@ out:
 			of->previous->next = of->next;
 		else
 			ctx->open_files = of->next;
+		free(of->dabuf);
 		free(of);
 	}
+	if (daerr && !res)
+		res = daerr;
+	op_end(FOP_RELEASE, res);
 	if (res)
 		fuse_reply_err(req, -res);
 	else
 		fuse_reply_err(req, 0);
 }
 
+/*
+ *		Flush a file descriptor when it is closed
+ *
+ *	The delayed data is written, and the first error met when
+ *	writing delayed data through this descriptor is reported to
+ *	close(), which is the last chance for it to be seen.
+ */
+
+static void ntfs_fuse_flush(fuse_req_t req, fuse_ino_t ino,
+			struct fuse_file_info *fi)
+{
+	struct open_file *of;
+	int res;
+
+	op_begin(req, ino, 0, 0);
+	res = 0;
+	of = (struct open_file*)(long)fi->fh;
+	if (of && (of->state & CLOSE_DELAYED)) {
+		if (of->dasize)
+			flush_file(of);
+		res = of->daerr;
+		of->daerr = 0;
+	}
+	op_end(FOP_FLUSH, res);
+	fuse_reply_err(req, -res);
+}
+
 static void ntfs_fuse_mkdir(fuse_req_t req, fuse_ino_t parent,
 		       const char *name, mode_t mode)
 {
 	int res;
 	struct fuse_entry_param entry;
 
+	op_begin(req, parent, 0, 0);
 	res = ntfs_fuse_create(req, parent, name, S_IFDIR | (mode & 07777),
 			0, &entry, (char*)NULL, (struct fuse_file_info*)NULL);
+	op_end(FOP_MKDIR, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -3168,7 +3588,9 @@ static void ntfs_fuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 {
 	int res;
 
+	op_begin(req, parent, 0, 0);
 	res = ntfs_fuse_rm(req, parent, name, RM_DIR);
+	op_end(FOP_RMDIR, res);
 	if (res)
 		fuse_reply_err(req, -res);
 	else
@@ -3176,20 +3598,34 @@ static void ntfs_fuse_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
 }
 
 static void ntfs_fuse_fsync(fuse_req_t req,
-			fuse_ino_t ino __attribute__((unused)),
+			fuse_ino_t ino,
 			int type __attribute__((unused)),
 			struct fuse_file_info *fi __attribute__((unused)))
 {
+	struct open_file *of;
+	int res;
+
+	op_begin(req, ino, 0, 0);
+	flush_delayed(0, (struct open_file*)NULL);
 		/* sync the full device */
-	if (ntfs_device_sync(ctx->vol->dev))
-		fuse_reply_err(req, errno);
+	if (ntfs_index_sync_deferred(ctx->vol, TRUE)
+	    || ntfs_device_sync(ctx->vol->dev))
+		res = -errno;
 	else
-		fuse_reply_err(req, 0);
+		res = 0;
+		/* report an error met when writing delayed data */
+	for (of=ctx->open_files; of && !res; of=of->next)
+		if ((of->ino == ino) && of->daerr) {
+			res = of->daerr;
+			of->daerr = 0;
+		}
+	op_end(FOP_FSYNC, res);
+	fuse_reply_err(req, -res);
 }
 
 #if defined(FUSE_INTERNAL) || (FUSE_VERSION >= 28)
 static void ntfs_fuse_ioctl(fuse_req_t req __attribute__((unused)),
-			fuse_ino_t ino __attribute__((unused)),
+			fuse_ino_t ino,
 			int cmd, void *arg,
 			struct fuse_file_info *fi __attribute__((unused)),
 			unsigned flags, const void *data,
@@ -3200,6 +3636,8 @@ static void ntfs_fuse_ioctl(fuse_req_t req __attribute__((unused)),
 	int bufsz;
 	int ret = 0;
 
+	op_begin(req, ino, 0, 0);
+	flush_delayed(ino, (struct open_file*)NULL);
 	if (flags & FUSE_IOCTL_COMPAT) {
 		ret = -ENOSYS;
 	} else {
@@ -3228,8 +3666,9 @@ static void ntfs_fuse_ioctl(fuse_req_t req __attribute__((unused)),
 		if (ntfs_inode_close (ni))
 			set_fuse_error(&ret);
 	}
-	if (ret)
 fail :
+	op_end(FOP_IOCTL, ret);
+	if (ret)
 		fuse_reply_err(req, -ret);
 	else
 		fuse_reply_ioctl(req, 0, buf, out_bufsz);
@@ -3248,6 +3687,8 @@ static void ntfs_fuse_bmap(fuse_req_t req, fuse_ino_t ino, size_t blocksize,
 	int ret = 0; 
 	int cl_per_bl = ctx->vol->cluster_size / blocksize;
 
+	op_begin(req, ino, vidx, blocksize);
+	flush_delayed(ino, (struct open_file*)NULL);
 	if (blocksize > ctx->vol->cluster_size) {
 		ret = -EINVAL;
 		goto done;
@@ -3285,6 +3726,7 @@ close_inode:
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&ret);
 done :
+	op_end(FOP_BMAP, ret);
 	if (ret < 0)
 		fuse_reply_err(req, -ret);
 	else
@@ -3470,6 +3912,7 @@ static void ntfs_fuse_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
 	struct SECURITY_CONTEXT security;
 #endif
 
+	op_begin(req, ino, 0, size);
 #if !KERNELPERMS | (POSIXACLS & !KERNELACLS)
 	ntfs_fuse_fill_security_context(req, &security);
 #endif
@@ -3516,6 +3959,7 @@ exit:
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&ret);
 out :
+	op_end(FOP_LISTXATTR, ret);
 	if (ret < 0)
 		fuse_reply_err(req, -ret);
 	else
@@ -3550,11 +3994,13 @@ static void ntfs_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 	int namespace;
 	struct SECURITY_CONTEXT security;
 
+	op_begin(req, ino, 0, size);
 #if defined(__APPLE__) || defined(__DARWIN__)
 	/* If the attribute is not a resource fork attribute and the position
 	 * parameter is non-zero, we return with EINVAL as requesting position
 	 * is not permitted for non-resource fork attributes. */
 	if (position && strcmp(name, XATTR_RESOURCEFORK_NAME)) {
+		op_end(FOP_GETXATTR, -EINVAL);
 		fuse_reply_err(req, EINVAL);
 		return;
 	}
@@ -3613,6 +4059,7 @@ static void ntfs_fuse_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 #endif
 		} else
 			res = -errno;
+		op_end(FOP_GETXATTR, res);
 		if (res < 0)
 			fuse_reply_err(req, -res);
 		else
@@ -3695,6 +4142,7 @@ exit:
 		set_fuse_error(&res);
 
 out :
+	op_end(FOP_GETXATTR, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -3731,12 +4179,14 @@ static void ntfs_fuse_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 	int namespace;
 	struct SECURITY_CONTEXT security;
 
+	op_begin(req, ino, 0, size);
 #if defined(__APPLE__) || defined(__DARWIN__)
 	/* If the attribute is not a resource fork attribute and the position
 	 * parameter is non-zero, we return with EINVAL as requesting position
 	 * is not permitted for non-resource fork attributes. */
 	is_resource_fork = strcmp(name, XATTR_RESOURCEFORK_NAME) ? FALSE : TRUE;
 	if (position && !is_resource_fork) {
+		op_end(FOP_SETXATTR, -EINVAL);
 		fuse_reply_err(req, EINVAL);
 		return;
 	}
@@ -3821,6 +4271,7 @@ static void ntfs_fuse_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
 		    && fuse_lowlevel_notify_inval_inode(ctx->fc, ino, -1, 0))
 			res = -errno;
 #endif
+		op_end(FOP_SETXATTR, res);
 		if (res < 0)
 			fuse_reply_err(req, -res);
 		else
@@ -3962,6 +4413,7 @@ exit:
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&res);
 out :
+	op_end(FOP_SETXATTR, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -3978,6 +4430,7 @@ static void ntfs_fuse_removexattr(fuse_req_t req, fuse_ino_t ino, const char *na
 	int namespace;
 	struct SECURITY_CONTEXT security;
 
+	op_begin(req, ino, 0, 0);
 	attr = ntfs_xattr_system_type(name,ctx->vol);
 	if (attr != XATTR_UNMAPPED) {
 		switch (attr) {
@@ -4071,6 +4524,7 @@ static void ntfs_fuse_removexattr(fuse_req_t req, fuse_ino_t ino, const char *na
 #endif
 			break;
 		}
+		op_end(FOP_REMOVEXATTR, res);
 		if (res < 0)
 			fuse_reply_err(req, -res);
 		else
@@ -4159,6 +4613,7 @@ exit:
 	if (ntfs_inode_close(ni))
 		set_fuse_error(&res);
 out :
+	op_end(FOP_REMOVEXATTR, res);
 	if (res < 0)
 		fuse_reply_err(req, -res);
 	else
@@ -4236,6 +4691,7 @@ static void ntfs_close(void)
 
 static void ntfs_fuse_destroy2(void *notused __attribute__((unused)))
 {
+	flush_delayed(0, (struct open_file*)NULL);
 	ntfs_close();
 }
 
@@ -4248,6 +4704,7 @@ static struct fuse_lowlevel_ops ntfs_3g_ops = {
 	.releasedir	= ntfs_fuse_releasedir,
 	.open		= ntfs_fuse_open,
 	.release	= ntfs_fuse_release,
+	.flush		= ntfs_fuse_flush,
 	.read		= ntfs_fuse_read,
 	.write		= ntfs_fuse_write,
 	.setattr	= ntfs_fuse_setattr,
@@ -4335,6 +4792,11 @@ static int ntfs_open(const char *device)
 		NVolSetCompression(ctx->vol);
 	else
 		NVolClearCompression(ctx->vol);
+	if (ctx->prealloc)
+		NVolSetPreallocate(ctx->vol);
+	if (ctx->defer_index)
+		NVolSetDeferIndex(ctx->vol);
+	ctx->vol->compression_level = ctx->compression_level;
 #ifdef HAVE_SETXATTR
 			/* archivers must see hidden files */
 	if (ctx->efs_raw)
@@ -4843,9 +5305,15 @@ int main(int argc, char *argv[])
 	if (permissions_mode)
 		ntfs_log_info("%s, configuration type %d\n",permissions_mode,
 			5 + POSIXACLS*6 - KERNELPERMS*3 + CACHEING);
+	setup_stats();
         
-	fuse_session_loop(se);
+	ntfs_fuse_loop(se, ctx->vol);
 	fuse_remove_signal_handlers(se);
+	stop_stats();
+	if (ctx->trace_path) {
+		ntfs_trace_dump(ctx->trace_path);
+		ntfs_trace_stop();
+	}
         
 	err = 0;
 
@@ -4855,6 +5323,7 @@ err_out:
 	ntfs_mount_error(opts.device, opts.mnt_point, err);
 	if (ctx->abs_mnt_point)
 		free(ctx->abs_mnt_point);
+	free(ctx->trace_path);
 #if defined(HAVE_SETXATTR) && defined(XATTR_MAPPINGS)
 	ntfs_xattr_free_mapping(xattr_mapping);
 #endif /* defined(HAVE_SETXATTR) && defined(XATTR_MAPPINGS) */
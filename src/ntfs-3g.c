@@ -108,6 +108,7 @@
 #include "misc.h"
 #include "ioctl.h"
 #include "plugin.h"
+#include "trace.h"
 
 #include "ntfs-3g_common.h"
 
@@ -170,7 +171,8 @@ enum {
 	CLOSE_COMPRESSED = 1,
 	CLOSE_ENCRYPTED = 2,
 	CLOSE_DMTIME = 4,
-	CLOSE_REPARSE = 8
+	CLOSE_REPARSE = 8,
+	CLOSE_PREALLOC = 16
 };
 
 static struct ntfs_options opts;
@@ -1537,6 +1539,10 @@ static int ntfs_fuse_open(const char *org_path,
 		/* mark a future need to update the mtime */
 			if (ctx->dmtime)
 				fi->fh |= CLOSE_DMTIME;
+		/* mark a future need to free the space reserved */
+			if (ctx->prealloc
+			    && !(na->data_flags & ATTR_COMPRESSION_MASK))
+				fi->fh |= CLOSE_PREALLOC;
 		/* deny opening metadata files for writing */
 			if (ni->mft_no < FILE_first_user)
 				res = -EPERM;
@@ -1776,6 +1782,8 @@ static int ntfs_fuse_release(const char *org_path,
 	res = 0;
 	if (fi->fh & CLOSE_COMPRESSED)
 		res = ntfs_attr_pclose(na);
+	if ((fi->fh & CLOSE_PREALLOC) && ntfs_attr_trim(na))
+		res = -errno;
 #ifdef HAVE_SETXATTR	/* extended attributes interface required */
 	if (fi->fh & CLOSE_ENCRYPTED)
 		res = ntfs_efs_fixup_attribute(NULL, na);
@@ -2222,6 +2230,9 @@ static int ntfs_fuse_create(const char *org_path, mode_t typemode, dev_t dev,
 			/* mark a need to update the mtime */
 			if (fi && ctx->dmtime)
 				fi->fh |= CLOSE_DMTIME;
+			if (fi && ctx->prealloc
+			    && !(ni->flags & FILE_ATTR_COMPRESSED))
+				fi->fh |= CLOSE_PREALLOC;
 			NInoSetDirty(ni);
 			/*
 			 * closing ni requires access to dir_ni to
@@ -2293,6 +2304,9 @@ static int ntfs_fuse_create_stream(const char *path,
 #endif /* HAVE_SETXATTR */
 		if (ctx->dmtime)
 			fi->fh |= CLOSE_DMTIME;
+		if (ctx->prealloc
+		    && !(ni->flags & FILE_ATTR_COMPRESSED))
+			fi->fh |= CLOSE_PREALLOC;
 	}
 
 	if (ntfs_inode_close(ni))
@@ -2909,7 +2923,9 @@ static int ntfs_fuse_fsync(const char *path __attribute__((unused)),
 	int ret;
 
 		/* sync the full device */
-	ret = ntfs_device_sync(ctx->vol->dev);
+	ret = ntfs_index_sync_deferred(ctx->vol, TRUE);
+	if (!ret)
+		ret = ntfs_device_sync(ctx->vol->dev);
 	if (ret)
 		ret = -errno;
 	return (ret);
@@ -4044,6 +4060,11 @@ static int ntfs_open(const char *device)
 		NVolSetCompression(ctx->vol);
 	else
 		NVolClearCompression(ctx->vol);
+	if (ctx->prealloc)
+		NVolSetPreallocate(ctx->vol);
+	if (ctx->defer_index)
+		NVolSetDeferIndex(ctx->vol);
+	ctx->vol->compression_level = ctx->compression_level;
 #ifdef HAVE_SETXATTR
 			/* archivers must see hidden files */
 	if (ctx->efs_raw)
@@ -4252,8 +4273,10 @@ static struct fuse *mount_fuse(char *parsed_options)
 		int len;
         
 		len = snprintf(buf, sizeof(buf), "-ouse_ino,kernel_cache"
-				",attr_timeout=%d,entry_timeout=%d",
-				(int)TIMEOUT_RO, (int)TIMEOUT_RO);
+				",attr_timeout=%d,entry_timeout=%d"
+				",negative_timeout=%d",
+				(int)TIMEOUT_RO, (int)TIMEOUT_RO,
+				(int)TIMEOUT_RO);
 		if ((len < 0)
 		    || (len >= (int)sizeof(buf))
 		    || (fuse_opt_add_arg(&args, buf) == -1))
@@ -4263,10 +4286,28 @@ static struct fuse *mount_fuse(char *parsed_options)
 		if (fuse_opt_add_arg(&args, "-ouse_ino,kernel_cache"
 				",attr_timeout=0") == -1)
 			goto err;
-#else
+#elif defined(__sun) && defined(__SVR4)
 		if (fuse_opt_add_arg(&args, "-ouse_ino,kernel_cache"
 				",attr_timeout=1") == -1)
 			goto err;
+#else
+		/*
+		 * Attributes can only be cached when the internal fuse
+		 * identifies the hard links by their inode number, which
+		 * cannot be done when the named streams are accessed
+		 * through paths, as they share the inode number of
+		 * their file.
+		 */
+#ifdef FUSE_INTERNAL
+		if (ctx->streams != NF_STREAMS_INTERFACE_WINDOWS) {
+			if (fuse_opt_add_arg(&args, "-ouse_ino,link_ino"
+					",kernel_cache,attr_timeout=1") == -1)
+				goto err;
+		} else
+#endif
+			if (fuse_opt_add_arg(&args, "-ouse_ino,kernel_cache"
+					",attr_timeout=0") == -1)
+				goto err;
 #endif
 	}
 	if (ctx->debug)
@@ -4570,8 +4611,15 @@ int main(int argc, char *argv[])
 	if ((ctx->vol->secure_flags & (1 << SECURITY_RAW))
 	    && !ctx->uid && ctx->gid)
 		ntfs_log_error("Warning : using problematic uid==0 and gid!=0\n");
+		/* only the library events are traced */
+	if (ctx->trace_path && ntfs_trace_start(TRACE_RECORDS))
+		ntfs_log_perror("Could not start tracing");
 	
-	fuse_loop(fh);
+	ntfs_fuse_loop(fuse_get_session(fh), ctx->vol);
+	if (ctx->trace_path) {
+		ntfs_trace_dump(ctx->trace_path);
+		ntfs_trace_stop();
+	}
 	
 	err = 0;
 
@@ -4581,6 +4629,7 @@ err_out:
 	ntfs_mount_error(opts.device, opts.mnt_point, err);
 	if (ctx->abs_mnt_point)
 		free(ctx->abs_mnt_point);
+	free(ctx->trace_path);
 #if defined(HAVE_SETXATTR) && defined(XATTR_MAPPINGS)
 	ntfs_xattr_free_mapping(xattr_mapping);
 #endif /* defined(HAVE_SETXATTR) && defined(XATTR_MAPPINGS) */
@@ -45,11 +45,15 @@
 #endif
 
 #include <getopt.h>
+#include <poll.h>
 #include <fuse.h>
+#include <fuse_lowlevel.h>
 
 #include "compat.h"
 #include "inode.h"
 #include "dir.h"
+#include "index.h"
+#include "compress.h"
 #include "security.h"
 #include "xattrs.h"
 #include "reparse.h"
@@ -85,6 +89,9 @@ const struct DEFOPTION optionlist[] = {
 	{ "atime", OPT_ATIME, FLGOPT_BOGUS },
 	{ "relatime", OPT_RELATIME, FLGOPT_BOGUS },
 	{ "delay_mtime", OPT_DMTIME, FLGOPT_DECIMAL | FLGOPT_OPTIONAL },
+	{ "delay_alloc", OPT_DELAY_ALLOC, FLGOPT_DECIMAL | FLGOPT_OPTIONAL },
+	{ "prealloc", OPT_PREALLOC, FLGOPT_BOGUS },
+	{ "defer_index", OPT_DEFER_INDEX, FLGOPT_BOGUS },
 	{ "rw", OPT_RW, FLGOPT_BOGUS },
 	{ "fake_rw", OPT_FAKE_RW, FLGOPT_BOGUS },
 	{ "fsname", OPT_FSNAME, FLGOPT_NOSUPPORT },
@@ -104,6 +111,7 @@ const struct DEFOPTION optionlist[] = {
 	{ "windows_names", OPT_WINDOWS_NAMES, FLGOPT_BOGUS },
 	{ "compression", OPT_COMPRESSION, FLGOPT_BOGUS },
 	{ "nocompression", OPT_NOCOMPRESSION, FLGOPT_BOGUS },
+	{ "compression_level", OPT_COMPRESSION_LEVEL, FLGOPT_DECIMAL },
 	{ "silent", OPT_SILENT, FLGOPT_BOGUS },
 	{ "recover", OPT_RECOVER, FLGOPT_BOGUS },
 	{ "norecover", OPT_NORECOVER, FLGOPT_BOGUS },
@@ -128,6 +136,7 @@ const struct DEFOPTION optionlist[] = {
 	{ "efs_raw", OPT_EFS_RAW, FLGOPT_BOGUS },
 	{ "posix_nlink", OPT_POSIX_NLINK, FLGOPT_BOGUS },
 	{ "special_files", OPT_SPECIAL_FILES, FLGOPT_STRING },
+	{ "trace", OPT_TRACE, FLGOPT_STRING },
 	{ (const char*)NULL, 0, 0 } /* end marker */
 } ;
 
@@ -311,6 +320,17 @@ char *parse_mount_options(ntfs_fuse_context_t *ctx,
 					intarg = DEFAULT_DMTIME;
 				ctx->dmtime = intarg*10000000LL;
 				break;
+			case OPT_DELAY_ALLOC :
+				if (!intarg)
+					intarg = DEFAULT_DELAY_ALLOC;
+				ctx->delay_alloc = intarg*1024LL;
+				break;
+			case OPT_PREALLOC :
+				ctx->prealloc = TRUE;
+				break;
+			case OPT_DEFER_INDEX :
+				ctx->defer_index = TRUE;
+				break;
 			case OPT_NO_DEF_OPTS :
 				no_def_opts = TRUE; /* Don't add default options. */
 				ctx->silent = FALSE; /* cancel default silent */
@@ -373,6 +393,15 @@ char *parse_mount_options(ntfs_fuse_context_t *ctx,
 			case OPT_NOCOMPRESSION :
 				ctx->compression = FALSE;
 				break;
+			case OPT_COMPRESSION_LEVEL :
+				if ((intarg < COMPRESSION_LEVEL_FAST)
+				    || (intarg > COMPRESSION_LEVEL_BEST)) {
+					ntfs_log_error("Invalid compression "
+						"level %d.\n", intarg);
+					goto err_exit;
+				}
+				ctx->compression_level = intarg;
+				break;
 			case OPT_SILENT :
 				ctx->silent = TRUE;
 				break;
@@ -515,6 +544,20 @@ char *parse_mount_options(ntfs_fuse_context_t *ctx,
 					goto err_exit;
 				}
 				break;
+			case OPT_TRACE :
+					/* the daemon runs in the root directory */
+				if (val[0] != '/') {
+					ntfs_log_error("The trace file must be"
+						" designated by a full path.\n");
+					goto err_exit;
+				}
+				ctx->trace_path = strdup(val);
+				if (!ctx->trace_path) {
+					ntfs_log_error("no more memory to store "
+						"'trace' option.\n");
+					goto err_exit;
+				}
+				break;
 			case OPT_FSNAME : /* Filesystem name. */
 			/*
 			 * We need this to be able to check whether filesystem
@@ -679,6 +722,60 @@ int ntfs_parse_options(struct ntfs_options *popts, void (*usage)(void),
 	return 0;
 }
 
+/*
+ *		Process the requests until the file system is unmounted
+ *
+ *	This is fuse_session_loop(), except that the deferred index
+ *	blocks are checked after each request, and every second while
+ *	some of them are waiting on an idle mount, so that they are not
+ *	left unwritten for much longer than DEFERRED_INDEX_DELAY seconds.
+ *
+ *	Returns 0 if successful, -1 otherwise
+ */
+
+int ntfs_fuse_loop(struct fuse_session *se, ntfs_volume *vol)
+{
+	struct fuse_chan *ch;
+	struct fuse_chan *tmpch;
+	struct pollfd pfd;
+	size_t bufsize;
+	char *buf;
+	int res;
+
+	ch = fuse_session_next_chan(se, (struct fuse_chan*)NULL);
+	bufsize = fuse_chan_bufsize(ch);
+	buf = (char*)ntfs_malloc(bufsize);
+	if (!buf)
+		return (-1);
+	pfd.fd = fuse_chan_fd(ch);
+	pfd.events = POLLIN;
+	res = 0;
+	while (!fuse_session_exited(se)) {
+		if (ntfs_index_has_deferred(vol)) {
+			res = poll(&pfd, 1, 1000);
+			if (!res)
+				ntfs_index_sync_deferred(vol, FALSE);
+			if ((res < 0) && (errno != EINTR)) {
+				res = -errno;
+				break;
+			}
+			if (res <= 0)
+				continue;
+		}
+		tmpch = ch;
+		res = fuse_chan_recv(&tmpch, buf, bufsize);
+		if (res == -EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		fuse_session_process(se, buf, res, tmpch);
+		ntfs_index_sync_deferred(vol, FALSE);
+	}
+	free(buf);
+	fuse_session_reset(se);
+	return (res < 0 ? -1 : 0);
+}
+
 #ifdef HAVE_SETXATTR
 
 int ntfs_fuse_listxattr_common(ntfs_inode *ni, ntfs_attr_search_ctx *actx,
@@ -70,6 +70,7 @@ enum {
 	OPT_WINDOWS_NAMES,
 	OPT_COMPRESSION,
 	OPT_NOCOMPRESSION,
+	OPT_COMPRESSION_LEVEL,
 	OPT_SILENT,
 	OPT_RECOVER,
 	OPT_NORECOVER,
@@ -94,6 +95,10 @@ enum {
 	OPT_EFS_RAW,
 	OPT_POSIX_NLINK,
 	OPT_SPECIAL_FILES,
+	OPT_TRACE,
+	OPT_DELAY_ALLOC,
+	OPT_PREALLOC,
+	OPT_DEFER_INDEX,
 } ;
 
 			/* Option flags */
@@ -137,6 +142,8 @@ typedef struct {
 	ntfs_fuse_streams_interface streams;
 	ntfs_atime_t atime;
 	s64 dmtime;
+	s64 delay_alloc; /* max bytes appended per file before writing */
+	s64 delayed_total; /* bytes appended and not written yet */
 	BOOL ro;
 	BOOL rw;
 	BOOL show_sys_files;
@@ -145,6 +152,9 @@ typedef struct {
 	BOOL windows_names;
 	BOOL ignore_case;
 	BOOL compression;
+	int compression_level;
+	BOOL prealloc;
+	BOOL defer_index;
 	BOOL acl;
 	BOOL silent;
 	BOOL recover;
@@ -169,6 +179,7 @@ typedef struct {
 	single_log_t errors_logged;
 	char *usermap_path;
 	char *abs_mnt_point;
+	char *trace_path;
 #ifndef DISABLE_PLUGINS
 	plugin_list_t *plugins;
 #endif /* DISABLE_PLUGINS */
@@ -204,6 +215,9 @@ char *parse_mount_options(ntfs_fuse_context_t *ctx,
 int ntfs_parse_options(struct ntfs_options *popts, void (*usage)(void),
 			int argc, char *argv[]);
 
+struct fuse_session;
+int ntfs_fuse_loop(struct fuse_session *se, ntfs_volume *vol);
+
 int ntfs_fuse_listxattr_common(ntfs_inode *ni, ntfs_attr_search_ctx *actx,
  			char *list, size_t size, BOOL prefixing);
 BOOL user_xattrs_allowed(ntfs_fuse_context_t *ctx, ntfs_inode *ni);
@@ -306,15 +306,41 @@ NtfsIsVolumeReadOnly(VOID* NtfsVolume)
  * for, and perform look up to prevent double inode open.
  */
 
-/* A file lookup entry */
+/*
+ * A file lookup entry. Entries are chained on a list of all the
+ * entries (used for cleanup) as well as hashed by path and by inode
+ * number, so that lookups remain fast when the Shell or a bootloader
+ * keeps a large number of files open.
+ */
 typedef struct {
 	LIST_ENTRY* ForwardLink;
 	LIST_ENTRY* BackLink;
+	LIST_ENTRY PathLink;
+	LIST_ENTRY InumLink;
+	UINT32 PathHash;
+	UINT64 Inum;
 	EFI_NTFS_FILE* File;
 } LookupEntry;
 
 /*
- * Look for an existing file instance in our list, either
+ * FNV-1a hash of a path. An empty path designates the root.
+ */
+static UINT32
+NtfsLookupHash(CONST CHAR16* Path)
+{
+	UINT32 Hash = 2166136261U;
+
+	if (Path[0] == 0)
+		Path = L"/";
+	while (*Path != 0)
+		Hash = (Hash ^ *Path++) * 16777619U;
+	return Hash;
+}
+
+#define LOOKUP_BUCKET(Value) ((UINTN)(Value) & (LOOKUP_HASH_SIZE - 1))
+
+/*
+ * Look for an existing file instance in our tables, either
  * by matching a File->Path (if Inum is 0) or the inode
  * number specified in Inum.
  * IgnoreSelf can be used if you want to prevent the file
@@ -326,26 +352,33 @@ typedef struct {
 static EFI_NTFS_FILE*
 NtfsLookup(EFI_NTFS_FILE* File, UINT64 Inum, BOOLEAN IgnoreSelf)
 {
-	LookupEntry* ListHead = (LookupEntry*)&File->FileSystem->LookupListHead;
+	LIST_ENTRY *ListHead, *Link;
 	LookupEntry* Entry;
-	ntfs_inode* ni;
-
-	for (Entry = (LookupEntry*)ListHead->ForwardLink;
-		Entry != ListHead;
-		Entry = (LookupEntry*)Entry->ForwardLink) {
-		FS_ASSERT(Entry->File->NtfsInode != NULL);
-		if (Inum == 0) {
+	UINT32 Hash;
+
+	if (Inum == 0) {
+		Hash = NtfsLookupHash(File->Path);
+		ListHead = &File->FileSystem->LookupPathHash[LOOKUP_BUCKET(Hash)];
+		for (Link = ListHead->ForwardLink; Link != ListHead; Link = Link->ForwardLink) {
+			Entry = BASE_CR(Link, LookupEntry, PathLink);
+			FS_ASSERT(Entry->File->NtfsInode != NULL);
 			/* If IgnoreSelf is active, prevent param from matching */
 			if (IgnoreSelf && Entry->File == File)
 				continue;
+			if (Entry->PathHash != Hash)
+				continue;
 			/* An empty path should return the root */
 			if (File->Path[0] == 0 && Entry->File->IsRoot)
 				return Entry->File;
 			if (StrCmp(File->Path, Entry->File->Path) == 0)
 				return Entry->File;
-		} else {
-			ni = Entry->File->NtfsInode;
-			if (ni->mft_no == GetInodeNumber(Inum))
+		}
+	} else {
+		Inum = GetInodeNumber(Inum);
+		ListHead = &File->FileSystem->LookupInumHash[LOOKUP_BUCKET(Inum)];
+		for (Link = ListHead->ForwardLink; Link != ListHead; Link = Link->ForwardLink) {
+			Entry = BASE_CR(Link, LookupEntry, InumLink);
+			if (Entry->Inum == Inum)
 				return Entry->File;
 		}
 	}
@@ -373,51 +406,102 @@ NtfsLookupParent(EFI_NTFS_FILE* File)
 }
 
 /*
- * Add a new file instance to the lookup list
+ * Return the lookup entry of an open file instance, by
+ * looking it up in the bucket of its current path.
+ */
+static LookupEntry*
+NtfsLookupEntry(EFI_NTFS_FILE* File)
+{
+	LIST_ENTRY *ListHead, *Link;
+	LookupEntry* Entry;
+
+	ListHead = &File->FileSystem->LookupPathHash[LOOKUP_BUCKET(NtfsLookupHash(File->Path))];
+	for (Link = ListHead->ForwardLink; Link != ListHead; Link = Link->ForwardLink) {
+		Entry = BASE_CR(Link, LookupEntry, PathLink);
+		if (Entry->File == File)
+			return Entry;
+	}
+	return NULL;
+}
+
+/*
+ * Initialize the lookup list and tables of a file system
+ */
+static VOID
+NtfsLookupInit(EFI_FS* FileSystem)
+{
+	INTN i;
+
+	InitializeListHead(&FileSystem->LookupListHead);
+	for (i = 0; i < LOOKUP_HASH_SIZE; i++) {
+		InitializeListHead(&FileSystem->LookupPathHash[i]);
+		InitializeListHead(&FileSystem->LookupInumHash[i]);
+	}
+}
+
+/*
+ * Add a new file instance to the lookup tables
  */
 static VOID
 NtfsLookupAdd(EFI_NTFS_FILE* File)
 {
-	LIST_ENTRY* ListHead = &File->FileSystem->LookupListHead;
+	EFI_FS* FileSystem = File->FileSystem;
 	LookupEntry* Entry = AllocatePool(sizeof(LookupEntry));
+	ntfs_inode* ni = File->NtfsInode;
 
 	if (Entry) {
 		Entry->File = File;
-		InsertTailList(ListHead, (LIST_ENTRY*)Entry);
+		Entry->PathHash = NtfsLookupHash(File->Path);
+		Entry->Inum = ni->mft_no;
+		InsertTailList(&FileSystem->LookupListHead, (LIST_ENTRY*)Entry);
+		InsertTailList(&FileSystem->LookupPathHash[LOOKUP_BUCKET(Entry->PathHash)],
+			&Entry->PathLink);
+		InsertTailList(&FileSystem->LookupInumHash[LOOKUP_BUCKET(Entry->Inum)],
+			&Entry->InumLink);
 	}
 }
 
 /*
- * Remove an existing file instance from the lookup list
+ * Rehash an existing file instance, that is about to be renamed to NewPath
+ */
+static VOID
+NtfsLookupMove(EFI_NTFS_FILE* File, CHAR16* NewPath)
+{
+	LookupEntry* Entry = NtfsLookupEntry(File);
+
+	if (Entry) {
+		RemoveEntryList(&Entry->PathLink);
+		Entry->PathHash = NtfsLookupHash(NewPath);
+		InsertTailList(&File->FileSystem->LookupPathHash[LOOKUP_BUCKET(Entry->PathHash)],
+			&Entry->PathLink);
+	}
+}
+
+/*
+ * Remove an existing file instance from the lookup tables
  */
 static VOID
 NtfsLookupRem(EFI_NTFS_FILE* File)
 {
-	LookupEntry* ListHead = (LookupEntry*)&File->FileSystem->LookupListHead;
-	LookupEntry* Entry;
+	LookupEntry* Entry = NtfsLookupEntry(File);
 
-	for (Entry = (LookupEntry*)ListHead->ForwardLink;
-		Entry != ListHead;
-		Entry = (LookupEntry*)Entry->ForwardLink) {
-		if (File == Entry->File) {
-			RemoveEntryList((LIST_ENTRY*)Entry);
-			FreePool(Entry);
-			return;
-		}
+	if (Entry) {
+		RemoveEntryList(&Entry->InumLink);
+		RemoveEntryList(&Entry->PathLink);
+		RemoveEntryList((LIST_ENTRY*)Entry);
+		FreePool(Entry);
 	}
 }
 
 /*
- * Clear the lookup list and free all allocated resources
+ * Clear the lookup tables and free all allocated resources
  */
 static VOID
-NtfsLookupFree(LIST_ENTRY* List)
+NtfsLookupFree(EFI_FS* FileSystem)
 {
-	LookupEntry *ListHead = (LookupEntry*)List, *Entry;
+	LookupEntry *ListHead = (LookupEntry*)&FileSystem->LookupListHead, *Entry;
 
-	for (Entry = (LookupEntry*)ListHead->ForwardLink;
-		Entry != ListHead;
-		Entry = (LookupEntry*)Entry->ForwardLink) {
+	while ((Entry = (LookupEntry*)ListHead->ForwardLink) != ListHead) {
 		RemoveEntryList((LIST_ENTRY*)Entry);
 		FreePool(Entry);
 	}
@@ -511,8 +595,8 @@ NtfsMountVolume(EFI_FS* FileSystem)
 	/* Insert this filesystem in our list so that ntfs_mount() can locate it */
 	InsertTailList(&FsListHead, (LIST_ENTRY*)FileSystem);
 
-	/* Initialize the Lookup List for this volume */
-	InitializeListHead(&FileSystem->LookupListHead);
+	/* Initialize the Lookup tables for this volume */
+	NtfsLookupInit(FileSystem);
 
 	ntfs_log_set_handler(ntfs_log_handler_uefi);
 
@@ -565,7 +649,7 @@ NtfsUnmountVolume(EFI_FS* FileSystem)
 	ntfs_umount(FileSystem->NtfsVolume, FALSE);
 
 	PrintInfo(L"Unmounted volume '%s'\n", FileSystem->NtfsVolumeLabel);
-	NtfsLookupFree(&FileSystem->LookupListHead);
+	NtfsLookupFree(FileSystem);
 	free(FileSystem->NtfsVolumeLabel);
 	FileSystem->NtfsVolumeLabel = NULL;
 	FileSystem->MountCount = 0;
@@ -640,6 +724,411 @@ NtfsFreeFile(EFI_NTFS_FILE* File)
 	}
 }
 
+/*
+ * Return the unnamed data attribute of an open file, which is opened
+ * on first use and kept attached to the file instance until it is
+ * released, so that the runlist only needs to be mapped once.
+ */
+static ntfs_attr*
+NtfsGetData(EFI_NTFS_FILE* File)
+{
+	if (File->NtfsData == NULL)
+		File->NtfsData = ntfs_attr_open(File->NtfsInode, AT_DATA, AT_UNNAMED, 0);
+	return File->NtfsData;
+}
+
+/*
+ * Release the data attribute of an open file. This must be done
+ * before the inode gets closed, deleted or relinked.
+ */
+static VOID
+NtfsReleaseData(EFI_NTFS_FILE* File)
+{
+	ntfs_attr_close(File->NtfsData);
+	File->NtfsData = NULL;
+}
+
+/*
+ * Asynchronous reads
+ *
+ * When the partition exposes DiskIo2, the plain (non resident,
+ * uncompressed and unencrypted) data of a file can be read directly
+ * from the disk, with one request per chunk of each run, so that
+ * several requests are outstanding at the same time. This is used
+ * for ReadEx() calls which come with an event, and to read ahead
+ * the next part of files which are read sequentially.
+ *
+ * The requests are issued at TPL_CALLBACK, which is the level of
+ * their notification functions, so that the counts they share with
+ * the rest of the driver never need any other protection.
+ */
+
+#define ASYNC_CHUNK_SIZE    (1024 * 1024)
+#define READ_AHEAD_MIN      (256 * 1024)
+#define READ_AHEAD_MAX      (4 * 1024 * 1024)
+
+/* A read from a file, made of one or more disk requests */
+typedef struct _NTFS_READ {
+	EFI_FS*             FileSystem;
+	EFI_FILE_IO_TOKEN*  Token;      /* NULL for a read-ahead */
+	UINT8*              Buffer;
+	INT64               Offset;
+	UINTN               Size;
+	INTN                Pending;
+	EFI_STATUS          Status;
+	BOOLEAN             Done;
+	BOOLEAN             Orphan;     /* read-ahead dropped while pending */
+	struct _NTFS_READ*  Waiter;     /* read to serve from the read-ahead */
+} NTFS_READ;
+
+/* A disk request */
+typedef struct {
+	EFI_DISK_IO2_TOKEN  Token;
+	NTFS_READ*          Read;
+} NTFS_DISK_READ;
+
+/*
+ * Get the current task priority level
+ */
+static EFI_TPL
+GetCurrentTpl(VOID)
+{
+	EFI_TPL Tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+
+	gBS->RestoreTPL(Tpl);
+	return Tpl;
+}
+
+/*
+ * Check whether reads can be queued, which requires DiskIo2, and
+ * the completion of requests to be able to interrupt the caller.
+ */
+static BOOLEAN
+NtfsCanQueue(EFI_FS* FileSystem)
+{
+	return FileSystem->DiskIo2 != NULL && GetCurrentTpl() < TPL_CALLBACK;
+}
+
+/*
+ * Allocate a read, its buffer being provided by the caller
+ */
+static NTFS_READ*
+NtfsAllocateRead(EFI_FS* FileSystem, EFI_FILE_IO_TOKEN* Token,
+	VOID* Buffer, INT64 Offset, UINTN Size)
+{
+	NTFS_READ* Read = AllocateZeroPool(sizeof(NTFS_READ));
+
+	if (Read != NULL) {
+		Read->FileSystem = FileSystem;
+		Read->Token = Token;
+		Read->Buffer = Buffer;
+		Read->Offset = Offset;
+		Read->Size = Size;
+		Read->Status = EFI_SUCCESS;
+	}
+	return Read;
+}
+
+/*
+ * Complete a read when all its disk requests are done.
+ * Called at TPL_CALLBACK.
+ */
+static VOID
+NtfsReadComplete(NTFS_READ* Read)
+{
+	NTFS_READ* Waiter;
+
+	if (Read->Token != NULL) {
+		if (EFI_ERROR(Read->Status))
+			Read->Token->BufferSize = 0;
+		Read->Token->Status = Read->Status;
+		gBS->SignalEvent(Read->Token->Event);
+		FreePool(Read);
+		return;
+	}
+
+	/* This is a read-ahead, serve the read which was waiting for it */
+	Read->Done = TRUE;
+	Waiter = Read->Waiter;
+	if (Waiter != NULL) {
+		Read->Waiter = NULL;
+		Waiter->Status = Read->Status;
+		if (!EFI_ERROR(Read->Status))
+			CopyMem(Waiter->Buffer, &Read->Buffer[Waiter->Offset - Read->Offset],
+				Waiter->Size);
+		NtfsReadComplete(Waiter);
+	}
+	if (Read->Orphan) {
+		FreePool(Read->Buffer);
+		FreePool(Read);
+	}
+}
+
+static VOID EFIAPI
+NtfsDiskReadNotify(EFI_EVENT Event, VOID* Context)
+{
+	NTFS_DISK_READ* DiskRead = (NTFS_DISK_READ*)Context;
+	NTFS_READ* Read = DiskRead->Read;
+
+	if (EFI_ERROR(DiskRead->Token.TransactionStatus) && !EFI_ERROR(Read->Status))
+		Read->Status = DiskRead->Token.TransactionStatus;
+	Read->FileSystem->PendingReads--;
+	gBS->CloseEvent(Event);
+	FreePool(DiskRead);
+	if (--Read->Pending == 0)
+		NtfsReadComplete(Read);
+}
+
+/*
+ * Find the run which contains a vcn, starting from a known run
+ */
+static runlist_element*
+NtfsFindRun(runlist_element* rl, VCN vcn)
+{
+	for (; rl->length; rl++) {
+		if (vcn >= rl->vcn && vcn < rl->vcn + rl->length)
+			return rl;
+	}
+	return NULL;
+}
+
+/*
+ * Check whether the unnamed data of a file can be read directly
+ * from the disk, and map its runlist for doing so
+ */
+static BOOLEAN
+NtfsCanReadDirect(ntfs_attr* na)
+{
+	return (na != NULL && NAttrNonResident(na) && !NAttrCompressed(na)
+		&& !NAttrEncrypted(na) && !ntfs_attr_map_whole_runlist(na));
+}
+
+/*
+ * Issue the disk requests for reading the unnamed data of a file.
+ *
+ * The holes and the part beyond the initialized size are zeroed.
+ * The completion of the read is signaled by NtfsReadComplete(),
+ * possibly before returning. EFI_UNSUPPORTED is returned when the
+ * data cannot be read directly from the disk, and nothing has been
+ * issued then.
+ */
+static EFI_STATUS
+NtfsIssueRead(EFI_NTFS_FILE* File, NTFS_READ* Read)
+{
+	EFI_FS* FileSystem = File->FileSystem;
+	ntfs_volume* vol = FileSystem->NtfsVolume;
+	NTFS_DISK_READ* DiskRead;
+	runlist_element* rl;
+	ntfs_attr* na;
+	EFI_STATUS Status, IoStatus;
+	EFI_TPL OldTpl = TPL_APPLICATION;
+	s64 pos, end, len;
+	INTN Pass;
+
+	na = NtfsGetData(File);
+	if (!NtfsCanReadDirect(na))
+		return EFI_UNSUPPORTED;
+
+	/*
+	 * Check the mapping on a first pass, so that nothing is
+	 * issued if some part cannot be read directly.
+	 */
+	Status = EFI_SUCCESS;
+	end = Read->Offset + Read->Size;
+	for (Pass = 0; Pass < 2 && !EFI_ERROR(Status); Pass++) {
+		if (Pass)
+			OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+		rl = na->rl;
+		for (pos = Read->Offset; pos < end && !EFI_ERROR(Status); pos += len) {
+			if (pos >= na->initialized_size) {
+				len = end - pos;
+				if (Pass)
+					ZeroMem(&Read->Buffer[pos - Read->Offset], len);
+				continue;
+			}
+			rl = NtfsFindRun(rl, pos >> vol->cluster_size_bits);
+			if (rl == NULL || (rl->lcn < 0 && rl->lcn != LCN_HOLE)) {
+				Status = EFI_UNSUPPORTED;
+				break;
+			}
+			len = ((rl->vcn + rl->length) << vol->cluster_size_bits) - pos;
+			if (len > end - pos)
+				len = end - pos;
+			if (len > na->initialized_size - pos)
+				len = na->initialized_size - pos;
+			if (len > ASYNC_CHUNK_SIZE)
+				len = ASYNC_CHUNK_SIZE;
+			if (!Pass)
+				continue;
+			if (rl->lcn == LCN_HOLE) {
+				ZeroMem(&Read->Buffer[pos - Read->Offset], len);
+				continue;
+			}
+			DiskRead = AllocateZeroPool(sizeof(NTFS_DISK_READ));
+			if (DiskRead == NULL) {
+				Read->Status = EFI_OUT_OF_RESOURCES;
+				break;
+			}
+			DiskRead->Read = Read;
+			IoStatus = gBS->CreateEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK,
+				NtfsDiskReadNotify, DiskRead, &DiskRead->Token.Event);
+			if (!EFI_ERROR(IoStatus))
+				IoStatus = FileSystem->DiskIo2->ReadDiskEx(FileSystem->DiskIo2,
+					FileSystem->BlockIo->Media->MediaId,
+					(rl->lcn << vol->cluster_size_bits) + pos
+						- (rl->vcn << vol->cluster_size_bits),
+					&DiskRead->Token, len, &Read->Buffer[pos - Read->Offset]);
+			if (EFI_ERROR(IoStatus)) {
+				if (DiskRead->Token.Event != NULL)
+					gBS->CloseEvent(DiskRead->Token.Event);
+				FreePool(DiskRead);
+				Read->Status = IoStatus;
+				break;
+			}
+			Read->Pending++;
+			FileSystem->PendingReads++;
+		}
+	}
+
+	/*
+	 * Failures to issue requests are reported when completing the
+	 * read, the mapping failures have prevented issuing any.
+	 */
+	if (Pass == 2) {
+		if (Read->Pending == 0)
+			NtfsReadComplete(Read);
+		gBS->RestoreTPL(OldTpl);
+	}
+	return Status;
+}
+
+/*
+ * Drop the read-ahead of a file, to be freed on completion if
+ * it is still pending
+ */
+static VOID
+NtfsDropReadAhead(EFI_NTFS_FILE* File)
+{
+	NTFS_READ* Ahead = File->ReadAhead;
+	EFI_TPL OldTpl;
+
+	if (Ahead == NULL)
+		return;
+	File->ReadAhead = NULL;
+	OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+	if (Ahead->Done) {
+		FreePool(Ahead->Buffer);
+		FreePool(Ahead);
+	} else
+		Ahead->Orphan = TRUE;
+	gBS->RestoreTPL(OldTpl);
+}
+
+/*
+ * Start reading ahead from the current position of a file which is
+ * read sequentially, unless the current read-ahead still covers it
+ */
+static VOID
+NtfsReadAhead(EFI_NTFS_FILE* File, UINTN Size)
+{
+	NTFS_READ* Ahead = File->ReadAhead;
+	INT64 DataSize = ((ntfs_inode*)File->NtfsInode)->data_size;
+
+	if (Ahead != NULL && File->Offset >= Ahead->Offset
+		&& File->Offset < Ahead->Offset + (INT64)Ahead->Size)
+		return;
+	NtfsDropReadAhead(File);
+	if (File->Offset >= DataSize || !NtfsCanQueue(File->FileSystem))
+		return;
+	/* Do not allocate a buffer which could not be filled directly */
+	if (!NtfsCanReadDirect(NtfsGetData(File)))
+		return;
+
+	if (Size < READ_AHEAD_MIN)
+		Size = READ_AHEAD_MIN;
+	if (Size > READ_AHEAD_MAX)
+		Size = READ_AHEAD_MAX;
+	if ((INT64)Size > DataSize - File->Offset)
+		Size = (UINTN)(DataSize - File->Offset);
+	Ahead = NtfsAllocateRead(File->FileSystem, NULL, NULL, File->Offset, Size);
+	if (Ahead == NULL)
+		return;
+	Ahead->Buffer = AllocatePool(Size);
+	if (Ahead->Buffer != NULL && NtfsIssueRead(File, Ahead) == EFI_SUCCESS) {
+		File->ReadAhead = Ahead;
+	} else {
+		if (Ahead->Buffer != NULL)
+			FreePool(Ahead->Buffer);
+		FreePool(Ahead);
+	}
+}
+
+/*
+ * Serve a read from the read-ahead of a file, when it covers it.
+ *
+ * Without a token, wait for the read-ahead to complete. With a token,
+ * the read is completed along with the read-ahead.
+ */
+static BOOLEAN
+NtfsReadFromReadAhead(EFI_NTFS_FILE* File, VOID* Data, UINTN Size,
+	EFI_FILE_IO_TOKEN* Token)
+{
+	NTFS_READ *Ahead = File->ReadAhead, *Waiter;
+	BOOLEAN Served = FALSE;
+	EFI_TPL OldTpl;
+
+	if (Ahead == NULL || File->Offset < Ahead->Offset
+		|| File->Offset + (INT64)Size > Ahead->Offset + (INT64)Ahead->Size)
+		return FALSE;
+
+	if (Token == NULL) {
+		if (!Ahead->Done && GetCurrentTpl() >= TPL_CALLBACK)
+			return FALSE;
+		while (!Ahead->Done)
+			gBS->Stall(10);
+		if (EFI_ERROR(Ahead->Status))
+			return FALSE;
+		CopyMem(Data, &Ahead->Buffer[File->Offset - Ahead->Offset], Size);
+		return TRUE;
+	}
+
+	OldTpl = gBS->RaiseTPL(TPL_CALLBACK);
+	if (Ahead->Done) {
+		if (!EFI_ERROR(Ahead->Status)) {
+			CopyMem(Data, &Ahead->Buffer[File->Offset - Ahead->Offset], Size);
+			Token->Status = EFI_SUCCESS;
+			gBS->SignalEvent(Token->Event);
+			Served = TRUE;
+		}
+	} else if (Ahead->Waiter == NULL) {
+		Waiter = NtfsAllocateRead(File->FileSystem, Token, Data, File->Offset, Size);
+		if (Waiter != NULL) {
+			Ahead->Waiter = Waiter;
+			Served = TRUE;
+		}
+	}
+	gBS->RestoreTPL(OldTpl);
+	return Served;
+}
+
+/*
+ * Cancel the pending disk reads of a volume, and wait for their
+ * completion when possible
+ */
+VOID
+NtfsCancelReads(EFI_FS* FileSystem)
+{
+	if (FileSystem->DiskIo2 == NULL || FileSystem->PendingReads == 0)
+		return;
+	FileSystem->DiskIo2->Cancel(FileSystem->DiskIo2);
+	if (GetCurrentTpl() < TPL_CALLBACK) {
+		while (FileSystem->PendingReads > 0)
+			gBS->Stall(10);
+	}
+	if (FileSystem->PendingReads > 0)
+		PrintWarning(L"%d disk reads still pending\n", FileSystem->PendingReads);
+}
+
 /*
  * Open or reopen a file instance
  */
@@ -683,6 +1172,8 @@ NtfsCloseFile(EFI_NTFS_FILE* File)
 
 	if (File == NULL || File->NtfsInode == NULL)
 		return;
+	NtfsDropReadAhead(File);
+	NtfsReleaseData(File);
 	/*
 	 * If the inode is dirty, ntfs_inode_close() will issue an
 	 * ntfs_inode_sync() which may try to open the parent inode.
@@ -735,10 +1226,11 @@ NtfsReadFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 {
 	ntfs_attr* na = NULL;
 	s64 max_read, size = *Len;
+	BOOLEAN Sequential = (File->Offset == File->ReadEnd);
 
 	*Len = 0;
 
-	na = ntfs_attr_open(File->NtfsInode, AT_DATA, AT_UNNAMED, 0);
+	na = NtfsGetData(File);
 	if (!na) {
 		PrintError(L"%a failed: %a\n", __FUNCTION__, strerror(errno));
 		return ErrnoToEfiStatus();
@@ -748,12 +1240,17 @@ NtfsReadFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 	if (File->Offset + size > max_read) {
 		if (File->Offset > max_read) {
 			/* Per UEFI specs */
-			ntfs_attr_close(na);
 			return EFI_DEVICE_ERROR;
 		}
 		size = max_read - File->Offset;
 	}
 
+	if (NtfsReadFromReadAhead(File, Data, (UINTN)size, NULL)) {
+		File->Offset += size;
+		*Len = (UINTN)size;
+		size = 0;
+	}
+
 	while (size > 0) {
 		s64 ret = ntfs_attr_pread(na, File->Offset, size, &((UINT8*)Data)[*Len]);
 		if (ret != size)
@@ -761,7 +1258,6 @@ NtfsReadFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 				((ntfs_inode*)File->NtfsInode)->mft_no,
 				File->Offset, *Len, ret);
 		if (ret <= 0 || ret > size) {
-			ntfs_attr_close(na);
 			if (ret >= 0)
 				errno = EIO;
 			PrintError(L"%a failed: %a\n", __FUNCTION__, strerror(errno));
@@ -772,7 +1268,50 @@ NtfsReadFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 		*Len += ret;
 	}
 
-	ntfs_attr_close(na);
+	if (Sequential)
+		NtfsReadAhead(File, *Len);
+	File->ReadEnd = File->Offset;
+
+	if (!NtfsIsVolumeReadOnly(File->FileSystem->NtfsVolume))
+		ntfs_inode_update_times(File->NtfsInode, NTFS_UPDATE_MCTIME);
+
+	return EFI_SUCCESS;
+}
+
+/*
+ * Queue a read from an open file, the completion being signaled
+ * through the event of the token. EFI_UNSUPPORTED is returned when
+ * the read cannot be queued, and has to be done synchronously.
+ */
+EFI_STATUS
+NtfsReadFileEx(EFI_NTFS_FILE* File, EFI_FILE_IO_TOKEN* Token)
+{
+	NTFS_READ* Read;
+	INT64 DataSize = ((ntfs_inode*)File->NtfsInode)->data_size;
+	BOOLEAN Sequential = (File->Offset == File->ReadEnd);
+
+	if (!NtfsCanQueue(File->FileSystem) || File->Offset > DataSize)
+		return EFI_UNSUPPORTED;
+
+	if (File->Offset + (INT64)Token->BufferSize > DataSize)
+		Token->BufferSize = (UINTN)(DataSize - File->Offset);
+
+	if (!NtfsReadFromReadAhead(File, Token->Buffer, Token->BufferSize, Token)) {
+		Read = NtfsAllocateRead(File->FileSystem, Token, Token->Buffer,
+			File->Offset, Token->BufferSize);
+		if (Read == NULL)
+			return EFI_UNSUPPORTED;
+		if (NtfsIssueRead(File, Read) != EFI_SUCCESS) {
+			FreePool(Read);
+			return EFI_UNSUPPORTED;
+		}
+	}
+
+	/* The position is that of the end of the queued read */
+	File->Offset += Token->BufferSize;
+	if (Sequential)
+		NtfsReadAhead(File, Token->BufferSize);
+	File->ReadEnd = File->Offset;
 
 	if (!NtfsIsVolumeReadOnly(File->FileSystem->NtfsVolume))
 		ntfs_inode_update_times(File->NtfsInode, NTFS_UPDATE_MCTIME);
@@ -1046,6 +1585,9 @@ NtfsDeleteFile(EFI_NTFS_FILE* File)
 	if (dir_ni->mft_no == FILE_Extend)
 		return EFI_ACCESS_DENIED;
 
+	NtfsDropReadAhead(File);
+	NtfsReleaseData(File);
+
 	/* Delete the file */
 	r = ntfs_delete(File->FileSystem->NtfsVolume, NULL, File->NtfsInode,
 		dir_ni, File->BaseName, SafeStrLen(File->BaseName));
@@ -1092,7 +1634,10 @@ NtfsWriteFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 	if (ni->flags & FILE_ATTR_READONLY)
 		return EFI_WRITE_PROTECTED;
 
-	na = ntfs_attr_open(File->NtfsInode, AT_DATA, AT_UNNAMED, 0);
+	/* The data read ahead may be overwritten */
+	NtfsDropReadAhead(File);
+
+	na = NtfsGetData(File);
 	if (!na) {
 		PrintError(L"%a failed (open): %a\n", __FUNCTION__, strerror(errno));
 		return ErrnoToEfiStatus();
@@ -1101,7 +1646,6 @@ NtfsWriteFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 	while (size > 0) {
 		s64 ret = ntfs_attr_pwrite(na, File->Offset, size, &((UINT8*)Data)[*Len]);
 		if (ret <= 0) {
-			ntfs_attr_close(na);
 			if (ret >= 0)
 				errno = EIO;
 			PrintError(L"%a failed (write): %a\n", __FUNCTION__, strerror(errno));
@@ -1112,8 +1656,6 @@ NtfsWriteFile(EFI_NTFS_FILE* File, VOID* Data, UINTN* Len)
 		*Len += ret;
 	}
 
-	ntfs_attr_close(na);
-
 	ntfs_inode_update_times(File->NtfsInode, NTFS_UPDATE_MCTIME);
 
 	return EFI_SUCCESS;
@@ -1213,6 +1755,7 @@ NtfsMoveFile(EFI_NTFS_FILE* File, CHAR16* NewPath)
 	NewPath[Len] = PATH_CHAR;
 
 	/* Create the target */
+	NtfsReleaseData(File);
 	ni = File->NtfsInode;
 	if (ntfs_link(ni, SameDir ? parent_ni : newparent_ni, &NewPath[Len + 1], StrLen(&NewPath[Len + 1]))) {
 		Status = ErrnoToEfiStatus();
@@ -1220,6 +1763,7 @@ NtfsMoveFile(EFI_NTFS_FILE* File, CHAR16* NewPath)
 	}
 
 	/* Set the new FileName and BaseName */
+	NtfsLookupMove(File, NewPath);
 	OldPath = File->Path;
 	OldBaseName = File->BaseName;
 	File->Path = NewPath;
@@ -1348,13 +1892,13 @@ NtfsSetFileInfo(EFI_NTFS_FILE* File, EFI_FILE_INFO* Info, BOOLEAN ReadOnly)
 		/* Non attribute change of read-only file */
 		if (ReadOnly)
 			return EFI_ACCESS_DENIED;
-		na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+		NtfsDropReadAhead(File);
+		na = NtfsGetData(File);
 		if (!na) {
 			PrintError(L"%a ntfs_attr_open failed: %a\n", __FUNCTION__, strerror(errno));
 			return ErrnoToEfiStatus();
 		}
 		r = ntfs_attr_truncate(na, Info->FileSize);
-		ntfs_attr_close(na);
 		if (r) {
 			PrintError(L"%a ntfs_attr_truncate failed: %a\n", __FUNCTION__, strerror(errno));
 			return ErrnoToEfiStatus();
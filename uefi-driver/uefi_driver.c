@@ -269,7 +269,9 @@ FSBindingStop(EFI_DRIVER_BINDING_PROTOCOL* This,
 	Instance = BASE_CR(FileIoInterface, EFI_FS, FileIoInterface);
 
 	/* Perform target file system cleanup */
-	FSUninstall(Instance, ControllerHandle);
+	Status = FSUninstall(Instance, ControllerHandle);
+	if (EFI_ERROR(Status))
+		return Status;
 
 	gBS->CloseProtocol(ControllerHandle, &gEfiDiskIo2ProtocolGuid,
 		This->DriverBindingHandle, ControllerHandle);
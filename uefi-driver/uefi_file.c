@@ -381,11 +381,40 @@ FileRead(EFI_FILE_HANDLE This, UINTN* Len, VOID* Data)
 	return NtfsReadFile(File, Data, Len);
 }
 
-/* Ex version */
+/**
+ * Read from file, asynchronously when the token has an event
+ *
+ * @v This			File handle
+ * @v Token			Token holding the buffer, its size and the event
+ * @ret Status		EFI status code
+ *
+ * File data is queued as disk requests when possible, otherwise
+ * the read is done synchronously before signaling the event.
+ */
 EFI_STATUS EFIAPI
 FileReadEx(IN EFI_FILE_PROTOCOL *This, IN OUT EFI_FILE_IO_TOKEN *Token)
 {
-	return FileRead(This, &(Token->BufferSize), Token->Buffer);
+	EFI_STATUS Status;
+	EFI_NTFS_FILE* File = BASE_FILE(This);
+
+	if (Token->Event == NULL)
+		return FileRead(This, &(Token->BufferSize), Token->Buffer);
+
+	PrintExtra(L"ReadEx(" PERCENT_P L"|'%s', %d) %s\n", (UINTN)This, File->Path,
+		Token->BufferSize, File->IsDir ? L"<DIR>" : L"");
+
+	if (File->NtfsInode != NULL && !File->IsDir) {
+		Status = NtfsReadFileEx(File, Token);
+		if (Status != EFI_UNSUPPORTED)
+			return Status;
+	}
+
+	Status = FileRead(This, &(Token->BufferSize), Token->Buffer);
+	if (!EFI_ERROR(Status)) {
+		Token->Status = Status;
+		gBS->SignalEvent(Token->Event);
+	}
+	return Status;
 }
 
 /**
@@ -420,11 +449,23 @@ FileWrite(EFI_FILE_HANDLE This, UINTN* Len, VOID* Data)
 	return NtfsWriteFile(File, Data, Len);
 }
 
-/* Ex version */
+/*
+ * Ex version
+ *
+ * Writes may allocate clusters and update the MFT, which libntfs-3g
+ * can only do synchronously, so the event is signaled on return.
+ */
 EFI_STATUS EFIAPI
 FileWriteEx(IN EFI_FILE_PROTOCOL* This, EFI_FILE_IO_TOKEN* Token)
 {
-	return FileWrite(This, &(Token->BufferSize), Token->Buffer);
+	EFI_STATUS Status;
+
+	Status = FileWrite(This, &(Token->BufferSize), Token->Buffer);
+	if (Token->Event != NULL && !EFI_ERROR(Status)) {
+		Token->Status = Status;
+		gBS->SignalEvent(Token->Event);
+	}
+	return Status;
 }
 
 /**
@@ -844,11 +885,22 @@ FSInstall(EFI_FS* This, EFI_HANDLE ControllerHandle)
 }
 
 /* Uninstall EFI simple file system protocol */
-VOID
+EFI_STATUS
 FSUninstall(EFI_FS* This, EFI_HANDLE ControllerHandle)
 {
 	PrintInfo(L"FSUninstall: %s\n", This->DevicePathString);
 
+	/*
+	 * The notifications of pending reads refer to this instance
+	 * and to the buffers of the volume, so they must be over
+	 * before unmounting, and the instance must be kept otherwise.
+	 */
+	NtfsCancelReads(This);
+	if (This->PendingReads > 0) {
+		PrintError(L"Disk reads are still pending, cannot uninstall\n");
+		return EFI_DEVICE_ERROR;
+	}
+
 	if (This->TotalRefCount > 0) {
 		PrintWarning(L"Files are still open on this volume! Forcing unmount...\n");
 		NtfsUnmountVolume(This);
@@ -857,4 +909,5 @@ FSUninstall(EFI_FS* This, EFI_HANDLE ControllerHandle)
 	gBS->UninstallMultipleProtocolInterfaces(ControllerHandle,
 		&gEfiSimpleFileSystemProtocolGuid, &This->FileIoInterface,
 		NULL);
+	return EFI_SUCCESS;
 }